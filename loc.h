@@ -6,20 +6,215 @@
  *
  *   // Load from file
  *   loc_file loc = loc_load("strings.en.loc");
- *   
+ *
+ *   // Or map it read-only instead of copying it into memory. Pages are shared
+ *   // between processes that map the same file and only faulted in when touched.
+ *   loc_file loc = loc_load_mapped("strings.en.loc");
+ *
  *   // Get strings by English key
  *   const char *text = loc_get_string(&loc, "hello");
- *   
+ *
+ *   // Or by the key's id from a header made with loc_gen --header, no hashing or compares at all
+ *   const char *text = loc_get_by_id(&loc, LOC_KEY_HELLO);
+ *
+ *   // Or with a hash computed ahead of time (LOC_HASH_HELLO, or loc_hash64_constexpr in C++)
+ *   const char *text = loc_get_string_hashed(&loc, "hello", LOC_HASH_HELLO);
+ *
+ *   // With loc_gen --shared-keys the keys and index live in one file and every language attaches to it.
+ *   // The attached view borrows both files, free them (not the view) once no view is used anymore.
+ *   loc_file keys = loc_load_mapped("strings.keys.loc");
+ *   loc_file fr_values = loc_load("strings.fr.loc");
+ *   loc_file fr = loc_attach(&keys, &fr_values);
+ *   const char *text = loc_get_string(&fr, "hello");
+ *
+ *   // Or every language from one bundle (loc_gen --bundle), mapped once. Languages are views into the
+ *   // bundle, no reads or allocations. Don't loc_free them, loc_bundle_close the bundle instead.
+ *   loc_bundle bundle = loc_bundle_open("strings.bundle.loc");
+ *   loc_file fr = loc_bundle_get_language(&bundle, "fr");
+ *
+ *   // Or a table that can be swapped out while other threads read it. Each reader thread registers once,
+ *   // then brackets its lookups with enter/leave. Strings stay valid until that reader's loc_handle_leave,
+ *   // even if loc_handle_reload published a new table in the meantime.
+ *   loc_handle *handle = loc_handle_open("strings.fr.loc", LOC_LOAD_MMAP);
+ *   int reader = loc_handle_register_reader(handle);     // per thread
+ *   loc_file *fr = loc_handle_enter(handle, reader);
+ *   const char *text = loc_get_string(fr, "hello");
+ *   loc_handle_leave(handle, reader);                     // text isn't safe to use after this
+ *   loc_handle_reload(handle, "strings.fr.loc");          // from one thread at a time
+ *
+ *   // Over-the-air updates: a patch from loc_gen --diff goes in front of the loaded file, without copying or
+ *   // rebuilding it. The patch isn't copied either, keep it around as long as the file is used.
+ *   loc_apply_patch(&loc, patch_data, patch_size);
+ *
+ *   // Keys looked up over and over, by the address of the key: each thread remembers the last LOC_LOOKUP_CACHE_SIZE
+ *   // answers, a repeat costs a compare instead of a hash and an index probe. Only for keys whose text never
+ *   // changes at that address, like string literals. Loading, freeing, reloading or patching a table never
+ *   // returns its old answers. loc_get_cache_stats has this thread's hits and misses.
+ *   const char *text = loc_get_string_cached(&loc, "hello");
+ *
+ *   // With loc_gen --fallback=pt-BR:pt,pt:en a key pt-BR doesn't translate already has pt's (or en's) string in
+ *   // strings.pt-BR.loc, the lookup above never misses for it. loc_is_fallback tells the two apart.
+ *   int untranslated = loc_is_fallback(&loc, "hello");
+ *
+ *   // Strings with placeholders: "{sender} sent you {count} messages" -> "Ana sent you 3 messages". loc_gen --templates parses
+ *   // them once when it makes the file and loc_format only copies (without it only {0}, {1}... work). Truncates like snprintf.
+ *   const char *args[] = { "Ana", "3" };
+ *   char text[256];
+ *   loc_format(&loc, "messages_received", args, 2, text, sizeof(text));
+ *
+ *   // Plural forms (loc_gen --plurals): the row "[one] {0} file [other] {0} files | ..." is one key, "{0} files", with a form
+ *   // per category. The language's CLDR rules, compiled into the file, pick the form for the count. One lookup.
+ *   const char *files = loc_get_plural(&loc, "{0} files", count);
+ *
+ *   // Many keys at once, their cache misses overlap instead of happening one after the other
+ *   const char *keys[] = { "hello", "goodbye" };
+ *   const char *texts[2];
+ *   loc_get_strings(&loc, keys, 2, texts);
+ *
  *   // Clean up when done
  *   loc_free(&loc);
  *
- * FILE FORMAT:
+ *   // Files made with loc_gen --compress decompress a block of strings the first time a lookup needs it.
+ *   // Strings from them stay valid for the next LOC_BLOCK_CACHE_SIZE - 1 lookups on the same loc_file
+ *   // (or until loc_free), copy the ones you keep longer. loc_get_strings counts as one lookup per key.
+ *   // With --dedup or --share-suffixes a key and its string can be in two blocks, so it's LOC_BLOCK_CACHE_SIZE / 2 - 1.
+ *   // A compressed loc_file can't be shared between threads, and can't be bundled, attached or put in a loc_handle.
+ *
+ *   // Lookup statistics, when the implementation is compiled with LOC_STATS defined (zeros otherwise).
+ *   // Each thread counts on its own, the snapshot adds them up.
+ *   loc_stats stats = loc_stats_snapshot();
+ *   printf("%llu lookups, %llu misses\n", (unsigned long long)stats.lookups, (unsigned long long)stats.misses);
+ *
+ *   Flat index lookups scan groups with SSE2 or NEON when the compiler targets them.
+ *   Define LOC_NO_SIMD before including to use the portable version instead.
+ *
+ * FILE FORMAT (version 4):
+ *   Every number is little-endian. Offsets and sizes inside sections are offset_size bytes: 4, or 8 when
+ *   the header has LOC_FLAG_WIDE_OFFSETS (only needed once strings or the bucket list pass 4 GB).
+ *   The loader reads the file in place, it only checks that the header and the sections add up.
+ *
+ *   [magic]                    - 4 bytes, "LOCF".
+ *   [version]                  - (uint32_t) 4.
+ *   [flags]                    - (uint32_t) LOC_FLAG_* bits, select which index the file uses.
+ *   [section_count]            - (uint32_t) number of entries in the section directory.
+ *   [file_size]                - (uint64_t) size of the whole file in bytes, catches truncated files.
+ *   [section_directory]        - section_count * { id (uint32_t), reserved (uint32_t), offset (uint64_t), size (uint64_t) }.
+ *                                Offsets are relative to start of file.
+ *   [sections]                 - each section starts on an 8 byte boundary.
+ *
+ *   LOC_SECTION_STRINGS            - each entry is: english_key (null-terminated) + localized_string (null-terminated)
+ *
+ *   LOC_SECTION_IDS                - (offset array), one offset into strings per input row, pointing at the localized string.
+ *                                    A key's id is its row in the input file, see loc_gen --header.
+ *
+ *   Every index points at strings through entries, LOC_ENTRY_SIZE bytes:
+ *     { hash (uint32_t), key_len (uint32_t), value_len (uint32_t), offset (uint32_t) }
+ *   or LOC_WIDE_ENTRY_SIZE bytes with LOC_FLAG_WIDE_OFFSETS:
+ *     { hash (uint32_t), key_len (uint32_t), value_len (uint32_t), reserved (uint32_t), offset (uint64_t) }
+ *   hash is the high half of loc_hash64(key) and offset is relative to start of strings.
+ *   The high bit of key_len is LOC_ENTRY_FALLBACK: the key had no translation and the string was taken from a
+ *   fallback language (loc_gen --fallback). Only files with LOC_FLAG_FALLBACK have it set, never keys or value files.
+ *   The next bit is LOC_ENTRY_PLURAL (LOC_FLAG_PLURALS, keys files too): the string is followed by the key's other plural
+ *   forms, see below. The length is key_len & LOC_ENTRY_KEY_LEN_MASK.
+ *
+ *   Chained index (default), buckets are picked with loc_hash64(key) % bucket_count:
+ *   LOC_SECTION_BUCKET_OFFSETS     - (offset array), one offset per bucket. Offsets are relative to start of bucket_list.
+ *   LOC_SECTION_BUCKET_LIST        - each bucket is: entry_count (offset) + entries (count * entry).
+ *
+ *   Minimal perfect hash index (LOC_FLAG_MPH), every key has exactly one slot:
+ *   LOC_SECTION_MPH_DISPLACEMENTS  - (uint32_t array), one displacement per mph bucket. The bucket is (loc_hash64(key) >> 32) % bucket_count.
+ *   LOC_SECTION_MPH_SLOTS          - (entry array), one entry per slot. The slot is loc_mph_slot(hash, displacement, slot_count).
+ *
+ *   Flat open addressing index (LOC_FLAG_FLAT), slots come in groups of LOC_GROUP_SIZE:
+ *   LOC_SECTION_FLAT_CONTROL       - (uint8_t array), one control byte per slot. LOC_CTRL_EMPTY or the low 7 bits of loc_hash64(key).
+ *   LOC_SECTION_FLAT_SLOTS         - (entry array), one entry per slot. The slot count is a power of two.
+ *   Probing starts at group (hash >> 7) & (group_count - 1) and moves 1, 2, 3... groups further each step.
+ *   Groups fill up front to back, so the first empty slot in a group ends the search.
+ *
+ *   Shared keys (loc_gen --shared-keys), the keys and index are stored once for all languages:
+ *   keys file (LOC_FLAG_KEYS)      - LOC_SECTION_STRINGS holds english_key (null-terminated) per row, LOC_SECTION_IDS points at them.
+ *                                    Index entries have the key's row where value_len would be.
+ *   value file (LOC_FLAG_VALUES)   - LOC_SECTION_STRINGS holds localized_string (null-terminated) per row,
+ *                                    LOC_SECTION_IDS points at them. No index, loc_attach one to a keys file.
+ *
+ *   Deduplicated strings (loc_gen --dedup, LOC_FLAG_DEDUP):
+ *   LOC_SECTION_STRINGS            - english_key (null-terminated) per row, then every distinct localized_string once (null-terminated).
+ *                                    Rows with the same translation point at the same one, and with --share-suffixes a translation
+ *                                    that's the end of another points into it.
+ *   LOC_SECTION_IDS                - points at the row's localized string, like in any other file.
+ *   Index entries point at the key and have the key's row where value_len would be, like in a keys file.
+ *   Value files made with --shared-keys --dedup share their localized strings the same way, without the flag.
+ *
+ *   Compressed strings (loc_gen --compress, LOC_FLAG_COMPRESSED), instead of LOC_SECTION_STRINGS:
+ *   LOC_SECTION_BLOCKS             - the strings section cut into blocks of whole entries, each compressed on its own in the LZ4 block format.
+ *   LOC_SECTION_BLOCK_TABLE        - (block_count + 1) * { start in the strings (uint64_t), start in blocks (uint64_t) }, the last one
+ *                                    is the end of both. Offsets everywhere else still point into the uncompressed strings.
+ *   LOC_SECTION_DICTIONARY         - bytes every block is decompressed after, LZ4 matches can point back into it. May be empty.
+ *
+ *   Format templates (loc_gen --templates, LOC_FLAG_TEMPLATES), the placeholders of every localized string that has any:
+ *   LOC_SECTION_TEMPLATE_SLOTS     - slot_count * { value_offset (uint64_t), template_offset (uint64_t) }, a power of two. A string's
+ *                                    template starts at slot loc_mix64(value_offset) & (slot_count - 1) and moves one slot further
+ *                                    until it finds LOC_TEMPLATE_EMPTY_SLOT. value_offset is where the string is in the strings (the
+ *                                    value file's with --shared-keys), the same offset the id table has. Strings without one have no
+ *                                    placeholders. Both sections are left out if no string has any.
+ *   LOC_SECTION_TEMPLATES          - each template is: value_len (uint32_t), literal_len (uint32_t), op_count (uint32_t), op_count ops (uint32_t).
+ *                                    literal_len is how many of the string's bytes end up in the result. An op is kind (low 2 bits):
+ *                                    LOC_OP_LITERAL or LOC_OP_SKIP with n in the other 30 bits, LOC_OP_ARG with the argument in bits 2-17
+ *                                    and n in bits 18-31. Ops go through the string in order and take all value_len bytes of it.
+ *
+ *   Plural forms (loc_gen --plurals, LOC_FLAG_PLURALS). A localized string of an entry with LOC_ENTRY_PLURAL is form_count strings,
+ *   each null-terminated, one after the other: the "other" form, then the language's other categories in CLDR's order (zero, one,
+ *   two, few, many). value_len covers all of them. An empty form means the "other" form. A language file has its rules in:
+ *   LOC_SECTION_PLURAL_RULES       - form_count (uint32_t), table_size (uint32_t, a multiple of 4), table_size * form (uint8_t) for
+ *                                    n = 0..table_size - 1, then for n past the table the condition of forms 1..form_count - 1:
+ *                                    or_count, then or_count groups of and_count, then and_count relations of modulus (0 for none),
+ *                                    negate, range_count, range_count * { low, high }, all uint32_t. n takes the first form whose
+ *                                    condition holds, form 0 if none does: a condition holds if one of its groups does, a group if
+ *                                    all of its relations do, a relation if n (% modulus) is in one of the ranges, or with negate isn't.
+ *
+ *   Version 2 and 3 files (native size_t fields) are not loaded, run loc_gen again.
+ *
+ * BUNDLE FORMAT (loc_gen --bundle, version 1):
+ *   [magic]                    - 4 bytes, "LOCB".
+ *   [version]                  - (uint32_t) 1.
+ *   [language_count]           - (uint32_t) number of entries in the language directory.
+ *   [reserved]                 - (uint32_t) 0.
+ *   [file_size]                - (uint64_t) size of the whole bundle in bytes.
+ *   [language_directory]       - language_count * { code (16 bytes, null-padded), offset (uint64_t), size (uint64_t) }.
+ *   [languages]                - each one is a whole version 4 file as described above, starting on a LOC_BUNDLE_ALIGNMENT boundary.
+ *   A --shared-keys bundle has the keys file as language LOC_BUNDLE_KEYS and value files for the real languages.
+ *
+ * PATCH FORMAT (loc_gen --diff, version 1):
+ *   A patch holds the keys that changed between two files made from the same input with the same options
+ *   (base and new), laid out so it can be looked up where it is.
+ *   [magic]                    - 4 bytes, "LOCP".
+ *   [version]                  - (uint32_t) 1.
+ *   [flags]                    - (uint32_t) LOC_PATCH_IDS if the patch has every id whose key or string changed, then it
+ *                                answers loc_get_by_id too. loc_gen always sets it.
+ *   [entry_count]              - (uint32_t) number of entries.
+ *   [file_size]                - (uint64_t) size of the whole patch in bytes.
+ *   [base_strings_size]        - (uint64_t) size of the base file's strings section, to catch patches for another file.
+ *   [base_id_count]            - (uint32_t) number of ids in the base file.
+ *   [id_count]                 - (uint32_t) number of ids in the new file.
+ *   [slot_count]               - (uint32_t) size of the slot table, a power of two.
+ *   [reserved]                 - (uint32_t) 0.
+ *   [entries]                  - entry_count * { hash (uint64_t), id (uint32_t), flags (uint32_t), key_len (uint32_t),
+ *                                value_len (uint32_t), offset (uint64_t) }. hash is loc_hash64(key), offset is relative to
+ *                                start of strings. Entries with an id come first, sorted by id, the rest have LOC_PATCH_NO_ID.
+ *                                Entries with LOC_PATCH_ENTRY_KEY are found by key, the others (a repeated key's row) only by id.
+ *   [slots]                    - slot_count * (uint32_t), 0 or the index + 1 of a key entry. A key starts at slot
+ *                                loc_hash64(key) & (slot_count - 1) and moves one slot further until it finds an empty one.
+ *   [strings]                  - each entry is: english_key (null-terminated) + localized_string (null-terminated),
+ *                                the localized string is empty for a removed key.
+ *
+ * FILE FORMAT (version 1, no header, still loaded):
  *   [bucket_offset_table_size] - (size_t) size of bucket_offset_table in bytes.
  *   [bucket_offset_table]      - (size_t array), one offset per bucket. Offsets are relative to start of bucket_list.
  *   [bucket_list_size]         - (size_t) size of bucket_list in bytes.
  *   [bucket_list]              - each bucket is: offset_count (size_t) + offsets_to_strings (count * size_t) offsets are relative to start of strings.
  *   [strings_size]             - (size_t) size of the strings section in bytes.
  *   [strings]                  - each entry is: english_key (null-terminated) + localized_string (null-terminated)
+ *   Buckets are picked with the 32 bit FNV-1a hash of the key % bucket_count.
  *
  * LICENSE:
  *   MIT.
@@ -50,22 +245,271 @@
 extern "C" {
 #endif
 
+/* loc_load_flags flags */
+#define LOC_LOAD_MMAP 0x1 /* map the file read-only instead of reading it into a heap buffer */
+
+/* file header */
+#define LOC_MAGIC "LOCF"
+#define LOC_VERSION 4
+#define LOC_HEADER_SIZE 24
+#define LOC_DIRECTORY_ENTRY_SIZE 24
+
+/* header flags */
+#define LOC_FLAG_MPH 0x1 /* index is a minimal perfect hash instead of chained buckets */
+#define LOC_FLAG_FLAT 0x2 /* index is a flat open addressing table instead of chained buckets */
+#define LOC_FLAG_WIDE_OFFSETS 0x4 /* offsets are 64 bit instead of 32 bit */
+#define LOC_FLAG_KEYS 0x8 /* keys and index only, see loc_attach */
+#define LOC_FLAG_VALUES 0x10 /* one language's values only, see loc_attach */
+#define LOC_FLAG_COMPRESSED 0x20 /* strings are in compressed blocks */
+#define LOC_FLAG_DEDUP 0x40 /* values are shared between rows and found through the id table */
+#define LOC_FLAG_FALLBACK 0x80 /* some entries have LOC_ENTRY_FALLBACK, see loc_is_fallback */
+#define LOC_FLAG_TEMPLATES 0x100 /* placeholders are compiled, a string without a template has none, see loc_format */
+#define LOC_FLAG_PLURALS 0x200 /* some entries have LOC_ENTRY_PLURAL, a language file has its plural rules, see loc_get_plural */
+
+/* section ids */
+#define LOC_SECTION_STRINGS 1
+#define LOC_SECTION_BUCKET_OFFSETS 2
+#define LOC_SECTION_BUCKET_LIST 3
+#define LOC_SECTION_MPH_DISPLACEMENTS 4
+#define LOC_SECTION_MPH_SLOTS 5
+#define LOC_SECTION_FLAT_CONTROL 6
+#define LOC_SECTION_FLAT_SLOTS 7
+#define LOC_SECTION_IDS 8
+#define LOC_SECTION_BLOCKS 9
+#define LOC_SECTION_BLOCK_TABLE 10
+#define LOC_SECTION_DICTIONARY 11
+#define LOC_SECTION_TEMPLATE_SLOTS 12
+#define LOC_SECTION_TEMPLATES 13
+#define LOC_SECTION_PLURAL_RULES 14
+
+/* flat index */
+#define LOC_GROUP_SIZE 16
+#define LOC_CTRL_EMPTY 0x80
+
+/* bundles, see BUNDLE FORMAT */
+#define LOC_BUNDLE_MAGIC "LOCB"
+#define LOC_BUNDLE_VERSION 1
+#define LOC_BUNDLE_HEADER_SIZE 24
+#define LOC_BUNDLE_ENTRY_SIZE 32
+#define LOC_BUNDLE_CODE_SIZE 16
+#define LOC_BUNDLE_ALIGNMENT 4096
+#define LOC_BUNDLE_KEYS "keys" /* code of the shared keys file in a --shared-keys bundle */
+
+/* index entries, see FILE FORMAT */
+#define LOC_ENTRY_SIZE 16
+#define LOC_WIDE_ENTRY_SIZE 24
+#define LOC_ENTRY_FALLBACK 0x80000000u /* in key_len: the key has no translation, the string is a fallback language's */
+#define LOC_ENTRY_PLURAL 0x40000000u /* in key_len: the string is followed by the key's other plural forms */
+#define LOC_ENTRY_KEY_LEN_MASK 0x3fffffffu
+
+/* format templates, see FILE FORMAT and loc_format */
+#define LOC_TEMPLATE_SLOT_SIZE 16
+#define LOC_TEMPLATE_HEADER_SIZE 12
+#define LOC_TEMPLATE_EMPTY_SLOT 0xffffffffffffffffull
+#define LOC_OP_LITERAL 0 /* copy the next n bytes of the string */
+#define LOC_OP_SKIP 1 /* leave out the next n bytes, the second brace of {{ or }} */
+#define LOC_OP_ARG 2 /* an argument in place of the next n bytes, the placeholder */
+#define LOC_FORMAT_NOT_FOUND ((size_t)-1)
+
+/* delta patches, see PATCH FORMAT */
+#define LOC_PATCH_MAGIC "LOCP"
+#define LOC_PATCH_VERSION 1
+#define LOC_PATCH_HEADER_SIZE 48
+#define LOC_PATCH_ENTRY_SIZE 32
+#define LOC_PATCH_IDS 0x1 /* the patch has every id whose key or string changed, the others are the base file's */
+#define LOC_PATCH_ENTRY_KEY 0x1 /* the entry is found by key */
+#define LOC_PATCH_ENTRY_REMOVED 0x2 /* the key isn't in the new file */
+#define LOC_PATCH_NO_ID 0xffffffffu
+
+/* Decompressed blocks a compressed file keeps around. Strings stay valid for the next
+ * LOC_BLOCK_CACHE_SIZE - 1 lookups, every lookup decompresses at most one block. In a --dedup file a lookup
+ * can need the key's block and the block of a string another row had first, so there it's LOC_BLOCK_CACHE_SIZE / 2 - 1. */
+#ifndef LOC_BLOCK_CACHE_SIZE
+#define LOC_BLOCK_CACHE_SIZE 64
+#endif
+
+typedef struct loc_block_cache loc_block_cache;
+
+/* Sections point straight into the file, numbers in them are read with the loader's little-endian helpers */
 typedef struct {
     unsigned char *file_buffer;
-    size_t *bucket_offset_table;
+    unsigned char *bucket_offset_table;
     unsigned char *bucket_list;
-    unsigned char *strings;
+    unsigned char *strings;  /* the compressed blocks with LOC_FLAG_COMPRESSED, read strings with loc_pool_string */
     size_t bucket_count;
     size_t bucket_list_size;
-    size_t strings_size;
+    size_t strings_size;  /* uncompressed */
+    unsigned char *block_table;
+    size_t block_count;
+    size_t blocks_size;
+    unsigned char *dictionary;
+    size_t dictionary_size;
+    unsigned char *template_slots;  /* compiled placeholders by value offset, see loc_format */
+    size_t template_slot_count;
+    unsigned char *templates;
+    size_t templates_size;
+    unsigned char *plural_rules;  /* the language's, see loc_get_plural */
+    size_t plural_rules_size;
+    loc_block_cache *block_cache;  /* made on the first lookup, freed by loc_free */
+    unsigned char *mph_displacements;
+    unsigned char *mph_slots;
+    size_t mph_bucket_count;
+    size_t mph_slot_count;
+    uint8_t *flat_control;
+    unsigned char *flat_slots;
+    size_t flat_capacity;
+    unsigned char *id_table;
+    size_t id_count;
+    unsigned char *value_strings;  /* what the id table points into, strings unless attached to a keys file */
+    size_t value_strings_size;
+    size_t value_offset_size;
+    size_t offset_size;
+    size_t entry_size;
+    size_t file_size;
+    uint32_t load_flags;
+    uint32_t version;
+    uint32_t flags;
+    const unsigned char *patch_entries;  /* from loc_apply_patch, looked at before the file's own index. Borrowed. */
+    const unsigned char *patch_slots;
+    const unsigned char *patch_strings;
+    size_t patch_id_entry_count;  /* entries with an id, they come first */
+    size_t patch_slot_count;
+    size_t patch_id_count;
+    uint32_t patch_flags;
+    uint64_t generation;  /* new for every load, attach and patch, see loc_get_string_cached. 0 for an empty loc_file. */
 } loc_file;
 
+/* Every language in one file, see loc_bundle_open */
+typedef struct {
+    unsigned char *file_buffer;
+    unsigned char *directory;
+    uint32_t language_count;
+    uint32_t load_flags;
+    size_t file_size;
+} loc_bundle;
+
+/* Reloadable table, see loc_handle_open */
+#ifndef LOC_HANDLE_MAX_READERS
+#define LOC_HANDLE_MAX_READERS 64
+#endif
+
+typedef struct loc_handle_table loc_handle_table;
+
+/* A reader's slot has a cache line to itself, readers on other cores never write to the same line */
+typedef struct {
+    uint64_t epoch;  /* 0 free, 1 registered and outside, else the epoch the reader entered at */
+    unsigned char padding[56];
+} loc_reader_slot;
+
+typedef struct {
+    loc_file *current;
+    uint64_t epoch;
+    loc_handle_table *retired;  /* replaced tables some reader might still use */
+    size_t retired_count;
+    uint32_t load_flags;
+    unsigned char padding[64];  /* keeps the first reader off the line every reader loads current and epoch from */
+    loc_reader_slot readers[LOC_HANDLE_MAX_READERS];
+} loc_handle;
+
+/* Entries in each thread's loc_get_string_cached cache, a power of two. 0 turns the cache off. */
+#ifndef LOC_LOOKUP_CACHE_SIZE
+#define LOC_LOOKUP_CACHE_SIZE 256
+#endif
+
+/* The calling thread's loc_get_string_cached counters */
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+} loc_cache_stats;
+
+/* Lookup counters, see loc_stats_snapshot. Nothing is counted unless the implementation is compiled with LOC_STATS. */
+#ifndef LOC_STATS_MAX_THREADS
+#define LOC_STATS_MAX_THREADS 64
+#endif
+#ifndef LOC_STATS_LATENCY_SAMPLE
+#define LOC_STATS_LATENCY_SAMPLE 16  /* one lookup in this many is timed */
+#endif
+#define LOC_STATS_PROBE_BUCKETS 16
+#define LOC_STATS_LATENCY_BUCKETS 32
+
+typedef struct {
+    uint64_t lookups;              /* loc_get_string, loc_get_string_hashed and every key of loc_get_strings */
+    uint64_t misses;               /* lookups that returned NULL */
+    uint64_t probes;               /* places looked at in the index: entries of a chained bucket, the mph slot, flat groups */
+    uint64_t max_probes;           /* most probes a single lookup took */
+    uint64_t compare_bytes;        /* key bytes compared against the strings, fingerprint mismatches compare none */
+    uint64_t blocks_decompressed;  /* blocks of a compressed file that weren't in its cache */
+    uint64_t cache_hits;           /* loc_get_string_cached calls answered by the thread's cache, not counted as lookups */
+    uint64_t probe_histogram[LOC_STATS_PROBE_BUCKETS];      /* lookups by probes, the last one counts everything past it */
+    uint64_t latency_histogram[LOC_STATS_LATENCY_BUCKETS];  /* timed lookups by time, i counts [2^i, 2^(i+1)) ns */
+    uint64_t threads;              /* threads whose lookups are counted */
+    uint64_t untracked_threads;    /* threads past LOC_STATS_MAX_THREADS, their lookups aren't counted */
+} loc_stats;
+
 LOCAPI loc_file loc_load(const char *file_path);
+LOCAPI loc_file loc_load_flags(const char *file_path, uint32_t flags);
+LOCAPI loc_file loc_load_mapped(const char *file_path);
+LOCAPI loc_file loc_attach(const loc_file *keys, const loc_file *values);
 LOCAPI const char *loc_get_string(loc_file *loc, const char *english_key);
+LOCAPI const char *loc_get_string_hashed(loc_file *loc, const char *english_key, uint64_t hash);
+LOCAPI const char *loc_get_string_cached(loc_file *loc, const char *english_key);
+LOCAPI int loc_is_fallback(loc_file *loc, const char *english_key);
+LOCAPI size_t loc_format(loc_file *loc, const char *english_key, const char *const *args, size_t argc, char *out, size_t cap);
+LOCAPI const char *loc_get_plural(loc_file *loc, const char *english_key, uint64_t n);
+LOCAPI loc_cache_stats loc_get_cache_stats(void);
+LOCAPI const char *loc_get_by_id(loc_file *loc, uint32_t id);
+LOCAPI void loc_get_strings(loc_file *loc, const char *const *english_keys, size_t count, const char **out);
+LOCAPI int loc_apply_patch(loc_file *loc, const void *patch, size_t patch_size);
 LOCAPI void loc_free(loc_file *loc);
+LOCAPI loc_handle *loc_handle_open(const char *file_path, uint32_t flags);
+LOCAPI int loc_handle_reload(loc_handle *handle, const char *file_path);
+LOCAPI void loc_handle_reclaim(loc_handle *handle);
+LOCAPI void loc_handle_close(loc_handle *handle);
+LOCAPI int loc_handle_register_reader(loc_handle *handle);
+LOCAPI void loc_handle_unregister_reader(loc_handle *handle, int reader);
+LOCAPI loc_file *loc_handle_enter(loc_handle *handle, int reader);
+LOCAPI void loc_handle_leave(loc_handle *handle, int reader);
+LOCAPI loc_bundle loc_bundle_open(const char *file_path);
+LOCAPI loc_bundle loc_bundle_open_flags(const char *file_path, uint32_t flags);
+LOCAPI loc_file loc_bundle_get_language(const loc_bundle *bundle, const char *lang_code);
+LOCAPI void loc_bundle_close(loc_bundle *bundle);
+LOCAPI loc_stats loc_stats_snapshot(void);
 
 #ifdef __cplusplus
 }
+
+/* loc_hash64 at compile time, for keys that aren't in a generated header:
+ *   constexpr uint64_t hello_hash = loc_hash64_constexpr("hello");
+ *   loc_get_string_hashed(&loc, "hello", hello_hash);
+ */
+#if __cplusplus >= 201402L
+constexpr uint64_t loc_hash64_constexpr(const char *str) {
+    uint64_t hash = 14695981039346656037ull;
+    while(*str) {
+        hash = hash ^ (unsigned char)*str;
+        hash = hash * 1099511628211ull;
+        str++;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+#elif __cplusplus >= 201103L
+/* C++11 constexpr functions are a single return statement, so this one recurses once per byte */
+constexpr uint64_t loc_fnv64_constexpr(const char *str, uint64_t hash) {
+    return *str ? loc_fnv64_constexpr(str + 1, (hash ^ (unsigned char)*str) * 1099511628211ull) : hash;
+}
+constexpr uint64_t loc_xorshift_constexpr(uint64_t x) {
+    return x ^ (x >> 33);
+}
+constexpr uint64_t loc_hash64_constexpr(const char *str) {
+    return loc_xorshift_constexpr(loc_xorshift_constexpr(loc_xorshift_constexpr(
+        loc_fnv64_constexpr(str, 14695981039346656037ull)) * 0xff51afd7ed558ccdull) * 0xc4ceb9fe1a85ec53ull);
+}
+#endif
 #endif
 
 #endif /* LOC_H */
@@ -82,10 +526,211 @@ LOCAPI void loc_free(loc_file *loc);
     #include <windows.h>
 #else
     #include <sys/stat.h>
+    #include <sys/mman.h>
     #include <unistd.h>
     #include <fcntl.h>
 #endif
 
+/* Group scans for the flat index. Define LOC_NO_SIMD to force the portable version. */
+#if !defined(LOC_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #define LOC_SSE2
+    #include <emmintrin.h>
+#elif !defined(LOC_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64))
+    #define LOC_NEON
+    #include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define LOC_PREFETCH(addr) __builtin_prefetch(addr)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <xmmintrin.h>
+    #define LOC_PREFETCH(addr) _mm_prefetch((const char *)(addr), _MM_HINT_T0)
+#else
+    #define LOC_PREFETCH(addr) ((void)(addr))
+#endif
+
+/* Keys loc_get_strings keeps in flight at once */
+#ifndef LOC_BATCH_SIZE
+#define LOC_BATCH_SIZE 16
+#endif
+
+/* Atomics for loc_handle, sequentially consistent. loc_handle isn't available without them. */
+#if defined(__GNUC__) || defined(__clang__)
+    #define LOC_ATOMIC_LOAD_U64(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+    #define LOC_ATOMIC_LOAD_PTR(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+    #define LOC_ATOMIC_STORE_U64(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+    #define LOC_ATOMIC_EXCHANGE_PTR(p, v) __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+    #define LOC_ATOMIC_INCREMENT_U64(p) __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST)
+    #define LOC_ATOMIC_CAS_U64(p, expected, desired) \
+        __atomic_compare_exchange_n(p, &(expected), desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#elif defined(_MSC_VER)
+    // Interlocked functions are full barriers, plain loads need one after them
+    static uint64_t loc_atomic_load_u64(uint64_t *p) {
+        uint64_t value = *(volatile uint64_t *)p;
+        MemoryBarrier();
+        return value;
+    }
+    static loc_file *loc_atomic_load_ptr(loc_file **p) {
+        loc_file *value = *(loc_file *volatile *)p;
+        MemoryBarrier();
+        return value;
+    }
+    static int loc_atomic_cas_u64(uint64_t *p, uint64_t *expected, uint64_t desired) {
+        uint64_t old = (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)p, (LONG64)desired, (LONG64)*expected);
+        if(old == *expected) {
+            return 1;
+        }
+        *expected = old;
+        return 0;
+    }
+    #define LOC_ATOMIC_LOAD_U64(p) loc_atomic_load_u64(p)
+    #define LOC_ATOMIC_LOAD_PTR(p) loc_atomic_load_ptr(p)
+    #define LOC_ATOMIC_STORE_U64(p, v) InterlockedExchange64((volatile LONG64 *)(p), (LONG64)(v))
+    #define LOC_ATOMIC_EXCHANGE_PTR(p, v) ((loc_file *)InterlockedExchangePointer((PVOID volatile *)(p), (PVOID)(v)))
+    #define LOC_ATOMIC_INCREMENT_U64(p) ((uint64_t)InterlockedIncrement64((volatile LONG64 *)(p)))
+    #define LOC_ATOMIC_CAS_U64(p, expected, desired) loc_atomic_cas_u64(p, &(expected), desired)
+#endif
+
+/* Thread-local storage for the lookup cache and LOC_STATS */
+#if defined(_MSC_VER)
+    #define LOC_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__) || defined(__clang__)
+    #define LOC_THREAD_LOCAL __thread
+#endif
+
+/* Every table gets a generation of its own, never reused, so a cached answer can't outlive its table */
+static uint64_t loc_generation_counter;
+
+static uint64_t loc_next_generation(void) {
+#if defined(LOC_ATOMIC_LOAD_U64)
+    return LOC_ATOMIC_INCREMENT_U64(&loc_generation_counter);
+#else
+    return ++loc_generation_counter;
+#endif
+}
+
+/* Lookup statistics (LOC_STATS). Every thread counts into its own block, claimed on its first lookup, so the hot
+ * path has no shared writes or locked instructions: a counter is only ever written by its thread, with relaxed
+ * stores loc_stats_snapshot can read from another thread. Blocks aren't reused when a thread exits, its counts stay
+ * in the totals. A block is padded to keep two threads' counters out of the same cache line. */
+#if defined(LOC_STATS)
+    #if !defined(LOC_ATOMIC_LOAD_U64)
+        #error "LOC_STATS needs the atomics loc_handle uses (GCC, Clang or MSVC)"
+    #endif
+
+    #if defined(_MSC_VER)
+        #define LOC_STATS_READ(p) (*(volatile uint64_t *)(p))
+        #define LOC_STATS_ADD(p, n) (*(volatile uint64_t *)(p) += (n))
+    #else
+        #define LOC_STATS_READ(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+        #define LOC_STATS_ADD(p, n) __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED)
+    #endif
+
+    #if !defined(_WIN32) && !defined(_WIN64)
+        #include <time.h>
+    #endif
+
+    typedef struct {
+        loc_stats stats;
+        unsigned char padding[64];
+    } loc_stats_block;
+
+    static loc_stats_block loc_stats_blocks[LOC_STATS_MAX_THREADS];
+    static uint64_t loc_stats_thread_count;
+    static LOC_THREAD_LOCAL loc_stats *loc_stats_current;
+    static LOC_THREAD_LOCAL loc_stats loc_stats_untracked;  // where threads past LOC_STATS_MAX_THREADS count, never read
+
+    static loc_stats *loc_stats_thread(void) {
+        if(!loc_stats_current) {
+            uint64_t index = LOC_ATOMIC_INCREMENT_U64(&loc_stats_thread_count) - 1;
+            loc_stats_current = index < LOC_STATS_MAX_THREADS ? &loc_stats_blocks[index].stats : &loc_stats_untracked;
+        }
+        return loc_stats_current;
+    }
+
+    static uint64_t loc_stats_now(void) {
+    #if defined(_WIN32) || defined(_WIN64)
+        LARGE_INTEGER counter, frequency;
+        QueryPerformanceCounter(&counter);
+        QueryPerformanceFrequency(&frequency);
+        return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+    #else
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+    #endif
+    }
+
+    static void loc_stats_record(loc_stats *stats, const char *localized, uint64_t probes, int timed, uint64_t nanoseconds) {
+        size_t latency_bucket = 0;
+        while(nanoseconds > 1 && latency_bucket < LOC_STATS_LATENCY_BUCKETS - 1) {
+            nanoseconds >>= 1;
+            latency_bucket++;
+        }
+        size_t probe_bucket = probes < LOC_STATS_PROBE_BUCKETS ? (size_t)probes : LOC_STATS_PROBE_BUCKETS - 1;
+
+        LOC_STATS_ADD(&stats->lookups, 1);
+        LOC_STATS_ADD(&stats->misses, localized ? 0 : 1);
+        LOC_STATS_ADD(&stats->probe_histogram[probe_bucket], 1);
+        LOC_STATS_ADD(&stats->latency_histogram[latency_bucket], timed ? 1 : 0);
+        if(probes > stats->max_probes) {
+            LOC_STATS_ADD(&stats->max_probes, probes - stats->max_probes);
+        }
+    }
+
+    #define LOC_STATS_COUNT(field, n) LOC_STATS_ADD(&loc_stats_thread()->field, (n))
+#else
+    #define LOC_STATS_COUNT(field, n) ((void)0)
+#endif
+
+/* Slot i of a group is bit i * LOC_MASK_STRIDE of a group mask */
+#if defined(LOC_NEON)
+    #define LOC_MASK_STRIDE 4
+#else
+    #define LOC_MASK_STRIDE 1
+#endif
+
+/* Files are little-endian. Those hosts read fields in place, others put the bytes together. */
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || \
+    defined(_WIN32) || defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #define LOC_LITTLE_ENDIAN
+#endif
+
+static uint32_t loc_read_u32(const unsigned char *p) {
+#if defined(LOC_LITTLE_ENDIAN)
+    return *((const uint32_t *)p);
+#else
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+#endif
+}
+
+static uint64_t loc_read_u64(const unsigned char *p) {
+#if defined(LOC_LITTLE_ENDIAN)
+    return *((const uint64_t *)p);
+#else
+    return (uint64_t)loc_read_u32(p) | ((uint64_t)loc_read_u32(p + 4) << 32);
+#endif
+}
+
+/* Offsets and counts inside sections, 4 or 8 bytes depending on LOC_FLAG_WIDE_OFFSETS */
+static size_t loc_read_offset(const loc_file *loc, const unsigned char *p) {
+    if(loc->offset_size == 8) {
+        return (size_t)loc_read_u64(p);
+    }
+    return loc_read_u32(p);
+}
+
+static size_t loc_entry_offset(const loc_file *loc, const unsigned char *entry) {
+    if(loc->entry_size == LOC_WIDE_ENTRY_SIZE) {
+        return (size_t)loc_read_u64(entry + 16);
+    }
+    return loc_read_u32(entry + 12);
+}
+
 static uint32_t loc_hash_string(const char *str) {
     uint32_t hash = 2166136261u;
     const unsigned char *s = (const unsigned char *)str;
@@ -99,12 +744,47 @@ static uint32_t loc_hash_string(const char *str) {
     return hash;
 }
 
+static uint64_t loc_mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+/* Hash used by version 2+ files. 64 bit FNV-1a with a finalizer so that every bit depends on the whole key.
+ * Also returns the length of the key, we need it to compare against index entries. */
+static uint64_t loc_hash64(const char *str, size_t *len) {
+    uint64_t hash = 14695981039346656037ull;
+    const unsigned char *s = (const unsigned char *)str;
+
+    while(*s) {
+        hash = hash ^ (*s);
+        hash = hash * 1099511628211ull;
+        s++;
+    }
+
+    *len = (size_t)(s - (const unsigned char *)str);
+    return loc_mix64(hash);
+}
+
+static size_t loc_mph_slot(uint64_t hash, uint32_t displacement, size_t slot_count) {
+    return (size_t)(loc_mix64(hash + (uint64_t)displacement * 0x9e3779b97f4a7c15ull) % slot_count);
+}
+
 static size_t loc_strlen(const char *str) {
     const char *s = str;
     while (*s) s++;
     return s - str;
 }
 
+static void loc_memcpy(void *dest, const void *src, size_t n) {
+    unsigned char *d = (unsigned char *)dest;
+    const unsigned char *s = (const unsigned char *)src;
+    while(n--) *d++ = *s++;
+}
+
 static int loc_strcmp(const char *s1, const char *s2) {
     while (*s1 && (*s1 == *s2)) {
         s1++;
@@ -192,84 +872,1817 @@ static unsigned char *loc_read_entire_file(const char *file_path, size_t *bytes_
     return file;
 }
 
-LOCAPI loc_file loc_load(const char *file_path) {
-    loc_file loc = {0};
-    size_t file_size = 0;
-    
-    loc.file_buffer = loc_read_entire_file(file_path, &file_size);
-    if (!loc.file_buffer || file_size < sizeof(size_t) * 3) {
-        return loc;
+/* Maps the whole file read-only. The view stays valid until loc_unmap_file. */
+static unsigned char *loc_map_entire_file(const char *file_path, size_t *bytes_mapped) {
+    size_t file_size = loc_get_file_size(file_path);
+    if (file_size == 0) {
+        return NULL;
     }
-    
-    unsigned char *ptr = loc.file_buffer;
+
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE hFile = CreateFileA(file_path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+
+    HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!hMapping) {
+        CloseHandle(hFile);
+        return NULL;
+    }
+
+    // The view keeps the mapping alive, so both handles can be closed right away
+    void *view = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, file_size);
+    CloseHandle(hMapping);
+    CloseHandle(hFile);
+    if (!view) {
+        return NULL;
+    }
+#else
+    int fd = open(file_path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    void *view = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) {
+        return NULL;
+    }
+
+#if defined(MADV_RANDOM)
+    // Lookups jump around the file, read-ahead would only fault in pages we never touch
+    madvise(view, file_size, MADV_RANDOM);
+#endif
+#endif
+
+    *bytes_mapped = file_size;
+    return (unsigned char *)view;
+}
+
+static void loc_unmap_file(unsigned char *view, size_t file_size) {
+#if defined(_WIN32) || defined(_WIN64)
+    (void)file_size;
+    UnmapViewOfFile(view);
+#else
+    munmap(view, file_size);
+#endif
+}
+
+static int loc_memcmp(const void *a, const void *b, size_t n) {
+    const unsigned char *p1 = (const unsigned char *)a;
+    const unsigned char *p2 = (const unsigned char *)b;
+    for(size_t i = 0; i < n; i++) {
+        if(p1[i] != p2[i]) {
+            return p1[i] - p2[i];
+        }
+    }
+    return 0;
+}
+
+/* Version 1 files have no header, just the three size prefixed sections */
+static void loc_parse_v1(loc_file *loc) {
+    if (loc->file_size < sizeof(size_t) * 3) {
+        return;
+    }
+
+    unsigned char *ptr = loc->file_buffer;
+    loc->version = 1;
     
     size_t bucket_offset_table_size = *((size_t *)ptr);
     ptr += sizeof(size_t);
     
-    loc.bucket_offset_table = (size_t *)ptr;
-    loc.bucket_count = bucket_offset_table_size / sizeof(size_t);
+    loc->bucket_offset_table = ptr;
+    loc->bucket_count = bucket_offset_table_size / sizeof(size_t);
     ptr += bucket_offset_table_size;
     
-    loc.bucket_list_size = *((size_t *)ptr);
+    loc->bucket_list_size = *((size_t *)ptr);
     ptr += sizeof(size_t);
     
-    loc.bucket_list = ptr;
-    ptr += loc.bucket_list_size;
+    loc->bucket_list = ptr;
+    ptr += loc->bucket_list_size;
     
-    loc.strings_size = *((size_t *)ptr);
+    loc->strings_size = *((size_t *)ptr);
     ptr += sizeof(size_t);
     
-    loc.strings = ptr;
-    
-    return loc;
+    loc->strings = ptr;
 }
 
-LOCAPI const char *loc_get_string(loc_file *loc, const char *english_key) {
-    if(!loc || !loc->bucket_offset_table || !loc->strings || loc->bucket_count == 0) {
-        return NULL;
+/* Newer files start with a header and a directory of sections. Unknown sections are skipped.
+ * Nothing in the file is rewritten, so everything a lookup relies on is checked here once. */
+static void loc_parse_sections(loc_file *loc) {
+    unsigned char *header = loc->file_buffer;
+    uint32_t version = loc_read_u32(header + 4);
+    uint32_t flags = loc_read_u32(header + 8);
+    uint32_t section_count = loc_read_u32(header + 12);
+    uint64_t file_size = loc_read_u64(header + 16);
+
+    if(version != LOC_VERSION) {
+        return;  // Older header versions aren't supported, only headerless version 1 files
     }
-    
-    uint32_t hash = loc_hash_string(english_key);
-    size_t bucket_index = hash % loc->bucket_count;
-    
-    size_t bucket_offset = loc->bucket_offset_table[bucket_index];
-    unsigned char *bucket_ptr = loc->bucket_list + bucket_offset;
-    
-    // Read bucket: count followed by offsets
-    size_t count = *((size_t *)bucket_ptr);
-    bucket_ptr += sizeof(size_t);
-    size_t *offsets = (size_t *)bucket_ptr;
-    
-    for(size_t i = 0; i < count; i++) {
-        size_t string_offset = offsets[i];
-        if(string_offset >= loc->strings_size) {
-            continue;  // Invalid offset
+
+    uint32_t known_flags = LOC_FLAG_MPH | LOC_FLAG_FLAT | LOC_FLAG_WIDE_OFFSETS | LOC_FLAG_KEYS | LOC_FLAG_VALUES |
+                           LOC_FLAG_COMPRESSED | LOC_FLAG_DEDUP | LOC_FLAG_FALLBACK | LOC_FLAG_TEMPLATES | LOC_FLAG_PLURALS;
+    if((flags & ~known_flags) || ((flags & LOC_FLAG_MPH) && (flags & LOC_FLAG_FLAT)) ||
+       ((flags & LOC_FLAG_KEYS) && (flags & LOC_FLAG_VALUES)) ||
+       ((flags & (LOC_FLAG_COMPRESSED | LOC_FLAG_DEDUP | LOC_FLAG_FALLBACK)) && (flags & (LOC_FLAG_KEYS | LOC_FLAG_VALUES))) ||
+       ((flags & LOC_FLAG_TEMPLATES) && (flags & LOC_FLAG_KEYS))) {
+        return;  // Made by a newer generator, or nonsense
+    }
+
+    if(file_size != loc->file_size || loc->file_size < LOC_HEADER_SIZE) {
+        return;  // Truncated, or more than one file glued together
+    }
+
+    uint64_t directory_size = (uint64_t)section_count * LOC_DIRECTORY_ENTRY_SIZE;
+    if(directory_size > file_size - LOC_HEADER_SIZE) {
+        return;
+    }
+
+    // Don't point into the file until every section we need checks out
+    loc_file parsed = *loc;
+    parsed.version = version;
+    parsed.flags = flags;
+    parsed.offset_size = (flags & LOC_FLAG_WIDE_OFFSETS) ? 8 : 4;
+    parsed.entry_size = (flags & LOC_FLAG_WIDE_OFFSETS) ? LOC_WIDE_ENTRY_SIZE : LOC_ENTRY_SIZE;
+
+    size_t flat_slots_size = 0;
+    unsigned char *blocks = NULL;
+    unsigned char *directory = header + LOC_HEADER_SIZE;
+    for(uint32_t i = 0; i < section_count; i++) {
+        unsigned char *dir_entry = directory + (size_t)i * LOC_DIRECTORY_ENTRY_SIZE;
+        uint32_t id = loc_read_u32(dir_entry);
+        uint64_t offset = loc_read_u64(dir_entry + 8);
+        uint64_t size = loc_read_u64(dir_entry + 16);
+        if(offset > file_size || size > file_size - offset || offset % 8 != 0) {
+            return;  // Truncated or corrupt
         }
-        
-        // Format: [english_key:null-terminated][localized_string:null-terminated]
-        const char *stored_english = (const char *)(loc->strings + string_offset);
-        
-        if(loc_strcmp(stored_english, english_key) == 0) {
-            // Found a match! Skip past the English key to get the localized string
-            size_t english_len = loc_strlen(stored_english);
-            return stored_english + english_len + 1;  // +1 for null terminator
+
+        unsigned char *section = loc->file_buffer + (size_t)offset;
+        size_t element_size = 1;
+        switch(id) {
+            case LOC_SECTION_STRINGS:
+                parsed.strings = section;
+                parsed.strings_size = (size_t)size;
+                break;
+            case LOC_SECTION_BUCKET_OFFSETS:
+                element_size = parsed.offset_size;
+                parsed.bucket_offset_table = section;
+                parsed.bucket_count = (size_t)size / element_size;
+                break;
+            case LOC_SECTION_BUCKET_LIST:
+                parsed.bucket_list = section;
+                parsed.bucket_list_size = (size_t)size;
+                break;
+            case LOC_SECTION_MPH_DISPLACEMENTS:
+                element_size = sizeof(uint32_t);
+                parsed.mph_displacements = section;
+                parsed.mph_bucket_count = (size_t)size / element_size;
+                break;
+            case LOC_SECTION_MPH_SLOTS:
+                element_size = parsed.entry_size;
+                parsed.mph_slots = section;
+                parsed.mph_slot_count = (size_t)size / element_size;
+                break;
+            case LOC_SECTION_FLAT_CONTROL:
+                parsed.flat_control = (uint8_t *)section;
+                parsed.flat_capacity = (size_t)size;
+                break;
+            case LOC_SECTION_FLAT_SLOTS:
+                element_size = parsed.entry_size;
+                parsed.flat_slots = section;
+                flat_slots_size = (size_t)size;
+                break;
+            case LOC_SECTION_IDS:
+                element_size = parsed.offset_size;
+                parsed.id_table = section;
+                parsed.id_count = (size_t)size / element_size;
+                break;
+            case LOC_SECTION_BLOCKS:
+                blocks = section;
+                parsed.blocks_size = (size_t)size;
+                break;
+            case LOC_SECTION_BLOCK_TABLE:
+                element_size = 16;
+                parsed.block_table = section;
+                parsed.block_count = (size_t)size / element_size;
+                break;
+            case LOC_SECTION_DICTIONARY:
+                parsed.dictionary = section;
+                parsed.dictionary_size = (size_t)size;
+                break;
+            case LOC_SECTION_TEMPLATE_SLOTS:
+                element_size = LOC_TEMPLATE_SLOT_SIZE;
+                parsed.template_slots = section;
+                parsed.template_slot_count = (size_t)size / element_size;
+                break;
+            case LOC_SECTION_TEMPLATES:
+                parsed.templates = section;
+                parsed.templates_size = (size_t)size;
+                break;
+            case LOC_SECTION_PLURAL_RULES:
+                parsed.plural_rules = section;
+                parsed.plural_rules_size = (size_t)size;
+                break;
+            default:
+                break;
+        }
+
+        if(size % element_size != 0) {
+            return;
         }
     }
-    
-    return NULL;  // Not found
-}
 
-LOCAPI void loc_free(loc_file *loc) {
-    if(loc && loc->file_buffer) {
-        free(loc->file_buffer);
-        loc->file_buffer = NULL;
-        loc->bucket_offset_table = NULL;
-        loc->bucket_list = NULL;
-        loc->strings = NULL;
-        loc->bucket_count = 0;
-        loc->bucket_list_size = 0;
-        loc->strings_size = 0;
+    // Compressed strings are found through the block table, its last entry is the size of the strings.
+    // Blocks are checked when they're decompressed.
+    if(flags & LOC_FLAG_COMPRESSED) {
+        if(parsed.strings || !blocks || parsed.block_count == 0) {
+            return;
+        }
+        parsed.strings = blocks;
+        parsed.block_count--;
+        parsed.strings_size = (size_t)loc_read_u64(parsed.block_table + parsed.block_count * 16);
+    }
+
+    if(!parsed.strings) {
+        return;
     }
+
+    // A keys file has no values of its own until it's attached to a value file
+    if(!(flags & LOC_FLAG_KEYS)) {
+        parsed.value_strings = parsed.strings;
+        parsed.value_strings_size = parsed.strings_size;
+        parsed.value_offset_size = parsed.offset_size;
+    }
+
+    // The probe sequence relies on a power of two number of whole groups
+    size_t capacity = parsed.flat_capacity;
+    if(capacity % LOC_GROUP_SIZE != 0 || (capacity & (capacity - 1)) != 0 ||
+       flat_slots_size != capacity * parsed.entry_size) {
+        parsed.flat_control = NULL;
+        parsed.flat_slots = NULL;
+        parsed.flat_capacity = 0;
+    }
+
+    // Same for the template slots. Without them loc_format parses the strings itself.
+    size_t slot_count = parsed.template_slot_count;
+    if(!(flags & LOC_FLAG_TEMPLATES) || (slot_count & (slot_count - 1)) != 0 || (slot_count && !parsed.templates)) {
+        parsed.flags &= ~(uint32_t)LOC_FLAG_TEMPLATES;
+        parsed.template_slots = NULL;
+        parsed.template_slot_count = 0;
+    }
+
+    *loc = parsed;
+}
+
+LOCAPI loc_file loc_load_flags(const char *file_path, uint32_t flags) {
+    loc_file loc = {0};
+    size_t file_size = 0;
+
+    if (flags & LOC_LOAD_MMAP) {
+        loc.file_buffer = loc_map_entire_file(file_path, &file_size);
+    } else {
+        loc.file_buffer = loc_read_entire_file(file_path, &file_size);
+    }
+    loc.file_size = file_size;
+    loc.load_flags = flags;
+
+    if (!loc.file_buffer) {
+        return loc;
+    }
+
+    // Only the headers are read here, so a mapped load doesn't touch the rest of the file
+    if (file_size >= LOC_HEADER_SIZE && loc_memcmp(loc.file_buffer, LOC_MAGIC, 4) == 0) {
+        loc_parse_sections(&loc);
+    } else {
+        loc_parse_v1(&loc);
+    }
+
+    loc.generation = loc_next_generation();
+    return loc;
+}
+
+LOCAPI loc_file loc_load(const char *file_path) {
+    return loc_load_flags(file_path, 0);
+}
+
+LOCAPI loc_file loc_load_mapped(const char *file_path) {
+    return loc_load_flags(file_path, LOC_LOAD_MMAP);
+}
+
+/* Looks keys up in keys and returns their translation from values. Both have to come from the same loc_gen --shared-keys run.
+ * The view points into both files and owns neither, loc_free does nothing to it. */
+LOCAPI loc_file loc_attach(const loc_file *keys, const loc_file *values) {
+    loc_file view = {0};
+    if(!keys || !values || !(keys->flags & LOC_FLAG_KEYS) || !(values->flags & LOC_FLAG_VALUES) ||
+       !keys->strings || !values->strings || keys->id_count != values->id_count) {
+        return view;
+    }
+
+    view = *keys;
+    view.file_buffer = NULL;
+    view.file_size = 0;
+    view.load_flags = 0;
+    view.id_table = values->id_table;
+    view.value_strings = values->value_strings;
+    view.value_strings_size = values->value_strings_size;
+    view.value_offset_size = values->value_offset_size;
+    view.template_slots = values->template_slots;
+    view.template_slot_count = values->template_slot_count;
+    view.templates = values->templates;
+    view.templates_size = values->templates_size;
+    view.plural_rules = values->plural_rules;
+    view.plural_rules_size = values->plural_rules_size;
+    view.flags |= values->flags & LOC_FLAG_TEMPLATES;
+    view.generation = loc_next_generation();
+    return view;
+}
+
+/* Version 1 buckets only hold offsets, every candidate costs a full string compare */
+static const char *loc_get_string_v1(loc_file *loc, const char *english_key) {
+    size_t bucket_index = loc_hash_string(english_key) % loc->bucket_count;
+    size_t bucket_offset = ((size_t *)loc->bucket_offset_table)[bucket_index];
+    unsigned char *bucket_ptr = loc->bucket_list + bucket_offset;
+    
+    // Read bucket: count followed by offsets
+    size_t count = *((size_t *)bucket_ptr);
+    bucket_ptr += sizeof(size_t);
+    size_t *offsets = (size_t *)bucket_ptr;
+    
+    for(size_t i = 0; i < count; i++) {
+        size_t string_offset = offsets[i];
+        if(string_offset >= loc->strings_size) {
+            continue;  // Invalid offset
+        }
+        
+        // Format: [english_key:null-terminated][localized_string:null-terminated]
+        const char *stored_english = (const char *)(loc->strings + string_offset);
+        
+        if(loc_strcmp(stored_english, english_key) == 0) {
+            // Found a match! Skip past the English key to get the localized string
+            size_t english_len = loc_strlen(stored_english);
+            return stored_english + english_len + 1;  // +1 for null terminator
+        }
+    }
+    
+    return NULL;  // Not found
+}
+
+/* Blocks are decompressed into buffers this much bigger than them, so copies can always move whole words */
+#define LOC_LZ4_SLACK 16
+
+static void loc_copy_word(unsigned char *dst, const unsigned char *src) {
+    // Unaligned, compilers merge these into one load and one store
+    uint64_t word = (uint64_t)src[0] | ((uint64_t)src[1] << 8) | ((uint64_t)src[2] << 16) | ((uint64_t)src[3] << 24) |
+                    ((uint64_t)src[4] << 32) | ((uint64_t)src[5] << 40) | ((uint64_t)src[6] << 48) | ((uint64_t)src[7] << 56);
+    dst[0] = (unsigned char)word;
+    dst[1] = (unsigned char)(word >> 8);
+    dst[2] = (unsigned char)(word >> 16);
+    dst[3] = (unsigned char)(word >> 24);
+    dst[4] = (unsigned char)(word >> 32);
+    dst[5] = (unsigned char)(word >> 40);
+    dst[6] = (unsigned char)(word >> 48);
+    dst[7] = (unsigned char)(word >> 56);
+}
+
+/* Copies n bytes rounded up to a whole word, both sides have room for the rest. dst may overlap src from 8 bytes
+ * on, every word only reads what's written already. */
+static void loc_copy_words(unsigned char *dst, const unsigned char *src, size_t n) {
+    unsigned char *end = dst + n;
+    do {
+        loc_copy_word(dst, src);
+        dst += 8;
+        src += 8;
+    } while(dst < end);
+}
+
+/* Decodes one LZ4 block into exactly dst_size bytes, dst has LOC_LZ4_SLACK bytes more room. Matches can reach
+ * back past the start of dst into the end of dict. Returns 0 if the block is damaged, nothing is read or
+ * written out of bounds either way. */
+static int loc_lz4_decompress(const unsigned char *src, size_t src_size, unsigned char *dst, size_t dst_size,
+                              const unsigned char *dict, size_t dict_size) {
+    size_t in = 0;
+    size_t out = 0;
+    for(;;) {
+        if(in >= src_size) {
+            return 0;
+        }
+        unsigned token = src[in++];
+
+        size_t literal_len = token >> 4;
+        if(literal_len == 15) {
+            unsigned char more;
+            do {
+                if(in >= src_size) return 0;
+                more = src[in++];
+                literal_len += more;
+            } while(more == 255);
+        }
+        if(literal_len > src_size - in || literal_len > dst_size - out) {
+            return 0;
+        }
+        if(src_size - in - literal_len >= 8 && literal_len) {
+            loc_copy_words(dst + out, src + in, literal_len);
+        } else {
+            for(size_t i = 0; i < literal_len; i++) {
+                dst[out + i] = src[in + i];  // The end of the block, a whole word would read past it
+            }
+        }
+        in += literal_len;
+        out += literal_len;
+
+        // The last sequence is only literals
+        if(in == src_size) {
+            return out == dst_size;
+        }
+
+        if(src_size - in < 2) {
+            return 0;
+        }
+        size_t offset = (size_t)src[in] | ((size_t)src[in + 1] << 8);
+        in += 2;
+        size_t match_len = token & 15;
+        if(match_len == 15) {
+            unsigned char more;
+            do {
+                if(in >= src_size) return 0;
+                more = src[in++];
+                match_len += more;
+            } while(more == 255);
+        }
+        match_len += 4;
+        if(offset == 0 || offset > out + dict_size || match_len > dst_size - out) {
+            return 0;
+        }
+
+        // The part before dst comes from the end of the dictionary, a byte at a time near its end
+        if(offset > out) {
+            size_t from_dict = offset - out < match_len ? offset - out : match_len;
+            const unsigned char *from = dict + dict_size - (offset - out);
+            if(offset - out >= from_dict + 8) {
+                loc_copy_words(dst + out, from, from_dict);
+            } else {
+                for(size_t i = 0; i < from_dict; i++) {
+                    dst[out + i] = from[i];
+                }
+            }
+            out += from_dict;
+            match_len -= from_dict;
+        }
+        if(match_len == 0) {
+            continue;
+        }
+        if(offset >= 8) {
+            loc_copy_words(dst + out, dst + out - offset, match_len);
+            out += match_len;
+        } else {
+            for(size_t i = 0; i < match_len; i++, out++) {
+                dst[out] = dst[out - offset];  // A match this close repeats what it's copying
+            }
+        }
+    }
+}
+
+/* The least recently used block makes room, so a block stays until LOC_BLOCK_CACHE_SIZE - 1 other blocks were used after it */
+struct loc_block_cache {
+    uint32_t *block_slots;  /* block -> slot + 1, 0 if it isn't decompressed */
+    unsigned char *slot_data[LOC_BLOCK_CACHE_SIZE];
+    size_t slot_capacity[LOC_BLOCK_CACHE_SIZE];
+    size_t slot_block[LOC_BLOCK_CACHE_SIZE];  /* block + 1, 0 if the slot is empty */
+    uint64_t slot_used[LOC_BLOCK_CACHE_SIZE];  /* when the slot's block was last used, 0 if it's empty */
+    uint64_t uses;
+};
+
+static void loc_block_cache_free(loc_block_cache *cache) {
+    for(size_t i = 0; i < LOC_BLOCK_CACHE_SIZE; i++) {
+        free(cache->slot_data[i]);
+    }
+    free(cache->block_slots);
+    free(cache);
+}
+
+/* The uncompressed block, from the cache or decompressed into it. NULL if it's damaged or memory ran out. */
+static unsigned char *loc_block_data(loc_file *loc, size_t block, size_t block_size) {
+    loc_block_cache *cache = loc->block_cache;
+    if(!cache) {
+        cache = (loc_block_cache *)calloc(1, sizeof(loc_block_cache));
+        if(!cache) {
+            return NULL;
+        }
+        cache->block_slots = (uint32_t *)calloc(loc->block_count, sizeof(uint32_t));
+        if(!cache->block_slots) {
+            free(cache);
+            return NULL;
+        }
+        loc->block_cache = cache;
+    }
+
+    uint32_t cached = cache->block_slots[block];
+    if(cached) {
+        cache->slot_used[cached - 1] = ++cache->uses;
+        return cache->slot_data[cached - 1];
+    }
+
+    // A scan of a few dozen slots is nothing next to decompressing a block
+    size_t slot = 0;
+    for(size_t i = 1; i < LOC_BLOCK_CACHE_SIZE; i++) {
+        if(cache->slot_used[i] < cache->slot_used[slot]) {
+            slot = i;
+        }
+    }
+    if(cache->slot_block[slot]) {
+        cache->block_slots[cache->slot_block[slot] - 1] = 0;
+        cache->slot_block[slot] = 0;
+    }
+
+    // The slack has room for a terminator, so even a damaged block can't make a string run off its end
+    if(cache->slot_capacity[slot] < block_size + LOC_LZ4_SLACK) {
+        unsigned char *data = (unsigned char *)realloc(cache->slot_data[slot], block_size + LOC_LZ4_SLACK);
+        if(!data) {
+            return NULL;
+        }
+        cache->slot_data[slot] = data;
+        cache->slot_capacity[slot] = block_size + LOC_LZ4_SLACK;
+    }
+
+    const unsigned char *entry = loc->block_table + block * 16;
+    uint64_t compressed_start = loc_read_u64(entry + 8);
+    uint64_t compressed_end = loc_read_u64(entry + 24);
+    unsigned char *data = cache->slot_data[slot];
+    LOC_STATS_COUNT(blocks_decompressed, 1);
+    if(compressed_start > compressed_end || compressed_end > loc->blocks_size ||
+       !loc_lz4_decompress(loc->strings + (size_t)compressed_start, (size_t)(compressed_end - compressed_start),
+                           data, block_size, loc->dictionary, loc->dictionary_size)) {
+        return NULL;
+    }
+    data[block_size] = 0;
+
+    cache->block_slots[block] = (uint32_t)(slot + 1);
+    cache->slot_block[slot] = block + 1;
+    cache->slot_used[slot] = ++cache->uses;
+    return data;
+}
+
+/* The block the string pool's offset is in */
+static size_t loc_block_index(const loc_file *loc, size_t offset) {
+    size_t low = 0;
+    size_t high = loc->block_count;
+    while(high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if(loc_read_u64(loc->block_table + middle * 16) <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/* size bytes of the string pool at offset, NULL if they aren't all in one block (or the block is damaged) */
+static const char *loc_block_string(loc_file *loc, size_t offset, size_t size) {
+    size_t low = loc_block_index(loc, offset);
+    uint64_t block_start = loc_read_u64(loc->block_table + low * 16);
+    uint64_t block_end = loc_read_u64(loc->block_table + (low + 1) * 16);
+    if(offset < block_start || block_end > loc->strings_size || block_end < offset || size > block_end - offset) {
+        return NULL;
+    }
+
+    unsigned char *data = loc_block_data(loc, low, (size_t)(block_end - block_start));
+    return data ? (const char *)data + (offset - (size_t)block_start) : NULL;
+}
+
+/* The string pool at offset. The caller checked that size bytes from there are inside the strings. */
+static const char *loc_pool_string(loc_file *loc, size_t offset, size_t size) {
+    if(loc->flags & LOC_FLAG_COMPRESSED) {
+        return loc_block_string(loc, offset, size);
+    }
+    return (const char *)(loc->strings + offset);
+}
+
+#define LOC_NO_OFFSET ((size_t)-1)
+
+/* What a lookup found besides the string, for loc_is_fallback and loc_format */
+typedef struct {
+    uint32_t entry_flags;  /* LOC_ENTRY_* bits of the entry */
+    size_t value_offset;   /* where the string is in value_strings, LOC_NO_OFFSET if it's not from there (a patch) */
+} loc_found;
+
+/* Where the id table says id's string is in value_strings, LOC_NO_OFFSET if that's outside of them */
+static size_t loc_id_value_offset(const loc_file *loc, size_t id) {
+    if(id >= loc->id_count) {
+        return LOC_NO_OFFSET;
+    }
+    const unsigned char *id_entry = loc->id_table + id * loc->value_offset_size;
+    size_t string_offset = loc->value_offset_size == 8 ? (size_t)loc_read_u64(id_entry) : loc_read_u32(id_entry);
+    return string_offset < loc->value_strings_size ? string_offset : LOC_NO_OFFSET;
+}
+
+/* id's string in the file itself, whatever a patch says about the id. NULL if the id or its offset is invalid. */
+static const char *loc_row_string(loc_file *loc, size_t id) {
+    size_t string_offset = loc_id_value_offset(loc, id);
+    if(string_offset == LOC_NO_OFFSET) {
+        return NULL;
+    }
+
+    // Compressed files are never attached, their values are in their own strings
+    if(loc->flags & LOC_FLAG_COMPRESSED) {
+        return loc_block_string(loc, string_offset, 1);
+    }
+    return (const char *)(loc->value_strings + string_offset);
+}
+
+/* Checks an index entry against the key. The fingerprint and length reject almost every
+ * mismatch without touching the strings section. */
+static const char *loc_match_entry(loc_file *loc, const unsigned char *entry, const char *english_key, size_t key_len, uint64_t hash,
+                                   loc_found *found) {
+    uint32_t entry_key_len = loc_read_u32(entry + 4) & LOC_ENTRY_KEY_LEN_MASK;
+    if(loc_read_u32(entry) != (uint32_t)(hash >> 32) || entry_key_len != key_len) {
+        return NULL;
+    }
+
+    // Format: [english_key:null-terminated][localized_string:null-terminated], just the key in a keys or deduplicated file
+    size_t string_offset = loc_entry_offset(loc, entry);
+    int by_row = (loc->flags & (LOC_FLAG_KEYS | LOC_FLAG_DEDUP)) != 0;
+    size_t stored_size = by_row ? (size_t)entry_key_len + 1 : (size_t)entry_key_len + loc_read_u32(entry + 8) + 2;
+    if(string_offset > loc->strings_size || stored_size > loc->strings_size - string_offset) {
+        return NULL;  // Invalid entry
+    }
+
+    const char *stored_english = loc_pool_string(loc, string_offset, stored_size);
+    LOC_STATS_COUNT(compare_bytes, stored_english ? key_len : 0);
+    if(!stored_english || loc_memcmp(stored_english, english_key, key_len) != 0) {
+        return NULL;
+    }
+
+    if(found) {
+        found->entry_flags = loc_read_u32(entry + 4) & ~LOC_ENTRY_KEY_LEN_MASK;
+        found->value_offset = by_row ? loc_id_value_offset(loc, loc_read_u32(entry + 8)) : string_offset + key_len + 1;
+    }
+    if(by_row) {
+        // The entry has the key's row in this file. A patch was asked about the key before the index was, and its ids
+        // are the new file's, so the row is read from the file's own id table.
+        return loc_row_string(loc, loc_read_u32(entry + 8));
+    }
+    return stored_english + key_len + 1;  // +1 for null terminator
+}
+
+/* The entries of the key's bucket, NULL if the bucket runs past the end of the bucket list */
+static const unsigned char *loc_bucket_entries(const loc_file *loc, uint64_t hash, size_t *count) {
+    size_t bucket_index = (size_t)(hash % loc->bucket_count);
+    size_t bucket_offset = loc_read_offset(loc, loc->bucket_offset_table + bucket_index * loc->offset_size);
+    if(bucket_offset > loc->bucket_list_size || loc->offset_size > loc->bucket_list_size - bucket_offset) {
+        return NULL;
+    }
+
+    // Read bucket: count followed by entries
+    const unsigned char *bucket_ptr = loc->bucket_list + bucket_offset;
+    size_t bucket_room = loc->bucket_list_size - bucket_offset - loc->offset_size;
+    *count = loc_read_offset(loc, bucket_ptr);
+    if(*count > bucket_room / loc->entry_size) {
+        return NULL;
+    }
+    return bucket_ptr + loc->offset_size;
+}
+
+static const char *loc_get_string_chained(loc_file *loc, const char *english_key, size_t key_len, uint64_t hash, loc_found *found) {
+    size_t count = 0;
+    const unsigned char *entries = loc_bucket_entries(loc, hash, &count);
+    if(!entries) {
+        return NULL;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        LOC_STATS_COUNT(probes, 1);
+        const char *localized = loc_match_entry(loc, entries + i * loc->entry_size, english_key, key_len, hash, found);
+        if(localized) {
+            return localized;
+        }
+    }
+
+    return NULL;  // Not found
+}
+
+static const char *loc_get_string_mph(loc_file *loc, const char *english_key, size_t key_len, uint64_t hash, loc_found *found) {
+    size_t bucket_index = (size_t)((hash >> 32) % loc->mph_bucket_count);
+    uint32_t displacement = loc_read_u32(loc->mph_displacements + bucket_index * sizeof(uint32_t));
+    size_t slot = loc_mph_slot(hash, displacement, loc->mph_slot_count);
+
+    // Every key has its own slot, so a single compare tells us whether the key is in the table
+    LOC_STATS_COUNT(probes, 1);
+    return loc_match_entry(loc, loc->mph_slots + slot * loc->entry_size, english_key, key_len, hash, found);
+}
+
+static unsigned loc_ctz64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctzll(x);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (unsigned)index;
+#else
+    unsigned n = 0;
+    while(!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+/* Finds the slots of a group whose control byte is tag, and the empty ones.
+ * Tags are 7 bits, so any control byte with the high bit set counts as empty. */
+static void loc_group_scan(const uint8_t *control, uint8_t tag, uint64_t *match, uint64_t *empty) {
+#if defined(LOC_SSE2)
+    __m128i group = _mm_loadu_si128((const __m128i *)control);
+    *match = (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag)));
+    *empty = (uint64_t)(unsigned)_mm_movemask_epi8(group);
+#elif defined(LOC_NEON)
+    // No movemask on NEON, narrowing each 16 bit lane by 4 leaves one nibble per byte
+    uint8x16_t group = vld1q_u8(control);
+    uint8x16_t eq = vceqq_u8(group, vdupq_n_u8(tag));
+    uint8x16_t hi = vtstq_u8(group, vdupq_n_u8(0x80));
+    *match = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0) & 0x8888888888888888ull;
+    *empty = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hi), 4)), 0) & 0x8888888888888888ull;
+#else
+    uint64_t match_bits = 0;
+    uint64_t empty_bits = 0;
+    for(size_t i = 0; i < LOC_GROUP_SIZE; i++) {
+        if(control[i] == tag) match_bits |= (uint64_t)1 << i;
+        if(control[i] & 0x80) empty_bits |= (uint64_t)1 << i;
+    }
+    *match = match_bits;
+    *empty = empty_bits;
+#endif
+}
+
+static const char *loc_get_string_flat(loc_file *loc, const char *english_key, size_t key_len, uint64_t hash, loc_found *found) {
+    size_t group_mask = loc->flat_capacity / LOC_GROUP_SIZE - 1;
+    size_t group = (size_t)(hash >> 7) & group_mask;
+    uint8_t tag = (uint8_t)(hash & 0x7f);
+
+    for(size_t probe = 1; probe <= group_mask + 1; probe++) {
+        uint64_t match, empty;
+        LOC_STATS_COUNT(probes, 1);
+        loc_group_scan(loc->flat_control + group * LOC_GROUP_SIZE, tag, &match, &empty);
+
+        // Slots after the first empty one were never filled
+        if(empty) {
+            match &= (empty & (0 - empty)) - 1;
+        }
+
+        while(match) {
+            size_t i = loc_ctz64(match) / LOC_MASK_STRIDE;
+            const char *localized = loc_match_entry(loc, loc->flat_slots + (group * LOC_GROUP_SIZE + i) * loc->entry_size, english_key, key_len, hash, found);
+            if(localized) {
+                return localized;
+            }
+            match &= match - 1;
+        }
+
+        if(empty) {
+            return NULL;  // The key would have been put in this group
+        }
+        group = (group + probe) & group_mask;
+    }
+
+    return NULL;  // Not found
+}
+
+/* The patch's answer for a key. Returns 0 if the patch doesn't have the key, the file's own index does.
+ * Otherwise *localized is the new string, or NULL if the patch removed the key. */
+static int loc_patch_find(const loc_file *loc, const char *english_key, size_t key_len, uint64_t hash, const char **localized) {
+    size_t slot_mask = loc->patch_slot_count - 1;
+    size_t slot = (size_t)hash & slot_mask;
+
+    for(size_t probe = 0; probe <= slot_mask; probe++) {
+        uint32_t index = loc_read_u32(loc->patch_slots + slot * sizeof(uint32_t));
+        if(index == 0) {
+            return 0;  // The key would have been put here
+        }
+
+        // Entries were checked by loc_apply_patch, the strings are in bounds and terminated
+        const unsigned char *entry = loc->patch_entries + (size_t)(index - 1) * LOC_PATCH_ENTRY_SIZE;
+        if(loc_read_u64(entry) == hash && loc_read_u32(entry + 16) == key_len) {
+            const char *stored_english = (const char *)(loc->patch_strings + (size_t)loc_read_u64(entry + 24));
+            if(loc_memcmp(stored_english, english_key, key_len) == 0) {
+                *localized = (loc_read_u32(entry + 12) & LOC_PATCH_ENTRY_REMOVED) ? NULL : stored_english + key_len + 1;
+                return 1;
+            }
+        }
+        slot = (slot + 1) & slot_mask;
+    }
+
+    return 0;
+}
+
+static int loc_has_index(const loc_file *loc);
+
+/* Dispatches to the file's index. Only for files with a header, version 1 files use loc_get_string_v1.
+ * found (may be NULL) is filled in from the key's entry, it's left alone for a key the patch has. */
+static const char *loc_find(loc_file *loc, const char *english_key, size_t key_len, uint64_t hash, loc_found *found) {
+    const char *patched;
+    if(loc->patch_entries && loc_patch_find(loc, english_key, key_len, hash, &patched)) {
+        return patched;
+    }
+
+    if(!loc_has_index(loc)) {
+        return NULL;
+    }
+
+    if(loc->flags & LOC_FLAG_MPH) {
+        return loc_get_string_mph(loc, english_key, key_len, hash, found);
+    }
+    if(loc->flags & LOC_FLAG_FLAT) {
+        return loc_get_string_flat(loc, english_key, key_len, hash, found);
+    }
+    return loc_get_string_chained(loc, english_key, key_len, hash, found);
+}
+
+/* loc_find, counted in the thread's stats with LOC_STATS */
+static const char *loc_lookup(loc_file *loc, const char *english_key, size_t key_len, uint64_t hash, loc_found *found) {
+#if defined(LOC_STATS)
+    // Reading the clock costs more than a lookup, only one in LOC_STATS_LATENCY_SAMPLE is timed
+    loc_stats *stats = loc_stats_thread();
+    uint64_t probes = stats->probes;
+    int timed = stats->lookups % LOC_STATS_LATENCY_SAMPLE == 0;
+    uint64_t start = timed ? loc_stats_now() : 0;
+    const char *localized = loc_find(loc, english_key, key_len, hash, found);
+    uint64_t nanoseconds = timed ? loc_stats_now() - start : 0;
+    loc_stats_record(stats, localized, stats->probes - probes, timed, nanoseconds);
+    return localized;
+#else
+    return loc_find(loc, english_key, key_len, hash, found);
+#endif
+}
+
+LOCAPI const char *loc_get_string(loc_file *loc, const char *english_key) {
+    if(!loc || !loc->strings) {
+        return NULL;
+    }
+
+    if(loc->version == 1) {
+        if(!loc->bucket_offset_table || loc->bucket_count == 0) {
+            return NULL;
+        }
+        return loc_get_string_v1(loc, english_key);
+    }
+
+    size_t key_len = 0;
+    uint64_t hash = loc_hash64(english_key, &key_len);
+    return loc_lookup(loc, english_key, key_len, hash, NULL);
+}
+
+/* hash has to be loc_hash64 of the key, from a generated header or loc_hash64_constexpr */
+LOCAPI const char *loc_get_string_hashed(loc_file *loc, const char *english_key, uint64_t hash) {
+    if(!loc || !loc->strings) {
+        return NULL;
+    }
+
+    if(loc->version == 1) {
+        return loc_get_string(loc, english_key);  // Version 1 files use a different hash
+    }
+
+    return loc_lookup(loc, english_key, loc_strlen(english_key), hash, NULL);
+}
+
+/* 1 if the key has no translation of its own and loc_get_string returns a fallback language's string
+ * (loc_gen --fallback), 0 if it's translated or not in the file. A key a patch changed counts as translated,
+ * patches don't carry the flag. Value files (--shared-keys) don't either, their entries are in the keys file. */
+LOCAPI int loc_is_fallback(loc_file *loc, const char *english_key) {
+    if(!loc || !loc->strings || loc->version == 1 || !(loc->flags & LOC_FLAG_FALLBACK)) {
+        return 0;
+    }
+
+    size_t key_len = 0;
+    uint64_t hash = loc_hash64(english_key, &key_len);
+    loc_found found = {0, LOC_NO_OFFSET};
+    return loc_find(loc, english_key, key_len, hash, &found) && (found.entry_flags & LOC_ENTRY_FALLBACK);
+}
+
+/* The template compiled for the string at value_offset, NULL if it has none. A template that doesn't fit in the
+ * section, or whose string doesn't end where it says, is taken for none. */
+static const unsigned char *loc_template_find(const loc_file *loc, size_t value_offset) {
+    if(!loc->template_slot_count || value_offset == LOC_NO_OFFSET) {
+        return NULL;
+    }
+
+    size_t slot_mask = loc->template_slot_count - 1;
+    size_t slot = (size_t)loc_mix64(value_offset) & slot_mask;
+    for(size_t probe = 0; probe <= slot_mask; probe++) {
+        const unsigned char *entry = loc->template_slots + slot * LOC_TEMPLATE_SLOT_SIZE;
+        uint64_t offset = loc_read_u64(entry);
+        if(offset == LOC_TEMPLATE_EMPTY_SLOT) {
+            return NULL;  // The string would have been put here
+        }
+        if(offset == value_offset) {
+            uint64_t start = loc_read_u64(entry + 8);
+            if(start > loc->templates_size || LOC_TEMPLATE_HEADER_SIZE > loc->templates_size - start) {
+                return NULL;
+            }
+            const unsigned char *template_data = loc->templates + (size_t)start;
+            uint64_t value_len = loc_read_u32(template_data);
+            uint64_t op_count = loc_read_u32(template_data + 8);
+            if(op_count > (loc->templates_size - start - LOC_TEMPLATE_HEADER_SIZE) / 4 ||
+               value_len >= loc->value_strings_size - value_offset) {
+                return NULL;
+            }
+            return template_data;
+        }
+        slot = (slot + 1) & slot_mask;
+    }
+    return NULL;
+}
+
+/* Appends n bytes of text to out, as many as still fit before the terminator, and counts all of them */
+static void loc_format_append(char *out, size_t cap, size_t *len, const char *text, size_t n) {
+    if(*len + 1 < cap) {
+        size_t room = cap - 1 - *len;
+        loc_memcpy(out + *len, text, n < room ? n : room);
+    }
+    *len += n;
+}
+
+/* Terminates what loc_format_append wrote, returns the whole length */
+static size_t loc_format_end(char *out, size_t cap, size_t len) {
+    if(cap) {
+        out[len < cap ? len : cap - 1] = '\0';
+    }
+    return len;
+}
+
+/* The number in a {0}..{9999} placeholder at p, -1 if there isn't one. *size is the placeholder's length. */
+static long loc_format_placeholder(const char *p, size_t *size) {
+    long number = 0;
+    size_t digits = 0;
+    while(digits < 4 && p[1 + digits] >= '0' && p[1 + digits] <= '9') {
+        number = number * 10 + (p[1 + digits] - '0');
+        digits++;
+    }
+    if(digits == 0 || p[1 + digits] != '}') {
+        return -1;
+    }
+    *size = digits + 2;
+    return number;
+}
+
+/* Substitutes a string without a template while reading it: what loc_gen --templates compiles, except that
+ * {name} placeholders are left as they are, only the generator knows their numbers */
+static void loc_format_scan(const char *value, const char *const *args, size_t argc, char *out, size_t cap, size_t *len) {
+    const char *run = value;
+    const char *p = value;
+    while(*p) {
+        size_t size = 0;
+        long number;
+        if((p[0] == '{' && p[1] == '{') || (p[0] == '}' && p[1] == '}')) {
+            loc_format_append(out, cap, len, run, (size_t)(p + 1 - run));  // One of the two
+            p += 2;
+            run = p;
+        } else if(p[0] == '{' && (number = loc_format_placeholder(p, &size)) >= 0) {
+            loc_format_append(out, cap, len, run, (size_t)(p - run));
+            if((size_t)number < argc && args[number]) {
+                loc_format_append(out, cap, len, args[number], loc_strlen(args[number]));
+            } else {
+                loc_format_append(out, cap, len, p, size);  // No such argument, the placeholder stays
+            }
+            p += size;
+            run = p;
+        } else {
+            p++;
+        }
+    }
+    loc_format_append(out, cap, len, run, (size_t)(p - run));
+}
+
+/* Runs a template over its string. The length is known before anything is written: the template's literal
+ * bytes plus the arguments, so a result that fits is copied without checking room op by op. */
+static size_t loc_format_template(const unsigned char *template_data, const char *value, const char *const *args, size_t argc,
+                                  char *out, size_t cap) {
+    size_t value_len = loc_read_u32(template_data);
+    size_t op_count = loc_read_u32(template_data + 8);
+    const unsigned char *ops = template_data + LOC_TEMPLATE_HEADER_SIZE;
+
+    // Ops can't take more of the string than it has, a template that does is damaged and the string is used as it is
+    size_t needed = loc_read_u32(template_data + 4);
+    size_t used = 0;
+    for(size_t i = 0; i < op_count; i++) {
+        uint32_t op = loc_read_u32(ops + i * 4);
+        uint32_t kind = op & 3;
+        size_t size = kind == LOC_OP_ARG ? (size_t)(op >> 18) : (size_t)(op >> 2);
+        size_t arg = (op >> 2) & 0xffff;
+        if(kind > LOC_OP_ARG || size > value_len - used) {
+            size_t len = 0;
+            loc_format_append(out, cap, &len, value, loc_strlen(value));
+            return loc_format_end(out, cap, len);
+        }
+        used += size;
+        if(kind == LOC_OP_ARG) {
+            needed += arg < argc && args[arg] ? loc_strlen(args[arg]) : size;
+        }
+    }
+    if(used != value_len) {
+        size_t len = 0;
+        loc_format_append(out, cap, &len, value, loc_strlen(value));
+        return loc_format_end(out, cap, len);
+    }
+
+    size_t len = 0;
+    int fits = needed < cap;
+    for(size_t i = 0; i < op_count; i++) {
+        uint32_t op = loc_read_u32(ops + i * 4);
+        uint32_t kind = op & 3;
+        size_t size = kind == LOC_OP_ARG ? (size_t)(op >> 18) : (size_t)(op >> 2);
+        size_t arg = (op >> 2) & 0xffff;
+        const char *text = value;
+        size_t text_len = size;
+        if(kind == LOC_OP_ARG && arg < argc && args[arg]) {
+            text = args[arg];
+            text_len = loc_strlen(text);
+        }
+        if(kind != LOC_OP_SKIP) {
+            if(fits) {
+                loc_memcpy(out + len, text, text_len);
+                len += text_len;
+            } else {
+                loc_format_append(out, cap, &len, text, text_len);
+            }
+        }
+        value += size;
+    }
+    loc_format_end(out, cap, len);
+    return needed;
+}
+
+/* Formats the key's string with args into out: {0}..{9999} is that argument, {{ and }} are a brace. With loc_gen
+ * --templates the placeholders were compiled when the file was made, {name} placeholders too (numbered by the order
+ * they first appear in the row, from the key on), and nothing is parsed here. Otherwise the string is read as
+ * it's copied, and {name} is left as it is. A placeholder without an argument (past argc or NULL) stays too.
+ * Like snprintf: writes at most cap bytes including the terminator, returns the length of the whole text
+ * (a result that was cut short is >= cap), LOC_FORMAT_NOT_FOUND if the key isn't in the file.
+ * loc_format(loc, key, args, argc, NULL, 0) only measures. */
+LOCAPI size_t loc_format(loc_file *loc, const char *english_key, const char *const *args, size_t argc, char *out, size_t cap) {
+    if(cap) {
+        out[0] = '\0';
+    }
+    if(!loc || !loc->strings) {
+        return LOC_FORMAT_NOT_FOUND;
+    }
+
+    const char *value;
+    loc_found found = {0, LOC_NO_OFFSET};
+    if(loc->version == 1) {
+        value = loc_get_string(loc, english_key);
+    } else {
+        size_t key_len = 0;
+        uint64_t hash = loc_hash64(english_key, &key_len);
+        value = loc_lookup(loc, english_key, key_len, hash, &found);
+    }
+    if(!value) {
+        return LOC_FORMAT_NOT_FOUND;
+    }
+
+    // The template has to be for this string. A decompressed one is only known to end at its terminator, so it's measured.
+    const unsigned char *template_data = loc_template_find(loc, found.value_offset);
+    if(template_data) {
+        size_t value_len = loc_read_u32(template_data);
+        int same = (loc->flags & LOC_FLAG_COMPRESSED) ? loc_strlen(value) == value_len : value[value_len] == '\0';
+        if(same) {
+            return loc_format_template(template_data, value, args, argc, out, cap);
+        }
+    }
+
+    size_t len = 0;
+    if((loc->flags & LOC_FLAG_TEMPLATES) && found.value_offset != LOC_NO_OFFSET) {
+        loc_format_append(out, cap, &len, value, loc_strlen(value));  // Compiled, and it has no placeholders
+    } else {
+        loc_format_scan(value, args, argc, out, cap, &len);
+    }
+    return loc_format_end(out, cap, len);
+}
+
+/* Which of the language's plural forms n takes, see LOC_SECTION_PLURAL_RULES. Damaged rules give form 0, "other". */
+static size_t loc_plural_form(const loc_file *loc, uint64_t n) {
+    if(loc->plural_rules_size < 8) {
+        return 0;
+    }
+    size_t form_count = loc_read_u32(loc->plural_rules);
+    size_t table_size = loc_read_u32(loc->plural_rules + 4);
+    if(table_size > loc->plural_rules_size - 8) {
+        return 0;
+    }
+    if(n < table_size) {
+        size_t form = loc->plural_rules[8 + n];
+        return form < form_count ? form : 0;
+    }
+
+    // Past the table the conditions are evaluated, every word is checked to be in the section
+    const unsigned char *words = loc->plural_rules + 8 + table_size;
+    size_t word_count = (loc->plural_rules_size - 8 - table_size) / 4;
+    size_t pos = 0;
+    for(size_t form = 1; form < form_count; form++) {
+        if(pos >= word_count) {
+            return 0;
+        }
+        uint32_t or_count = loc_read_u32(words + pos++ * 4);
+        int matches = 0;
+        for(uint32_t group = 0; group < or_count; group++) {
+            if(pos >= word_count) {
+                return 0;
+            }
+            uint32_t and_count = loc_read_u32(words + pos++ * 4);
+            int all = 1;
+            for(uint32_t relation = 0; relation < and_count; relation++) {
+                if(word_count - pos < 3) {
+                    return 0;
+                }
+                uint64_t modulus = loc_read_u32(words + pos * 4);
+                int negate = loc_read_u32(words + (pos + 1) * 4) != 0;
+                size_t range_count = loc_read_u32(words + (pos + 2) * 4);
+                uint64_t value = modulus ? n % modulus : n;
+                int in_range = 0;
+                pos += 3;
+                if(range_count > (word_count - pos) / 2) {
+                    return 0;
+                }
+                for(size_t range = 0; range < range_count; range++, pos += 2) {
+                    in_range |= value >= loc_read_u32(words + pos * 4) && value <= loc_read_u32(words + (pos + 1) * 4);
+                }
+                all &= in_range != negate;
+            }
+            matches |= all;
+        }
+        if(matches) {
+            return form;
+        }
+    }
+    return 0;
+}
+
+/* The key's string for the count n: the plural form the language's rules pick for n (loc_gen --plurals). The key is
+ * the row's "other" form. Keys without forms, patched keys and forms the language leaves empty answer with the
+ * "other" form, which is also what loc_get_string returns. NULL if the key isn't in the file. */
+LOCAPI const char *loc_get_plural(loc_file *loc, const char *english_key, uint64_t n) {
+    if(!loc || !loc->strings) {
+        return NULL;
+    }
+    if(loc->version == 1) {
+        return loc_get_string(loc, english_key);
+    }
+
+    size_t key_len = 0;
+    uint64_t hash = loc_hash64(english_key, &key_len);
+    loc_found found = {0, LOC_NO_OFFSET};
+    const char *value = loc_lookup(loc, english_key, key_len, hash, &found);
+    if(!value || !(found.entry_flags & LOC_ENTRY_PLURAL) || found.value_offset == LOC_NO_OFFSET) {
+        return value;
+    }
+    size_t form = loc_plural_form(loc, n);
+    if(form == 0) {
+        return value;
+    }
+
+    // The forms follow each other. They can't be read past the strings, or a compressed file's block.
+    size_t room = loc->value_strings_size - found.value_offset;
+    if(loc->flags & LOC_FLAG_COMPRESSED) {
+        uint64_t block_end = loc_read_u64(loc->block_table + (loc_block_index(loc, found.value_offset) + 1) * 16);
+        room = block_end > found.value_offset && block_end <= loc->strings_size ? (size_t)block_end - found.value_offset : 0;
+    }
+    size_t pos = 0;
+    for(size_t skipped = 0; skipped < form; skipped++) {
+        while(pos < room && value[pos] != '\0') {
+            pos++;
+        }
+        pos++;
+        if(pos >= room) {
+            return value;
+        }
+    }
+    return value[pos] != '\0' ? value + pos : value;
+}
+
+/* Per-thread direct-mapped cache of loc_get_string_cached answers. An entry is the caller's key pointer and the
+ * table's generation, so a hit is a load and two compares: no hashing, no shared writes, nothing atomic.
+ * Freed, reloaded or patched tables have a new generation (or none), their old entries just never match again. */
+#if defined(LOC_THREAD_LOCAL) && LOC_LOOKUP_CACHE_SIZE > 0
+    #if (LOC_LOOKUP_CACHE_SIZE & (LOC_LOOKUP_CACHE_SIZE - 1)) != 0
+        #error "LOC_LOOKUP_CACHE_SIZE has to be a power of two"
+    #endif
+
+    typedef struct {
+        const char *key;
+        const char *value;
+        uint64_t generation;
+    } loc_cache_entry;
+
+    typedef struct {
+        loc_cache_entry entries[LOC_LOOKUP_CACHE_SIZE];
+        loc_cache_stats stats;
+    } loc_lookup_cache;
+
+    static LOC_THREAD_LOCAL loc_lookup_cache loc_thread_cache;
+#endif
+
+/* loc_get_string through the calling thread's cache, keyed on english_key's address instead of its text.
+ * Only pass keys whose text stays the same for as long as the address is used: string literals, or keys that
+ * live as long as the program. A buffer that's reused for other keys would get the answer for the old one.
+ * Misses are cached too. Compressed files aren't cached, their strings move when blocks are evicted. */
+LOCAPI const char *loc_get_string_cached(loc_file *loc, const char *english_key) {
+#if defined(LOC_THREAD_LOCAL) && LOC_LOOKUP_CACHE_SIZE > 0
+    if(!loc || !loc->generation || (loc->flags & LOC_FLAG_COMPRESSED)) {
+        return loc_get_string(loc, english_key);
+    }
+
+    uint64_t mixed = ((uint64_t)(uintptr_t)english_key ^ loc->generation) * 0x9e3779b97f4a7c15ull;
+    loc_cache_entry *entry = &loc_thread_cache.entries[(size_t)(mixed >> 32) & (LOC_LOOKUP_CACHE_SIZE - 1)];
+    if(entry->key == english_key && entry->generation == loc->generation) {
+        loc_thread_cache.stats.hits++;
+        LOC_STATS_COUNT(cache_hits, 1);
+        return entry->value;
+    }
+
+    loc_thread_cache.stats.misses++;
+    entry->key = english_key;
+    entry->generation = loc->generation;
+    entry->value = loc_get_string(loc, english_key);
+    return entry->value;
+#else
+    return loc_get_string(loc, english_key);
+#endif
+}
+
+/* The calling thread's loc_get_string_cached hits and misses since it started, zeros without a cache */
+LOCAPI loc_cache_stats loc_get_cache_stats(void) {
+#if defined(LOC_THREAD_LOCAL) && LOC_LOOKUP_CACHE_SIZE > 0
+    return loc_thread_cache.stats;
+#else
+    loc_cache_stats none = {0, 0};
+    return none;
+#endif
+}
+
+/* Binary search over the entries with an id. Returns 0 if the id isn't in the patch. */
+static int loc_patch_find_id(const loc_file *loc, uint32_t id, const char **localized) {
+    size_t low = 0;
+    size_t high = loc->patch_id_entry_count;
+    while(low < high) {
+        size_t middle = low + (high - low) / 2;
+        const unsigned char *entry = loc->patch_entries + middle * LOC_PATCH_ENTRY_SIZE;
+        uint32_t entry_id = loc_read_u32(entry + 8);
+        if(entry_id == id) {
+            *localized = (const char *)(loc->patch_strings + (size_t)loc_read_u64(entry + 24) + loc_read_u32(entry + 16) + 1);
+            return 1;
+        }
+        if(entry_id < id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return 0;
+}
+
+/* id is the key's row in the input file, see loc_gen --header */
+LOCAPI const char *loc_get_by_id(loc_file *loc, uint32_t id) {
+    if(loc && loc->patch_entries) {
+        // Ids are the new file's. An id the patch doesn't have kept its key and string, the file's own table has it.
+        const char *patched;
+        if(!(loc->patch_flags & LOC_PATCH_IDS) || id >= loc->patch_id_count) {
+            return NULL;
+        }
+        if(loc_patch_find_id(loc, id, &patched)) {
+            return patched;
+        }
+    }
+
+    if(!loc || !loc->value_strings) {
+        return NULL;
+    }
+    return loc_row_string(loc, id);
+}
+
+/* Batch lookups. A single lookup waits on two or three cache misses one after the other
+ * (index head, entries, strings). loc_get_strings walks LOC_BATCH_SIZE keys through those
+ * levels together: hash all and prefetch their index heads, then prefetch all their entries,
+ * then all their strings. By the time a key is compared its lines are (hopefully) in cache. */
+
+static int loc_has_index(const loc_file *loc) {
+    if(loc->flags & LOC_FLAG_MPH) {
+        return loc->mph_slot_count != 0 && loc->mph_bucket_count != 0;
+    }
+    if(loc->flags & LOC_FLAG_FLAT) {
+        return loc->flat_capacity != 0;
+    }
+    return loc->bucket_offset_table && loc->bucket_count != 0;
+}
+
+/* First thing a lookup reads */
+static const void *loc_index_head(const loc_file *loc, uint64_t hash) {
+    if(loc->flags & LOC_FLAG_MPH) {
+        return loc->mph_displacements + (size_t)((hash >> 32) % loc->mph_bucket_count) * sizeof(uint32_t);
+    }
+    if(loc->flags & LOC_FLAG_FLAT) {
+        size_t group_mask = loc->flat_capacity / LOC_GROUP_SIZE - 1;
+        return loc->flat_control + ((size_t)(hash >> 7) & group_mask) * LOC_GROUP_SIZE;
+    }
+    return loc->bucket_offset_table + (size_t)(hash % loc->bucket_count) * loc->offset_size;
+}
+
+/* Where the entries for the key are, needs the head. For the flat index that's the first slot
+ * in the first group with a matching tag. NULL if there's nothing to look at. */
+static const unsigned char *loc_index_entries(const loc_file *loc, uint64_t hash, size_t *count) {
+    *count = 1;
+    if(loc->flags & LOC_FLAG_MPH) {
+        size_t bucket_index = (size_t)((hash >> 32) % loc->mph_bucket_count);
+        uint32_t displacement = loc_read_u32(loc->mph_displacements + bucket_index * sizeof(uint32_t));
+        return loc->mph_slots + loc_mph_slot(hash, displacement, loc->mph_slot_count) * loc->entry_size;
+    }
+    if(loc->flags & LOC_FLAG_FLAT) {
+        size_t group_mask = loc->flat_capacity / LOC_GROUP_SIZE - 1;
+        size_t group = (size_t)(hash >> 7) & group_mask;
+        uint64_t match, empty;
+        loc_group_scan(loc->flat_control + group * LOC_GROUP_SIZE, (uint8_t)(hash & 0x7f), &match, &empty);
+        if(!match) {
+            return NULL;
+        }
+        return loc->flat_slots + (group * LOC_GROUP_SIZE + loc_ctz64(match) / LOC_MASK_STRIDE) * loc->entry_size;
+    }
+    return loc_bucket_entries(loc, hash, count);
+}
+
+/* The entry whose string the final compare will most likely read, needs the entries. May be NULL. */
+static const unsigned char *loc_index_candidate(const loc_file *loc, const unsigned char *entries, size_t count, size_t key_len, uint64_t hash) {
+    if(!entries) {
+        return NULL;
+    }
+    for(size_t i = 0; i < count; i++) {
+        const unsigned char *entry = entries + i * loc->entry_size;
+        if(loc_read_u32(entry) == (uint32_t)(hash >> 32) && (loc_read_u32(entry + 4) & LOC_ENTRY_KEY_LEN_MASK) == key_len) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+LOCAPI void loc_get_strings(loc_file *loc, const char *const *english_keys, size_t count, const char **out) {
+    if(!loc || !loc->strings || loc->version == 1 || !loc_has_index(loc)) {
+        for(size_t i = 0; i < count; i++) {
+            out[i] = loc_get_string(loc, english_keys[i]);
+        }
+        return;
+    }
+
+    uint64_t hashes[LOC_BATCH_SIZE];
+    size_t key_lens[LOC_BATCH_SIZE];
+    const unsigned char *entries[LOC_BATCH_SIZE];
+    size_t entry_counts[LOC_BATCH_SIZE];
+
+    for(size_t start = 0; start < count; start += LOC_BATCH_SIZE) {
+        size_t n = count - start < LOC_BATCH_SIZE ? count - start : LOC_BATCH_SIZE;
+        const char *const *keys = english_keys + start;
+
+        for(size_t i = 0; i < n; i++) {
+            hashes[i] = loc_hash64(keys[i], &key_lens[i]);
+            LOC_PREFETCH(loc_index_head(loc, hashes[i]));
+        }
+
+        for(size_t i = 0; i < n; i++) {
+            entries[i] = loc_index_entries(loc, hashes[i], &entry_counts[i]);
+            if(entries[i]) {
+                LOC_PREFETCH(entries[i]);
+            }
+        }
+
+        for(size_t i = 0; i < n; i++) {
+            const unsigned char *candidate = loc_index_candidate(loc, entries[i], entry_counts[i], key_lens[i], hashes[i]);
+            if(candidate && loc_entry_offset(loc, candidate) < loc->strings_size && !(loc->flags & LOC_FLAG_COMPRESSED)) {
+                LOC_PREFETCH(loc->strings + loc_entry_offset(loc, candidate));
+            }
+            // Entries that carry the row get their value through the id table
+            if(candidate && (loc->flags & (LOC_FLAG_KEYS | LOC_FLAG_DEDUP)) && loc_read_u32(candidate + 8) < loc->id_count) {
+                LOC_PREFETCH(loc->id_table + (size_t)loc_read_u32(candidate + 8) * loc->value_offset_size);
+            }
+        }
+
+        // Everything the lookups need should be in cache now
+        for(size_t i = 0; i < n; i++) {
+            out[start + i] = loc_lookup(loc, keys[i], key_lens[i], hashes[i], NULL);
+        }
+    }
+}
+
+/* Checks that a patch entry's strings are inside the patch and terminated, lookups don't check again */
+static int loc_patch_entry_valid(const unsigned char *entry, const unsigned char *strings, size_t strings_size) {
+    uint64_t offset = loc_read_u64(entry + 24);
+    uint64_t key_len = loc_read_u32(entry + 16);
+    uint64_t value_len = loc_read_u32(entry + 20);
+    uint32_t flags = loc_read_u32(entry + 12);
+    if(offset > strings_size || key_len + value_len + 2 > strings_size - offset) {
+        return 0;
+    }
+    if(strings[offset + key_len] != 0 || strings[offset + key_len + 1 + value_len] != 0) {
+        return 0;
+    }
+    if((flags & ~(uint32_t)(LOC_PATCH_ENTRY_KEY | LOC_PATCH_ENTRY_REMOVED)) ||
+       ((flags & LOC_PATCH_ENTRY_REMOVED) && !(flags & LOC_PATCH_ENTRY_KEY))) {
+        return 0;
+    }
+    return 1;
+}
+
+/* Puts a patch made by loc_gen --diff in front of the file, lookups find the new strings without the file being
+ * copied or rebuilt. Only the patch is read, it's checked once here and lookups use it in place.
+ * The patch isn't copied: it has to stay unchanged (and 8 byte aligned, like malloc'd memory) as long as loc is used,
+ * loc_free doesn't free it. A file has one patch at a time, a new one replaces the last, NULL removes it.
+ * Returns 1 if the patch is in place, 0 if it's damaged or was made for another file, the file is left as it was. */
+LOCAPI int loc_apply_patch(loc_file *loc, const void *patch, size_t patch_size) {
+    if(!loc || !loc->strings) {
+        return 0;
+    }
+
+    if(!patch) {
+        loc->patch_entries = NULL;
+        loc->patch_slots = NULL;
+        loc->patch_strings = NULL;
+        loc->patch_id_entry_count = 0;
+        loc->patch_slot_count = 0;
+        loc->patch_id_count = 0;
+        loc->patch_flags = 0;
+        loc->generation = loc_next_generation();
+        return 1;
+    }
+
+    // Patches hold keys and values, keys files and value files (loc_attach) don't have both
+    const unsigned char *header = (const unsigned char *)patch;
+    if(loc->version != LOC_VERSION || (loc->flags & (LOC_FLAG_KEYS | LOC_FLAG_VALUES)) ||
+       patch_size < LOC_PATCH_HEADER_SIZE || loc_memcmp(header, LOC_PATCH_MAGIC, 4) != 0 ||
+       loc_read_u32(header + 4) != LOC_PATCH_VERSION || (loc_read_u32(header + 8) & ~(uint32_t)LOC_PATCH_IDS) ||
+       loc_read_u64(header + 16) != patch_size) {
+        return 0;
+    }
+
+    if(loc_read_u64(header + 24) != loc->strings_size || loc_read_u32(header + 32) != loc->id_count) {
+        return 0;  // Made against another file
+    }
+
+    uint64_t entry_count = loc_read_u32(header + 12);
+    uint64_t slot_count = loc_read_u32(header + 40);
+    uint64_t slots_start = LOC_PATCH_HEADER_SIZE + entry_count * LOC_PATCH_ENTRY_SIZE;
+    uint64_t strings_start = slots_start + slot_count * sizeof(uint32_t);
+    if(slot_count == 0 || (slot_count & (slot_count - 1)) != 0 || entry_count >= slot_count || strings_start > patch_size) {
+        return 0;
+    }
+
+    const unsigned char *entries = header + LOC_PATCH_HEADER_SIZE;
+    const unsigned char *slots = header + (size_t)slots_start;
+    const unsigned char *strings = header + (size_t)strings_start;
+    size_t strings_size = patch_size - (size_t)strings_start;
+    uint32_t id_count = loc_read_u32(header + 36);
+
+    // Ids are sorted and come first, so loc_get_by_id can search them
+    size_t id_entry_count = 0;
+    for(size_t i = 0; i < (size_t)entry_count; i++) {
+        const unsigned char *entry = entries + i * LOC_PATCH_ENTRY_SIZE;
+        uint32_t id = loc_read_u32(entry + 8);
+        if(!loc_patch_entry_valid(entry, strings, strings_size)) {
+            return 0;
+        }
+        if(id != LOC_PATCH_NO_ID) {
+            if(id_entry_count != i || id >= id_count ||
+               (i > 0 && id <= loc_read_u32(entry - LOC_PATCH_ENTRY_SIZE + 8))) {
+                return 0;
+            }
+            id_entry_count++;
+        }
+    }
+
+    for(size_t slot = 0; slot < (size_t)slot_count; slot++) {
+        uint32_t index = loc_read_u32(slots + slot * sizeof(uint32_t));
+        if(index > entry_count ||
+           (index != 0 && !(loc_read_u32(entries + (size_t)(index - 1) * LOC_PATCH_ENTRY_SIZE + 12) & LOC_PATCH_ENTRY_KEY))) {
+            return 0;
+        }
+    }
+
+    loc->patch_entries = entries;
+    loc->patch_slots = slots;
+    loc->patch_strings = strings;
+    loc->patch_id_entry_count = id_entry_count;
+    loc->patch_slot_count = (size_t)slot_count;
+    loc->patch_id_count = id_count;
+    loc->patch_flags = loc_read_u32(header + 8);
+    loc->generation = loc_next_generation();  // Answers changed, cached ones from before are stale
+    return 1;
+}
+
+LOCAPI void loc_free(loc_file *loc) {
+    if(loc && loc->block_cache) {
+        loc_block_cache_free(loc->block_cache);
+        loc->block_cache = NULL;
+    }
+    if(loc && loc->file_buffer) {
+        if(loc->load_flags & LOC_LOAD_MMAP) {
+            loc_unmap_file(loc->file_buffer, loc->file_size);
+        } else {
+            free(loc->file_buffer);
+        }
+        loc_file empty = {0};
+        *loc = empty;
+    }
+}
+
+/* Hot reload. A handle publishes one table at a time, reloading swaps in a new one and retires the old one.
+ * Readers announce the epoch they entered at in their own slot, a retired table is freed once every reader
+ * that's inside entered after it was replaced. Entering and leaving are a few loads and stores, readers never
+ * wait on a lock or on the writer. Reloads have to come from one thread at a time. */
+#if defined(LOC_ATOMIC_LOAD_U64)
+
+#define LOC_READER_FREE 0
+#define LOC_READER_OUTSIDE 1
+#define LOC_FIRST_EPOCH 2
+
+/* file comes first, the handle publishes &table->file */
+struct loc_handle_table {
+    loc_file file;
+    uint64_t retired_epoch;  // freed once no reader entered before this epoch
+    loc_handle_table *next;
+};
+
+static loc_file *loc_handle_load_table(const char *file_path, uint32_t flags) {
+    loc_handle_table *table = (loc_handle_table *)calloc(1, sizeof(loc_handle_table));
+    if(!table) {
+        return NULL;
+    }
+
+    // Lookups in a compressed file fill its block cache, readers on several threads would race on it
+    table->file = loc_load_flags(file_path, flags);
+    if(!table->file.strings || (table->file.flags & LOC_FLAG_COMPRESSED)) {
+        loc_free(&table->file);
+        free(table);
+        return NULL;
+    }
+    return &table->file;
+}
+
+static void loc_handle_free_table(loc_handle_table *table) {
+    loc_free(&table->file);
+    free(table);
+}
+
+LOCAPI loc_handle *loc_handle_open(const char *file_path, uint32_t flags) {
+    loc_file *table = loc_handle_load_table(file_path, flags);
+    if(!table) {
+        return NULL;
+    }
+
+    loc_handle *handle = (loc_handle *)calloc(1, sizeof(loc_handle));
+    if(!handle) {
+        loc_handle_free_table((loc_handle_table *)table);
+        return NULL;
+    }
+
+    handle->current = table;
+    handle->epoch = LOC_FIRST_EPOCH;
+    handle->load_flags = flags;
+    return handle;
+}
+
+/* Frees retired tables no reader can still be using. loc_handle_reload calls it too. */
+LOCAPI void loc_handle_reclaim(loc_handle *handle) {
+    if(!handle) {
+        return;
+    }
+
+    uint64_t oldest = LOC_ATOMIC_LOAD_U64(&handle->epoch);
+    for(int i = 0; i < LOC_HANDLE_MAX_READERS; i++) {
+        uint64_t reader_epoch = LOC_ATOMIC_LOAD_U64(&handle->readers[i].epoch);
+        if(reader_epoch >= LOC_FIRST_EPOCH && reader_epoch < oldest) {
+            oldest = reader_epoch;
+        }
+    }
+
+    loc_handle_table **link = &handle->retired;
+    while(*link) {
+        loc_handle_table *table = *link;
+        if(table->retired_epoch <= oldest) {
+            *link = table->next;
+            loc_handle_free_table(table);
+            handle->retired_count--;
+        } else {
+            link = &table->next;
+        }
+    }
+}
+
+/* Returns 1 once the new table is published, 0 if it couldn't be loaded and the current table stays.
+ * The old table is freed once the last reader that could have seen it leaves. */
+LOCAPI int loc_handle_reload(loc_handle *handle, const char *file_path) {
+    if(!handle) {
+        return 0;
+    }
+
+    loc_file *table = loc_handle_load_table(file_path, handle->load_flags);
+    if(!table) {
+        return 0;
+    }
+
+    // Readers that enter at the new epoch are guaranteed to see the new table
+    loc_handle_table *old = (loc_handle_table *)LOC_ATOMIC_EXCHANGE_PTR(&handle->current, table);
+    old->retired_epoch = LOC_ATOMIC_INCREMENT_U64(&handle->epoch);
+    old->next = handle->retired;
+    handle->retired = old;
+    handle->retired_count++;
+
+    loc_handle_reclaim(handle);
+    return 1;
+}
+
+/* No reader may be inside */
+LOCAPI void loc_handle_close(loc_handle *handle) {
+    if(!handle) {
+        return;
+    }
+
+    while(handle->retired) {
+        loc_handle_table *next = handle->retired->next;
+        loc_handle_free_table(handle->retired);
+        handle->retired = next;
+    }
+    loc_handle_free_table((loc_handle_table *)handle->current);
+    free(handle);
+}
+
+/* Claims a reader slot, once per thread. -1 if all LOC_HANDLE_MAX_READERS are taken. */
+LOCAPI int loc_handle_register_reader(loc_handle *handle) {
+    if(!handle) {
+        return -1;
+    }
+
+    for(int i = 0; i < LOC_HANDLE_MAX_READERS; i++) {
+        uint64_t expected = LOC_READER_FREE;
+        if(LOC_ATOMIC_CAS_U64(&handle->readers[i].epoch, expected, LOC_READER_OUTSIDE)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+LOCAPI void loc_handle_unregister_reader(loc_handle *handle, int reader) {
+    if(handle && reader >= 0 && reader < LOC_HANDLE_MAX_READERS) {
+        LOC_ATOMIC_STORE_U64(&handle->readers[reader].epoch, LOC_READER_FREE);
+    }
+}
+
+/* The current table. It and every string looked up in it stay valid until loc_handle_leave. */
+LOCAPI loc_file *loc_handle_enter(loc_handle *handle, int reader) {
+    LOC_ATOMIC_STORE_U64(&handle->readers[reader].epoch, LOC_ATOMIC_LOAD_U64(&handle->epoch));
+    return LOC_ATOMIC_LOAD_PTR(&handle->current);
+}
+
+LOCAPI void loc_handle_leave(loc_handle *handle, int reader) {
+    LOC_ATOMIC_STORE_U64(&handle->readers[reader].epoch, LOC_READER_OUTSIDE);
+}
+
+#endif
+
+LOCAPI loc_bundle loc_bundle_open_flags(const char *file_path, uint32_t flags) {
+    loc_bundle bundle = {0};
+    size_t file_size = 0;
+    unsigned char *file_buffer;
+
+    if(flags & LOC_LOAD_MMAP) {
+        file_buffer = loc_map_entire_file(file_path, &file_size);
+    } else {
+        file_buffer = loc_read_entire_file(file_path, &file_size);
+    }
+
+    if(!file_buffer) {
+        return bundle;
+    }
+
+    bundle.file_buffer = file_buffer;
+    bundle.file_size = file_size;
+    bundle.load_flags = flags;
+
+    // Only the header and directory are checked here, languages are checked when they're asked for
+    if(file_size < LOC_BUNDLE_HEADER_SIZE || loc_memcmp(file_buffer, LOC_BUNDLE_MAGIC, 4) != 0 ||
+       loc_read_u32(file_buffer + 4) != LOC_BUNDLE_VERSION || loc_read_u64(file_buffer + 16) != file_size) {
+        return bundle;
+    }
+
+    uint32_t language_count = loc_read_u32(file_buffer + 8);
+    if((uint64_t)language_count * LOC_BUNDLE_ENTRY_SIZE > file_size - LOC_BUNDLE_HEADER_SIZE) {
+        return bundle;
+    }
+
+    bundle.directory = file_buffer + LOC_BUNDLE_HEADER_SIZE;
+    bundle.language_count = language_count;
+    return bundle;
+}
+
+/* Bundles are mapped by default, a server answering in any language only touches the pages it uses */
+LOCAPI loc_bundle loc_bundle_open(const char *file_path) {
+    return loc_bundle_open_flags(file_path, LOC_LOAD_MMAP);
+}
+
+static int loc_bundle_code_equals(const unsigned char *stored, const char *lang_code) {
+    size_t i = 0;
+    for(; i < LOC_BUNDLE_CODE_SIZE && lang_code[i]; i++) {
+        if(stored[i] != (unsigned char)lang_code[i]) {
+            return 0;
+        }
+    }
+    return i < LOC_BUNDLE_CODE_SIZE && stored[i] == 0;
+}
+
+/* The embedded file for lang_code, parsed in place. The view doesn't own its memory. */
+static loc_file loc_bundle_find(const loc_bundle *bundle, const char *lang_code) {
+    loc_file view = {0};
+
+    for(uint32_t i = 0; i < bundle->language_count; i++) {
+        const unsigned char *entry = bundle->directory + (size_t)i * LOC_BUNDLE_ENTRY_SIZE;
+        if(!loc_bundle_code_equals(entry, lang_code)) {
+            continue;
+        }
+
+        uint64_t offset = loc_read_u64(entry + LOC_BUNDLE_CODE_SIZE);
+        uint64_t size = loc_read_u64(entry + LOC_BUNDLE_CODE_SIZE + 8);
+        if(offset > bundle->file_size || size > bundle->file_size - offset || offset % 8 != 0 || size < LOC_HEADER_SIZE) {
+            return view;  // Corrupt
+        }
+
+        view.file_buffer = bundle->file_buffer + (size_t)offset;
+        view.file_size = (size_t)size;
+        if(loc_memcmp(view.file_buffer, LOC_MAGIC, 4) == 0) {
+            loc_parse_sections(&view);
+        }
+        if(view.flags & LOC_FLAG_COMPRESSED) {
+            loc_file empty = {0};
+            return empty;  // Nothing would free its block cache
+        }
+        view.file_buffer = NULL;
+        view.file_size = 0;
+        view.generation = loc_next_generation();
+        return view;
+    }
+
+    return view;
+}
+
+LOCAPI loc_file loc_bundle_get_language(const loc_bundle *bundle, const char *lang_code) {
+    loc_file empty = {0};
+    if(!bundle || !bundle->directory || !lang_code) {
+        return empty;
+    }
+
+    loc_file language = loc_bundle_find(bundle, lang_code);
+    if(language.flags & LOC_FLAG_VALUES) {
+        loc_file keys = loc_bundle_find(bundle, LOC_BUNDLE_KEYS);
+        return loc_attach(&keys, &language);
+    }
+    return language;
+}
+
+LOCAPI void loc_bundle_close(loc_bundle *bundle) {
+    if(bundle && bundle->file_buffer) {
+        if(bundle->load_flags & LOC_LOAD_MMAP) {
+            loc_unmap_file(bundle->file_buffer, bundle->file_size);
+        } else {
+            free(bundle->file_buffer);
+        }
+        loc_bundle empty = {0};
+        *bundle = empty;
+    }
+}
+
+/* The lookup counters of every thread added up, all zero without LOC_STATS. Safe to call from any thread while
+ * others look things up, their latest lookups may be missing. Counts are never reset, subtract an earlier snapshot
+ * to measure a stretch of time (max_probes is over the whole run). */
+LOCAPI loc_stats loc_stats_snapshot(void) {
+    loc_stats total = {0};
+#if defined(LOC_STATS)
+    uint64_t thread_count = LOC_ATOMIC_LOAD_U64(&loc_stats_thread_count);
+    uint64_t tracked = thread_count < LOC_STATS_MAX_THREADS ? thread_count : LOC_STATS_MAX_THREADS;
+    for(size_t i = 0; i < tracked; i++) {
+        loc_stats *stats = &loc_stats_blocks[i].stats;
+        total.lookups += LOC_STATS_READ(&stats->lookups);
+        total.misses += LOC_STATS_READ(&stats->misses);
+        total.probes += LOC_STATS_READ(&stats->probes);
+        total.compare_bytes += LOC_STATS_READ(&stats->compare_bytes);
+        total.blocks_decompressed += LOC_STATS_READ(&stats->blocks_decompressed);
+        total.cache_hits += LOC_STATS_READ(&stats->cache_hits);
+        uint64_t max_probes = LOC_STATS_READ(&stats->max_probes);
+        total.max_probes = max_probes > total.max_probes ? max_probes : total.max_probes;
+        for(size_t j = 0; j < LOC_STATS_PROBE_BUCKETS; j++) {
+            total.probe_histogram[j] += LOC_STATS_READ(&stats->probe_histogram[j]);
+        }
+        for(size_t j = 0; j < LOC_STATS_LATENCY_BUCKETS; j++) {
+            total.latency_histogram[j] += LOC_STATS_READ(&stats->latency_histogram[j]);
+        }
+    }
+    total.threads = tracked;
+    total.untracked_threads = thread_count - tracked;
+#endif
+    return total;
 }
 
 #endif /* LOC_IMPLEMENTATION */
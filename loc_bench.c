@@ -0,0 +1,1269 @@
+/* loc_bench.c - benchmarks for loc_gen and loc.h
+ *
+ * Makes a synthetic corpus, builds it with loc_gen once per index, then times loading the files and looking
+ * strings up in them. Needs nothing but a loc_gen binary and a POSIX system (written for Linux):
+ *   cc -O2 loc_gen.c -o loc_gen -lpthread
+ *   cc -O2 loc_bench.c -o loc_bench -lpthread -lm
+ *   ./loc_bench --rows=200000 --languages=4 --out=before.json
+ *
+ * For every index (--variants) it measures:
+ *   loc_gen         wall time and peak RSS of the generator building every language
+ *   load            loc_load and loc_load_mapped of one language, median of --load-runs
+ *   hit             random lookups of keys that are in the file, one thread
+ *   miss            lookups of keys that aren't
+ *   batch           loc_get_strings, --batch keys per call
+ *   hit_mt          random hits from --threads threads sharing one loc_file
+ *   collide         lookups of the --collide keys that all land in the same chained bucket
+ * Throughput comes from an untimed loop, latency percentiles from --samples lookups timed one at a time
+ * (the cost of reading the clock is measured and taken off). Results go to stdout and, as JSON, to --out.
+ * Compile with -DLOC_STATS to also get the loader's probe and compare counts per workload.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/utsname.h>
+
+#define LOC_IMPLEMENTATION
+#include "loc.h"
+
+#define BENCH_MAX_LANGUAGES 32
+#define BENCH_MAX_THREADS 64
+#define BENCH_MAX_GEN_ARGS 32
+#define BENCH_MAX_TEXT 4096
+
+static const char *language_codes[BENCH_MAX_LANGUAGES] = {
+    "en", "fr", "de", "es", "it", "pt", "nl", "sv", "pl", "ru", "uk", "el", "tr", "ar", "he", "hi",
+    "th", "vi", "id", "ja", "zh", "ko", "cs", "da", "fi", "no", "hu", "ro", "bg", "hr", "sk", "sl"
+};
+
+/* Translations are words of code points from one script, picked by weight for every string */
+typedef struct {
+    const char *name;
+    uint32_t low;
+    uint32_t high;
+    int spaced;  // words separated by spaces, CJK runs them together
+    double weight;
+} script;
+
+static script scripts[] = {
+    {"latin", 'a', 'z', 1, 50},
+    {"accented", 0xe0, 0xff, 1, 10},
+    {"greek", 0x3b1, 0x3c9, 1, 5},
+    {"cyrillic", 0x430, 0x44f, 1, 10},
+    {"arabic", 0x627, 0x64a, 1, 5},
+    {"devanagari", 0x915, 0x939, 1, 5},
+    {"cjk", 0x4e00, 0x9fff, 0, 10},
+    {"emoji", 0x1f600, 0x1f64f, 1, 5},
+};
+#define SCRIPT_COUNT (sizeof(scripts) / sizeof(scripts[0]))
+
+/* An index to build, the name is what results are filed under */
+typedef struct {
+    const char *name;
+    const char *gen_flag;
+} variant;
+
+static const variant known_variants[] = {
+    {"chained", NULL},
+    {"mph", "--mph"},
+    {"flat", "--flat"},
+    {"compress", "--compress"},
+    {"dedup", "--dedup"},
+};
+#define KNOWN_VARIANT_COUNT (sizeof(known_variants) / sizeof(known_variants[0]))
+
+typedef struct {
+    size_t rows;
+    int languages;
+    char key_dist;  // 'u'niform, 'e'xponential or 'f'ixed
+    double key_min;
+    double key_max;
+    double key_mean;
+    size_t collide;
+    size_t miss_keys;
+    uint64_t seed;
+    int threads;
+    size_t lookups;
+    size_t samples;
+    size_t batch;
+    int load_runs;
+    const char *loc_gen;
+    const char *dir;
+    const char *out;
+    const char *variants;
+    const char *gen_args;
+    int keep;
+} bench_config;
+
+/* splitmix64, the corpus only depends on --seed */
+static uint64_t rng_next(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static double rng_unit(uint64_t *state) {
+    return (double)(rng_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t rng_range(uint64_t *state, uint64_t low, uint64_t high) {
+    return low + rng_next(state) % (high - low + 1);
+}
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static void *xmalloc(size_t size) {
+    void *p = malloc(size ? size : 1);
+    if(!p) {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static char *xstrdup(const char *s, size_t len) {
+    char *copy = (char *)xmalloc(len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+static size_t put_utf8(char *out, uint32_t c) {
+    if(c < 0x80) {
+        out[0] = (char)c;
+        return 1;
+    }
+    if(c < 0x800) {
+        out[0] = (char)(0xc0 | (c >> 6));
+        out[1] = (char)(0x80 | (c & 0x3f));
+        return 2;
+    }
+    if(c < 0x10000) {
+        out[0] = (char)(0xe0 | (c >> 12));
+        out[1] = (char)(0x80 | ((c >> 6) & 0x3f));
+        out[2] = (char)(0x80 | (c & 0x3f));
+        return 3;
+    }
+    out[0] = (char)(0xf0 | (c >> 18));
+    out[1] = (char)(0x80 | ((c >> 12) & 0x3f));
+    out[2] = (char)(0x80 | ((c >> 6) & 0x3f));
+    out[3] = (char)(0x80 | (c & 0x3f));
+    return 4;
+}
+
+/* Words from one script until the text is at least target bytes long */
+static size_t make_text(char *out, size_t target, const script *s, uint64_t *rng) {
+    size_t len = 0;
+    if(target > BENCH_MAX_TEXT - 64) target = BENCH_MAX_TEXT - 64;
+    while(len < target) {
+        if(len > 0 && s->spaced) {
+            out[len++] = ' ';
+        }
+        size_t chars = (size_t)rng_range(rng, 2, 9);
+        for(size_t i = 0; i < chars; i++) {
+            len += put_utf8(out + len, (uint32_t)rng_range(rng, s->low, s->high));
+        }
+    }
+    out[len] = '\0';
+    return len;
+}
+
+/* Keys are ASCII words cut to exactly len bytes, like English source strings */
+static size_t make_key(char *out, size_t len, uint64_t *rng) {
+    make_text(out, len, &scripts[0], rng);
+    out[len] = '\0';
+    if(out[len - 1] == ' ') {
+        out[len - 1] = (char)rng_range(rng, 'a', 'z');
+    }
+    return len;
+}
+
+static size_t key_length(const bench_config *config, uint64_t *rng) {
+    double len;
+    if(config->key_dist == 'u') {
+        len = (double)rng_range(rng, (uint64_t)config->key_min, (uint64_t)config->key_max);
+    } else if(config->key_dist == 'e') {
+        len = 1.0 + -(config->key_mean - 1.0) * log(1.0 - rng_unit(rng));
+    } else {
+        len = config->key_mean;
+    }
+    if(len < 1.0) len = 1.0;
+    if(len > 1024.0) len = 1024.0;
+    return (size_t)len;
+}
+
+static const script *pick_script(uint64_t *rng) {
+    double total = 0.0;
+    for(size_t i = 0; i < SCRIPT_COUNT; i++) total += scripts[i].weight;
+    double pick = rng_unit(rng) * total;
+    for(size_t i = 0; i < SCRIPT_COUNT; i++) {
+        if(pick < scripts[i].weight) return &scripts[i];
+        pick -= scripts[i].weight;
+    }
+    return &scripts[0];
+}
+
+/* Set of loc_hash64 values, keys have to be distinct and loc_gen refuses two keys with one hash */
+typedef struct {
+    uint64_t *slots;
+    size_t mask;
+} hash_set;
+
+static void hash_set_init(hash_set *set, size_t count) {
+    size_t capacity = 16;
+    while(capacity < count * 2) capacity *= 2;
+    set->slots = (uint64_t *)calloc(capacity, sizeof(uint64_t));
+    if(!set->slots) {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    set->mask = capacity - 1;
+}
+
+/* 0 if the hash was already in the set. Hash 0 stands for an empty slot, a key that hashes to it is refused too. */
+static int hash_set_insert(hash_set *set, uint64_t hash) {
+    if(hash == 0) return 0;
+    size_t slot = (size_t)hash & set->mask;
+    while(set->slots[slot]) {
+        if(set->slots[slot] == hash) return 0;
+        slot = (slot + 1) & set->mask;
+    }
+    set->slots[slot] = hash;
+    return 1;
+}
+
+typedef struct {
+    size_t row_count;        // rows + collide
+    int language_count;
+    char **fields;           // row_count * language_count, the first language is the key itself
+    char **hit_keys;         // the rows' keys in random order, without the colliding ones
+    size_t hit_count;
+    char **miss_keys;
+    size_t miss_count;
+    char **collide_keys;
+    size_t collide_count;
+    size_t input_size;
+} corpus;
+
+/* A key that lands in chained bucket target of bucket_count: a random prefix, then suffixes are tried until
+ * the hash fits. FNV-1a runs over the prefix once, each try only hashes the suffix. */
+static size_t make_colliding_key(char *out, size_t bucket_count, size_t target, uint64_t *rng) {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    size_t prefix_len = make_key(out, (size_t)rng_range(rng, 8, 24), rng);
+    out[prefix_len++] = ' ';
+
+    uint64_t prefix_hash = 14695981039346656037ull;
+    for(size_t i = 0; i < prefix_len; i++) {
+        prefix_hash = (prefix_hash ^ (unsigned char)out[i]) * 1099511628211ull;
+    }
+
+    for(uint64_t attempt = 0;; attempt++) {
+        uint64_t hash = prefix_hash;
+        uint64_t n = attempt;
+        size_t len = prefix_len;
+        do {
+            out[len] = alphabet[n % 62];
+            hash = (hash ^ (unsigned char)out[len]) * 1099511628211ull;
+            len++;
+            n /= 62;
+        } while(n);
+        if(loc_mix64(hash) % bucket_count == target) {
+            out[len] = '\0';
+            return len;
+        }
+    }
+}
+
+static void make_corpus(const bench_config *config, corpus *c) {
+    uint64_t rng = config->seed;
+    c->row_count = config->rows + config->collide;
+    c->language_count = config->languages;
+    c->fields = (char **)xmalloc(c->row_count * (size_t)c->language_count * sizeof(char *));
+    c->hit_count = config->rows;
+    c->hit_keys = (char **)xmalloc(c->hit_count * sizeof(char *));
+    c->miss_count = config->miss_keys;
+    c->miss_keys = (char **)xmalloc(c->miss_count * sizeof(char *));
+    c->collide_count = config->collide;
+    c->collide_keys = (char **)xmalloc(c->collide_count * sizeof(char *));
+
+    hash_set seen;
+    hash_set_init(&seen, c->row_count + c->miss_count);
+    char text[BENCH_MAX_TEXT];
+
+    // Keys, lengthened by one whenever short ones run out
+    for(size_t row = 0; row < c->row_count; row++) {
+        size_t len = 0;
+        if(row < config->rows) {
+            size_t target = key_length(config, &rng);
+            for(int attempt = 0;; attempt++) {
+                size_t hashed_len;
+                len = make_key(text, target, &rng);
+                if(hash_set_insert(&seen, loc_hash64(text, &hashed_len))) break;
+                if(attempt % 64 == 63 && target < 1024) target++;
+            }
+        } else {
+            size_t target = loc_hash64("collide", &len) % c->row_count;
+            do {
+                len = make_colliding_key(text, c->row_count, target, &rng);
+            } while(!hash_set_insert(&seen, loc_hash64(text, &len)));
+        }
+        c->fields[row * (size_t)c->language_count] = xstrdup(text, len);
+        if(row >= config->rows) {
+            c->collide_keys[row - config->rows] = c->fields[row * (size_t)c->language_count];
+        }
+    }
+
+    for(size_t row = 0; row < c->row_count; row++) {
+        size_t key_len = strlen(c->fields[row * (size_t)c->language_count]);
+        for(int lang = 1; lang < c->language_count; lang++) {
+            size_t target = (size_t)((double)key_len * (0.7 + 0.9 * rng_unit(&rng))) + 1;
+            size_t len = make_text(text, target, pick_script(&rng), &rng);
+            c->fields[row * (size_t)c->language_count + (size_t)lang] = xstrdup(text, len);
+        }
+    }
+
+    // Hits in random order, so consecutive lookups don't walk the file front to back
+    for(size_t i = 0; i < c->hit_count; i++) {
+        c->hit_keys[i] = c->fields[i * (size_t)c->language_count];
+    }
+    for(size_t i = c->hit_count; i > 1; i--) {
+        size_t j = (size_t)(rng_next(&rng) % i);
+        char *swap = c->hit_keys[i - 1];
+        c->hit_keys[i - 1] = c->hit_keys[j];
+        c->hit_keys[j] = swap;
+    }
+
+    // Misses look like keys, with the same lengths, and aren't in the file
+    for(size_t i = 0; i < c->miss_count; i++) {
+        size_t target = key_length(config, &rng);
+        size_t len;
+        for(int attempt = 0;; attempt++) {
+            size_t hashed_len;
+            len = make_key(text, target, &rng);
+            if(hash_set_insert(&seen, loc_hash64(text, &hashed_len))) break;
+            if(attempt % 64 == 63 && target < 1024) target++;
+        }
+        c->miss_keys[i] = xstrdup(text, len);
+    }
+
+    free(seen.slots);
+}
+
+static int write_corpus(const corpus *c, const char *path, size_t *size) {
+    FILE *f = fopen(path, "wb");
+    if(!f) {
+        return 0;
+    }
+    for(size_t row = 0; row < c->row_count; row++) {
+        for(int lang = 0; lang < c->language_count; lang++) {
+            if(lang > 0) fputs(" | ", f);
+            fputs(c->fields[row * (size_t)c->language_count + (size_t)lang], f);
+        }
+        fputc('\n', f);
+    }
+    *size = (size_t)ftell(f);
+    return fclose(f) == 0;
+}
+
+/* Runs loc_gen with its output going to log_path. Returns its exit status, -1 if it couldn't run. */
+static int run_loc_gen(char **argv, const char *log_path, double *wall_ms, long *peak_rss_kb) {
+    double start = now_seconds();
+    pid_t pid = fork();
+    if(pid < 0) {
+        return -1;
+    }
+    if(pid == 0) {
+        int log = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(log >= 0) {
+            dup2(log, STDOUT_FILENO);
+            dup2(log, STDERR_FILENO);
+            close(log);
+        }
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage usage;
+    if(wait4(pid, &status, 0, &usage) < 0) {
+        return -1;
+    }
+    *wall_ms = (now_seconds() - start) * 1000.0;
+    *peak_rss_kb = usage.ru_maxrss;
+    if(!WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status) == 127 ? -1 : WEXITSTATUS(status);
+}
+
+/* loc_gen is started by a small process forked before the corpus is made. Linux carries a process's peak RSS
+ * over exec, so a loc_gen forked straight from the bench would report the bench's memory as its own.
+ * A request is its size (uint32_t) then the log path and the arguments, each null-terminated. */
+#define SPAWN_REQUEST_MAX 16384
+
+typedef struct {
+    int requests;
+    int replies;
+    pid_t pid;
+} spawner;
+
+typedef struct {
+    int status;
+    double wall_ms;
+    long peak_rss_kb;
+} spawn_reply;
+
+static int read_all(int fd, void *data, size_t size) {
+    size_t done = 0;
+    while(done < size) {
+        ssize_t n = read(fd, (char *)data + done, size - done);
+        if(n <= 0) {
+            if(n < 0 && errno == EINTR) continue;
+            return 0;
+        }
+        done += (size_t)n;
+    }
+    return 1;
+}
+
+static int write_all(int fd, const void *data, size_t size) {
+    size_t done = 0;
+    while(done < size) {
+        ssize_t n = write(fd, (const char *)data + done, size - done);
+        if(n <= 0) {
+            if(n < 0 && errno == EINTR) continue;
+            return 0;
+        }
+        done += (size_t)n;
+    }
+    return 1;
+}
+
+static void spawner_loop(int requests, int replies) {
+    static char request[SPAWN_REQUEST_MAX];
+    char *argv[BENCH_MAX_GEN_ARGS + BENCH_MAX_LANGUAGES + 8];
+    uint32_t size;
+    while(read_all(requests, &size, sizeof(size)) && size <= sizeof(request) && read_all(requests, request, size)) {
+        const char *log_path = request;
+        int argc = 0;
+        for(size_t pos = strlen(request) + 1; pos < size && argc < (int)(sizeof(argv) / sizeof(argv[0])) - 1; pos += strlen(request + pos) + 1) {
+            argv[argc++] = request + pos;
+        }
+        argv[argc] = NULL;
+
+        spawn_reply reply;
+        reply.status = run_loc_gen(argv, log_path, &reply.wall_ms, &reply.peak_rss_kb);
+        if(!write_all(replies, &reply, sizeof(reply))) break;
+    }
+    _exit(0);
+}
+
+static int spawner_start(spawner *sp) {
+    int requests[2];
+    int replies[2];
+    if(pipe(requests) != 0 || pipe(replies) != 0) {
+        return 0;
+    }
+    sp->pid = fork();
+    if(sp->pid < 0) {
+        return 0;
+    }
+    if(sp->pid == 0) {
+        close(requests[1]);
+        close(replies[0]);
+        spawner_loop(requests[0], replies[1]);
+    }
+    close(requests[0]);
+    close(replies[1]);
+    sp->requests = requests[1];
+    sp->replies = replies[0];
+    return 1;
+}
+
+static int spawner_run(spawner *sp, char **argv, const char *log_path, double *wall_ms, long *peak_rss_kb) {
+    static char request[SPAWN_REQUEST_MAX];
+    size_t size = 0;
+    size_t len = strlen(log_path) + 1;
+    memcpy(request, log_path, len);
+    size += len;
+    for(int i = 0; argv[i]; i++) {
+        len = strlen(argv[i]) + 1;
+        if(size + len > sizeof(request)) return -1;
+        memcpy(request + size, argv[i], len);
+        size += len;
+    }
+
+    uint32_t request_size = (uint32_t)size;
+    spawn_reply reply;
+    if(!write_all(sp->requests, &request_size, sizeof(request_size)) || !write_all(sp->requests, request, size) ||
+       !read_all(sp->replies, &reply, sizeof(reply))) {
+        return -1;
+    }
+    *wall_ms = reply.wall_ms;
+    *peak_rss_kb = reply.peak_rss_kb;
+    return reply.status;
+}
+
+static void spawner_stop(spawner *sp) {
+    close(sp->requests);
+    close(sp->replies);
+    waitpid(sp->pid, NULL, 0);
+}
+
+/* The language the lookups run on, from whichever files loc_gen made: a bundle, shared keys plus a
+ * value file, or a plain file */
+typedef struct {
+    loc_bundle bundle;
+    loc_file keys;
+    loc_file values;
+    loc_file file;
+} bench_table;
+
+static int table_open(bench_table *table, const char *dir, const char *lang, int mapped) {
+    char path[1024];
+    char keys_path[1024];
+    memset(table, 0, sizeof(*table));
+    uint32_t flags = mapped ? LOC_LOAD_MMAP : 0;
+
+    snprintf(path, sizeof(path), "%s/corpus.bundle.loc", dir);
+    if(access(path, R_OK) == 0) {
+        table->bundle = loc_bundle_open_flags(path, flags);
+        table->file = loc_bundle_get_language(&table->bundle, lang);
+        return table->file.strings != NULL;
+    }
+
+    snprintf(path, sizeof(path), "%s/corpus.%s.loc", dir, lang);
+    snprintf(keys_path, sizeof(keys_path), "%s/corpus.keys.loc", dir);
+    if(access(keys_path, R_OK) == 0) {
+        table->keys = loc_load_flags(keys_path, flags);
+        table->values = loc_load_flags(path, flags);
+        table->file = loc_attach(&table->keys, &table->values);
+        return table->file.strings != NULL;
+    }
+
+    table->values = loc_load_flags(path, flags);
+    table->file = table->values;
+    return table->file.strings != NULL;
+}
+
+static void table_close(bench_table *table) {
+    if(table->bundle.file_buffer) {
+        loc_bundle_close(&table->bundle);
+    } else {
+        // An attached view borrows the keys and values, a plain file is the values
+        loc_free(&table->keys);
+        loc_free(&table->values);
+    }
+    memset(table, 0, sizeof(*table));
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, size_t count, double p) {
+    if(count == 0) return 0.0;
+    size_t index = (size_t)(p * (double)(count - 1) + 0.5);
+    return sorted[index];
+}
+
+/* What reading the clock twice costs, taken off every timed lookup */
+static double clock_overhead_ns(void) {
+    double samples[1001];
+    for(size_t i = 0; i < 1001; i++) {
+        uint64_t start = now_ns();
+        samples[i] = (double)(now_ns() - start);
+    }
+    qsort(samples, 1001, sizeof(double), compare_doubles);
+    return samples[500];
+}
+
+typedef enum {
+    MODE_SINGLE,
+    MODE_BATCH,
+} lookup_mode;
+
+typedef struct {
+    loc_file *loc;
+    char **keys;
+    size_t key_count;
+    size_t start;
+    size_t ops;
+    size_t samples;
+    size_t batch;
+    lookup_mode mode;
+    double clock_overhead;
+    pthread_barrier_t *barrier;
+    double *latencies;  // samples of them, ns per call
+    size_t found;       // keys the lookups found, for the hit workloads that's all of them
+    double seconds;
+} lookup_job;
+
+static size_t run_lookups(lookup_job *job, size_t ops, double *latencies) {
+    size_t found = 0;
+    size_t pos = job->start % job->key_count;
+    const char *out[1024];
+
+    if(job->mode == MODE_SINGLE) {
+        for(size_t i = 0; i < ops; i++) {
+            uint64_t start = latencies ? now_ns() : 0;
+            const char *localized = loc_get_string(job->loc, job->keys[pos]);
+            if(latencies) {
+                latencies[i] = (double)(now_ns() - start) - job->clock_overhead;
+            }
+            found += localized != NULL;
+            if(++pos == job->key_count) pos = 0;
+        }
+        return found;
+    }
+
+    // loc_get_strings wants the keys in one array, batches start over at the front instead of wrapping
+    size_t calls = ops / job->batch;
+    for(size_t i = 0; i < calls; i++) {
+        if(pos + job->batch > job->key_count) pos = 0;
+        uint64_t start = latencies ? now_ns() : 0;
+        loc_get_strings(job->loc, (const char *const *)job->keys + pos, job->batch, out);
+        if(latencies) {
+            latencies[i] = (double)(now_ns() - start) - job->clock_overhead;
+        }
+        for(size_t j = 0; j < job->batch; j++) {
+            found += out[j] != NULL;
+        }
+        pos += job->batch;
+    }
+    return found;
+}
+
+static void *lookup_thread(void *arg) {
+    lookup_job *job = (lookup_job *)arg;
+    if(job->barrier) {
+        pthread_barrier_wait(job->barrier);
+    }
+    double start = now_seconds();
+    job->found = run_lookups(job, job->ops, NULL);
+    job->seconds = now_seconds() - start;
+
+    size_t calls = job->mode == MODE_BATCH ? job->samples / job->batch : job->samples;
+    run_lookups(job, calls * (job->mode == MODE_BATCH ? job->batch : 1), job->latencies);
+    return NULL;
+}
+
+typedef struct {
+    const char *name;
+    int threads;
+    size_t ops;
+    size_t found;
+    double ops_per_second;
+    const char *latency_unit;
+    double p50, p90, p99, p999, max;
+    double probes_per_lookup;
+    double compare_bytes_per_lookup;
+} workload_result;
+
+/* Runs a workload on threads threads, each over the whole key list from its own starting point */
+static workload_result run_workload(const char *name, loc_file *shared, bench_table *own_tables, char **keys, size_t key_count,
+                                    int threads, lookup_mode mode, const bench_config *config, double clock_overhead) {
+    workload_result result;
+    memset(&result, 0, sizeof(result));
+    result.name = name;
+    result.threads = threads;
+    result.latency_unit = mode == MODE_BATCH ? "ns per call" : "ns per lookup";
+
+    lookup_job jobs[BENCH_MAX_THREADS];
+    pthread_t handles[BENCH_MAX_THREADS];
+    pthread_barrier_t barrier;
+    size_t batch = config->batch < key_count ? config->batch : key_count;
+    size_t calls_per_thread = mode == MODE_BATCH ? config->samples / batch : config->samples;
+    double *latencies = (double *)xmalloc((size_t)threads * calls_per_thread * sizeof(double));
+
+#if defined(LOC_STATS)
+    loc_stats before = loc_stats_snapshot();
+#endif
+
+    pthread_barrier_init(&barrier, NULL, (unsigned)threads + 1);
+    for(int i = 0; i < threads; i++) {
+        lookup_job *job = &jobs[i];
+        memset(job, 0, sizeof(*job));
+        job->loc = own_tables ? &own_tables[i].file : shared;
+        job->keys = keys;
+        job->key_count = key_count;
+        job->start = key_count / (size_t)threads * (size_t)i;
+        job->ops = config->lookups;
+        job->samples = config->samples;
+        job->batch = batch;
+        job->mode = mode;
+        job->clock_overhead = clock_overhead;
+        job->barrier = &barrier;
+        job->latencies = latencies + (size_t)i * calls_per_thread;
+        if(pthread_create(&handles[i], NULL, lookup_thread, job) != 0) {
+            printf("Error: couldn't start thread %d\n", i);
+            exit(1);
+        }
+    }
+
+    // Throughput is every thread's lookups over the time the slowest one took
+    pthread_barrier_wait(&barrier);
+    double slowest = 0.0;
+    for(int i = 0; i < threads; i++) {
+        pthread_join(handles[i], NULL);
+        slowest = jobs[i].seconds > slowest ? jobs[i].seconds : slowest;
+        result.found += jobs[i].found;
+    }
+    pthread_barrier_destroy(&barrier);
+
+    result.ops = config->lookups * (size_t)threads;
+    if(mode == MODE_BATCH) {
+        result.ops = config->lookups / batch * batch * (size_t)threads;
+    }
+    result.ops_per_second = slowest > 0.0 ? (double)result.ops / slowest : 0.0;
+
+    size_t latency_count = (size_t)threads * calls_per_thread;
+    qsort(latencies, latency_count, sizeof(double), compare_doubles);
+    result.p50 = percentile(latencies, latency_count, 0.50);
+    result.p90 = percentile(latencies, latency_count, 0.90);
+    result.p99 = percentile(latencies, latency_count, 0.99);
+    result.p999 = percentile(latencies, latency_count, 0.999);
+    result.max = latency_count ? latencies[latency_count - 1] : 0.0;
+    free(latencies);
+
+#if defined(LOC_STATS)
+    loc_stats after = loc_stats_snapshot();
+    uint64_t lookups = after.lookups - before.lookups;
+    if(lookups) {
+        result.probes_per_lookup = (double)(after.probes - before.probes) / (double)lookups;
+        result.compare_bytes_per_lookup = (double)(after.compare_bytes - before.compare_bytes) / (double)lookups;
+    }
+#endif
+    return result;
+}
+
+typedef struct {
+    const char *name;
+    int gen_status;
+    double gen_wall_ms;
+    long gen_peak_rss_kb;
+    long long file_size;
+    double load_ms;
+    double load_mapped_ms;
+    workload_result workloads[8];
+    int workload_count;
+} variant_result;
+
+static double median_load_ms(const char *dir, const char *lang, int mapped, int runs) {
+    double times[256];
+    if(runs > 256) runs = 256;
+    for(int i = 0; i < runs; i++) {
+        bench_table table;
+        double start = now_seconds();
+        int ok = table_open(&table, dir, lang, mapped);
+        times[i] = (now_seconds() - start) * 1000.0;
+        table_close(&table);
+        if(!ok) return -1.0;
+    }
+    qsort(times, (size_t)runs, sizeof(double), compare_doubles);
+    return times[runs / 2];
+}
+
+static long long file_size_of(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long long)st.st_size : -1;
+}
+
+static void print_workload(const workload_result *w) {
+    printf("  %-8s %2d thread%s %8.2f M lookups/s   p50 %7.0f  p90 %7.0f  p99 %7.0f  p99.9 %7.0f  max %9.0f %s",
+           w->name, w->threads, w->threads == 1 ? " " : "s", w->ops_per_second / 1e6,
+           w->p50, w->p90, w->p99, w->p999, w->max, w->latency_unit);
+#if defined(LOC_STATS)
+    printf("   %.2f probes, %.1f bytes compared", w->probes_per_lookup, w->compare_bytes_per_lookup);
+#endif
+    printf("\n");
+}
+
+static void run_variant(spawner *sp, const variant *v, const bench_config *config, const corpus *c, const char *dir,
+                        double clock_overhead, variant_result *result) {
+    memset(result, 0, sizeof(*result));
+    result->name = v->name;
+
+    // loc_gen --force [index flag] [--gen-args] corpus.txt languages...
+    char *argv[BENCH_MAX_GEN_ARGS + BENCH_MAX_LANGUAGES + 8];
+    int argc = 0;
+    char input_path[1024];
+    char log_path[1024];
+    char gen_args[1024];
+    snprintf(input_path, sizeof(input_path), "%s/corpus.txt", dir);
+    snprintf(log_path, sizeof(log_path), "%s/loc_gen.%s.log", dir, v->name);
+    argv[argc++] = (char *)config->loc_gen;
+    argv[argc++] = (char *)"--force";
+    if(v->gen_flag) argv[argc++] = (char *)v->gen_flag;
+    snprintf(gen_args, sizeof(gen_args), "%s", config->gen_args ? config->gen_args : "");
+    for(char *arg = strtok(gen_args, " "); arg && argc < BENCH_MAX_GEN_ARGS; arg = strtok(NULL, " ")) {
+        argv[argc++] = arg;
+    }
+    argv[argc++] = input_path;
+    for(int i = 0; i < c->language_count; i++) {
+        argv[argc++] = (char *)language_codes[i];
+    }
+    argv[argc] = NULL;
+
+    result->gen_status = spawner_run(sp, argv, log_path, &result->gen_wall_ms, &result->gen_peak_rss_kb);
+    if(result->gen_status != 0) {
+        printf("%s: loc_gen failed (%s), see %s\n", v->name, result->gen_status < 0 ? "couldn't run it" : "exit status", log_path);
+        return;
+    }
+
+    // Lookups go to the first translation, or the keys' own language if there's only one
+    const char *lang = language_codes[c->language_count > 1 ? 1 : 0];
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/corpus.bundle.loc", dir);
+    if(access(path, R_OK) != 0) {
+        snprintf(path, sizeof(path), "%s/corpus.%s.loc", dir, lang);
+    }
+    result->file_size = file_size_of(path);
+    result->load_ms = median_load_ms(dir, lang, 0, config->load_runs);
+    result->load_mapped_ms = median_load_ms(dir, lang, 1, config->load_runs);
+
+    bench_table table;
+    if(!table_open(&table, dir, lang, 0)) {
+        printf("%s: couldn't load %s\n", v->name, path);
+        table_close(&table);
+        return;
+    }
+
+    // A compressed file's block cache can't be shared, so every thread gets its own copy of the file
+    bench_table *own_tables = NULL;
+    if(table.file.flags & LOC_FLAG_COMPRESSED) {
+        own_tables = (bench_table *)xmalloc((size_t)config->threads * sizeof(bench_table));
+        for(int i = 0; i < config->threads; i++) {
+            table_open(&own_tables[i], dir, lang, 1);
+        }
+    }
+
+    printf("%s: loc_gen %.1f ms, peak RSS %.1f MB, %s %.1f MB\n", v->name, result->gen_wall_ms,
+           (double)result->gen_peak_rss_kb / 1024.0, path, (double)result->file_size / (1024.0 * 1024.0));
+    printf("  load     %.3f ms, mapped %.3f ms\n", result->load_ms, result->load_mapped_ms);
+
+    workload_result *w = result->workloads;
+    w[result->workload_count++] = run_workload("hit", &table.file, NULL, c->hit_keys, c->hit_count, 1, MODE_SINGLE, config, clock_overhead);
+    w[result->workload_count++] = run_workload("miss", &table.file, NULL, c->miss_keys, c->miss_count, 1, MODE_SINGLE, config, clock_overhead);
+    w[result->workload_count++] = run_workload("batch", &table.file, NULL, c->hit_keys, c->hit_count, 1, MODE_BATCH, config, clock_overhead);
+    if(config->threads > 1) {
+        w[result->workload_count++] = run_workload("hit_mt", &table.file, own_tables, c->hit_keys, c->hit_count, config->threads,
+                                                   MODE_SINGLE, config, clock_overhead);
+    }
+    if(c->collide_count) {
+        w[result->workload_count++] = run_workload("collide", &table.file, NULL, c->collide_keys, c->collide_count, 1, MODE_SINGLE,
+                                                   config, clock_overhead);
+    }
+    for(int i = 0; i < result->workload_count; i++) {
+        print_workload(&w[i]);
+        size_t expected = strcmp(w[i].name, "miss") == 0 ? 0 : w[i].ops;
+        if(w[i].found != expected) {
+            printf("  Warning: %s found %zu of %zu keys\n", w[i].name, w[i].found, w[i].ops);
+        }
+    }
+
+    if(own_tables) {
+        for(int i = 0; i < config->threads; i++) {
+            table_close(&own_tables[i]);
+        }
+        free(own_tables);
+    }
+    table_close(&table);
+}
+
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for(; *s; s++) {
+        if(*s == '"' || *s == '\\') {
+            fputc('\\', f);
+            fputc(*s, f);
+        } else if((unsigned char)*s < 0x20) {
+            fprintf(f, "\\u%04x", (unsigned char)*s);
+        } else {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
+/* The CPU's name from /proc/cpuinfo, "unknown" elsewhere */
+static void cpu_model(char *out, size_t size) {
+    snprintf(out, size, "unknown");
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if(!f) return;
+    char line[512];
+    while(fgets(line, sizeof(line), f)) {
+        char *colon = strchr(line, ':');
+        if(colon && strncmp(line, "model name", 10) == 0) {
+            colon++;
+            while(*colon == ' ') colon++;
+            colon[strcspn(colon, "\n")] = '\0';
+            snprintf(out, size, "%s", colon);
+            break;
+        }
+    }
+    fclose(f);
+}
+
+static int write_results(const char *path, const bench_config *config, const corpus *c, double corpus_ms,
+                         const variant_result *results, int result_count, double clock_overhead) {
+    FILE *f = fopen(path, "w");
+    if(!f) {
+        return 0;
+    }
+
+    struct utsname name;
+    char cpu[256];
+    char date[64];
+    time_t now = time(NULL);
+    uname(&name);
+    cpu_model(cpu, sizeof(cpu));
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(f, "{\n  \"format\": 1,\n  \"date\": \"%s\",\n", date);
+    fprintf(f, "  \"machine\": {\"system\": ");
+    json_string(f, name.sysname);
+    fprintf(f, ", \"release\": ");
+    json_string(f, name.release);
+    fprintf(f, ", \"arch\": ");
+    json_string(f, name.machine);
+    fprintf(f, ", \"cpu\": ");
+    json_string(f, cpu);
+    fprintf(f, ", \"cpus\": %ld, \"clock_overhead_ns\": %.1f},\n", sysconf(_SC_NPROCESSORS_ONLN), clock_overhead);
+
+    fprintf(f, "  \"config\": {\"rows\": %zu, \"languages\": %d, \"key_length\": ", config->rows, config->languages);
+    if(config->key_dist == 'u') {
+        fprintf(f, "{\"distribution\": \"uniform\", \"min\": %g, \"max\": %g}", config->key_min, config->key_max);
+    } else {
+        fprintf(f, "{\"distribution\": \"%s\", \"mean\": %g}", config->key_dist == 'e' ? "exp" : "fixed", config->key_mean);
+    }
+    fprintf(f, ", \"scripts\": {");
+    for(size_t i = 0; i < SCRIPT_COUNT; i++) {
+        fprintf(f, "%s\"%s\": %g", i ? ", " : "", scripts[i].name, scripts[i].weight);
+    }
+    fprintf(f, "}, \"collide\": %zu, \"miss_keys\": %zu, \"seed\": %llu, \"threads\": %d, \"lookups\": %zu, \"samples\": %zu, "
+               "\"batch\": %zu, \"load_runs\": %d, \"gen_args\": ",
+            config->collide, config->miss_keys, (unsigned long long)config->seed, config->threads, config->lookups,
+            config->samples, config->batch, config->load_runs);
+    json_string(f, config->gen_args ? config->gen_args : "");
+#if defined(LOC_STATS)
+    fprintf(f, ", \"loc_stats\": true");
+#else
+    fprintf(f, ", \"loc_stats\": false");
+#endif
+    fprintf(f, "},\n");
+
+    fprintf(f, "  \"corpus\": {\"rows\": %zu, \"input_bytes\": %zu, \"generate_ms\": %.1f},\n", c->row_count, c->input_size, corpus_ms);
+    fprintf(f, "  \"bench_peak_rss_kb\": %ld,\n", usage.ru_maxrss);
+
+    fprintf(f, "  \"variants\": [\n");
+    for(int i = 0; i < result_count; i++) {
+        const variant_result *r = &results[i];
+        fprintf(f, "    {\"name\": ");
+        json_string(f, r->name);
+        fprintf(f, ", \"gen_status\": %d, \"gen_wall_ms\": %.1f, \"gen_peak_rss_kb\": %ld, \"file_bytes\": %lld, "
+                   "\"load_ms\": %.4f, \"load_mapped_ms\": %.4f,\n     \"workloads\": [",
+                r->gen_status, r->gen_wall_ms, r->gen_peak_rss_kb, r->file_size, r->load_ms, r->load_mapped_ms);
+        for(int j = 0; j < r->workload_count; j++) {
+            const workload_result *w = &r->workloads[j];
+            fprintf(f, "%s\n       {\"name\": \"%s\", \"threads\": %d, \"lookups\": %zu, \"found\": %zu, \"lookups_per_second\": %.0f, "
+                       "\"latency_unit\": \"%s\", \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f",
+                    j ? "," : "", w->name, w->threads, w->ops, w->found, w->ops_per_second, w->latency_unit,
+                    w->p50, w->p90, w->p99, w->p999, w->max);
+#if defined(LOC_STATS)
+            fprintf(f, ", \"probes_per_lookup\": %.3f, \"compare_bytes_per_lookup\": %.2f", w->probes_per_lookup, w->compare_bytes_per_lookup);
+#endif
+            fprintf(f, "}");
+        }
+        fprintf(f, "]}%s\n", i + 1 < result_count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+/* Everything the bench made in dir, and dir itself if the bench made it */
+static void remove_outputs(const char *dir, const corpus *c, const variant_result *results, int result_count, int made_dir) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/corpus.txt", dir);
+    remove(path);
+    snprintf(path, sizeof(path), "%s/corpus.manifest", dir);
+    remove(path);
+    snprintf(path, sizeof(path), "%s/corpus.keys.loc", dir);
+    remove(path);
+    snprintf(path, sizeof(path), "%s/corpus.bundle.loc", dir);
+    remove(path);
+    for(int i = 0; i < c->language_count; i++) {
+        snprintf(path, sizeof(path), "%s/corpus.%s.loc", dir, language_codes[i]);
+        remove(path);
+    }
+    for(int i = 0; i < result_count; i++) {
+        snprintf(path, sizeof(path), "%s/loc_gen.%s.log", dir, results[i].name);
+        remove(path);
+    }
+    if(made_dir) {
+        rmdir(dir);
+    }
+}
+
+/* Returns the value of an option given as --name=value or --name value, NULL if argv[*i] isn't that option */
+static const char *option_value(int argc, char **argv, int *i, const char *name) {
+    const char *arg = argv[*i];
+    while(*name && *arg == *name) {
+        arg++;
+        name++;
+    }
+    if(*name) return NULL;
+
+    if(*arg == '=') return arg + 1;
+    if(*arg == '\0' && *i + 1 < argc) return argv[++(*i)];
+    return NULL;
+}
+
+/* uniform:MIN:MAX, exp:MEAN or fixed:N */
+static int parse_key_length(const char *value, bench_config *config) {
+    if(sscanf(value, "uniform:%lf:%lf", &config->key_min, &config->key_max) == 2) {
+        config->key_dist = 'u';
+        return config->key_min >= 1.0 && config->key_max >= config->key_min && config->key_max <= 1024.0;
+    }
+    if(sscanf(value, "exp:%lf", &config->key_mean) == 1) {
+        config->key_dist = 'e';
+        return config->key_mean >= 1.0 && config->key_mean <= 1024.0;
+    }
+    if(sscanf(value, "fixed:%lf", &config->key_mean) == 1) {
+        config->key_dist = 'f';
+        return config->key_mean >= 1.0 && config->key_mean <= 1024.0;
+    }
+    return 0;
+}
+
+/* name:weight,name:weight... scripts that aren't listed get weight 0 */
+static int parse_scripts(const char *value) {
+    char list[512];
+    snprintf(list, sizeof(list), "%s", value);
+    for(size_t i = 0; i < SCRIPT_COUNT; i++) {
+        scripts[i].weight = 0.0;
+    }
+
+    double total = 0.0;
+    for(char *item = strtok(list, ","); item; item = strtok(NULL, ",")) {
+        char *colon = strchr(item, ':');
+        double weight = colon ? strtod(colon + 1, NULL) : 1.0;
+        if(colon) *colon = '\0';
+        size_t i = 0;
+        while(i < SCRIPT_COUNT && strcmp(scripts[i].name, item) != 0) i++;
+        if(i == SCRIPT_COUNT || weight < 0.0) {
+            printf("Error: unknown script \"%s\"\n", item);
+            return 0;
+        }
+        scripts[i].weight = weight;
+        total += weight;
+    }
+    return total > 0.0;
+}
+
+static void print_usage(void) {
+    printf("Usage: loc_bench [options]\n");
+    printf("Builds a synthetic corpus with loc_gen for every variant and times loading and looking up strings.\n");
+    printf("Options:\n");
+    printf("  --loc-gen=PATH       the generator to run (default ./loc_gen)\n");
+    printf("  --rows=N             keys in the corpus (default 100000)\n");
+    printf("  --languages=N        languages, the first one is the keys themselves (default 3, at most 32)\n");
+    printf("  --key-length=DIST    key lengths in bytes: uniform:MIN:MAX, exp:MEAN or fixed:N (default exp:24)\n");
+    printf("  --scripts=LIST       scripts of the translations with weights, like latin:80,cjk:20. Scripts are\n");
+    printf("                       latin, accented, greek, cyrillic, arabic, devanagari, cjk and emoji (default all of them)\n");
+    printf("  --collide=N          add N keys that all land in one bucket of the chained index (default 0)\n");
+    printf("  --miss-keys=N        distinct keys the miss workload looks up (default 100000)\n");
+    printf("  --seed=N             seed of the corpus (default 1)\n");
+    printf("  --variants=LIST      indexes to build: chained, mph, flat, compress, dedup (default chained,mph,flat)\n");
+    printf("  --gen-args=ARGS      more loc_gen options for every variant, like \"-j 4\" or \"--shared-keys\"\n");
+    printf("  --threads=N          threads of the hit_mt workload (default the CPU count, at most 8)\n");
+    printf("  --lookups=N          lookups per thread timed for throughput (default 2000000)\n");
+    printf("  --samples=N          lookups per thread timed one at a time for latency (default 200000)\n");
+    printf("  --batch=N            keys per loc_get_strings call (default 64, at most 1024)\n");
+    printf("  --load-runs=N        loads timed per variant, the median is reported (default 10)\n");
+    printf("  --dir=DIR            where the corpus and files go (default a new directory in /tmp)\n");
+    printf("  --out=FILE           JSON results (default loc_bench.json)\n");
+    printf("  --keep               leave the corpus, the files and loc_gen's output in the directory\n");
+}
+
+int main(int argc, char **argv) {
+    bench_config config;
+    memset(&config, 0, sizeof(config));
+    config.rows = 100000;
+    config.languages = 3;
+    config.key_dist = 'e';
+    config.key_mean = 24.0;
+    config.miss_keys = 100000;
+    config.seed = 1;
+    config.lookups = 2000000;
+    config.samples = 200000;
+    config.batch = 64;
+    config.load_runs = 10;
+    config.loc_gen = "./loc_gen";
+    config.out = "loc_bench.json";
+    config.variants = "chained,mph,flat";
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    config.threads = cpus < 1 ? 1 : cpus > 8 ? 8 : (int)cpus;
+
+    const char *value;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--keep") == 0) {
+            config.keep = 1;
+        } else if(strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage();
+            return 0;
+        } else if((value = option_value(argc, argv, &i, "--loc-gen"))) {
+            config.loc_gen = value;
+        } else if((value = option_value(argc, argv, &i, "--rows"))) {
+            config.rows = (size_t)strtoull(value, NULL, 10);
+        } else if((value = option_value(argc, argv, &i, "--languages"))) {
+            config.languages = atoi(value);
+        } else if((value = option_value(argc, argv, &i, "--key-length"))) {
+            if(!parse_key_length(value, &config)) {
+                printf("Error: --key-length is uniform:MIN:MAX, exp:MEAN or fixed:N, lengths between 1 and 1024\n");
+                return 1;
+            }
+        } else if((value = option_value(argc, argv, &i, "--scripts"))) {
+            if(!parse_scripts(value)) {
+                printf("Error: --scripts needs at least one script with a weight above 0\n");
+                return 1;
+            }
+        } else if((value = option_value(argc, argv, &i, "--collide"))) {
+            config.collide = (size_t)strtoull(value, NULL, 10);
+        } else if((value = option_value(argc, argv, &i, "--miss-keys"))) {
+            config.miss_keys = (size_t)strtoull(value, NULL, 10);
+        } else if((value = option_value(argc, argv, &i, "--seed"))) {
+            config.seed = strtoull(value, NULL, 10);
+        } else if((value = option_value(argc, argv, &i, "--variants"))) {
+            config.variants = value;
+        } else if((value = option_value(argc, argv, &i, "--gen-args"))) {
+            config.gen_args = value;
+        } else if((value = option_value(argc, argv, &i, "--threads"))) {
+            config.threads = atoi(value);
+        } else if((value = option_value(argc, argv, &i, "--lookups"))) {
+            config.lookups = (size_t)strtoull(value, NULL, 10);
+        } else if((value = option_value(argc, argv, &i, "--samples"))) {
+            config.samples = (size_t)strtoull(value, NULL, 10);
+        } else if((value = option_value(argc, argv, &i, "--batch"))) {
+            config.batch = (size_t)strtoull(value, NULL, 10);
+        } else if((value = option_value(argc, argv, &i, "--load-runs"))) {
+            config.load_runs = atoi(value);
+        } else if((value = option_value(argc, argv, &i, "--dir"))) {
+            config.dir = value;
+        } else if((value = option_value(argc, argv, &i, "--out"))) {
+            config.out = value;
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            print_usage();
+            return 1;
+        }
+    }
+
+    if(config.rows == 0 || config.miss_keys == 0 || config.languages < 1 || config.languages > BENCH_MAX_LANGUAGES ||
+       config.threads < 1 || config.threads > BENCH_MAX_THREADS || config.batch < 1 || config.batch > 1024 ||
+       config.lookups < config.batch || config.samples < config.batch || config.load_runs < 1 || config.load_runs > 256) {
+        printf("Error: options out of range, see --help\n");
+        return 1;
+    }
+
+    variant variants[KNOWN_VARIANT_COUNT * 2];
+    int variant_count = 0;
+    char variant_list[256];
+    snprintf(variant_list, sizeof(variant_list), "%s", config.variants);
+    for(char *name = strtok(variant_list, ","); name; name = strtok(NULL, ",")) {
+        size_t i = 0;
+        while(i < KNOWN_VARIANT_COUNT && strcmp(known_variants[i].name, name) != 0) i++;
+        if(i == KNOWN_VARIANT_COUNT || variant_count == (int)(KNOWN_VARIANT_COUNT * 2)) {
+            printf("Error: unknown variant \"%s\"\n", name);
+            return 1;
+        }
+        variants[variant_count++] = known_variants[i];
+    }
+
+    char dir[512];
+    int made_dir = 0;
+    if(config.dir) {
+        snprintf(dir, sizeof(dir), "%s", config.dir);
+        if(mkdir(dir, 0755) == 0) made_dir = 1;
+    } else {
+        snprintf(dir, sizeof(dir), "/tmp/loc_bench.XXXXXX");
+        if(!mkdtemp(dir)) {
+            printf("Error: couldn't make a directory in /tmp: %s\n", strerror(errno));
+            return 1;
+        }
+        made_dir = 1;
+    }
+
+    spawner sp;
+    if(!spawner_start(&sp)) {
+        printf("Error: couldn't start the process that runs loc_gen: %s\n", strerror(errno));
+        return 1;
+    }
+
+    corpus c;
+    double start = now_seconds();
+    make_corpus(&config, &c);
+    char input_path[1024];
+    snprintf(input_path, sizeof(input_path), "%s/corpus.txt", dir);
+    if(!write_corpus(&c, input_path, &c.input_size)) {
+        printf("Error: couldn't write %s\n", input_path);
+        return 1;
+    }
+    double corpus_ms = (now_seconds() - start) * 1000.0;
+    printf("Corpus: %zu rows, %d language%s, %.1f MB in %s (%.0f ms)\n", c.row_count, c.language_count, c.language_count == 1 ? "" : "s",
+           (double)c.input_size / (1024.0 * 1024.0), input_path, corpus_ms);
+
+    double clock_overhead = clock_overhead_ns();
+    variant_result results[KNOWN_VARIANT_COUNT * 2];
+    for(int i = 0; i < variant_count; i++) {
+        run_variant(&sp, &variants[i], &config, &c, dir, clock_overhead, &results[i]);
+    }
+
+    spawner_stop(&sp);
+
+    int written = write_results(config.out, &config, &c, corpus_ms, results, variant_count, clock_overhead);
+    if(written) {
+        printf("Results written to %s\n", config.out);
+    } else {
+        printf("Error: couldn't write %s\n", config.out);
+    }
+
+    int failed = !written;
+    for(int i = 0; i < variant_count; i++) {
+        failed |= results[i].gen_status != 0;
+    }
+
+    // loc_gen's output is worth a look when it failed
+    if(!config.keep && failed) {
+        printf("Kept %s\n", dir);
+    } else if(!config.keep) {
+        remove_outputs(dir, &c, results, variant_count, made_dir);
+    }
+    return failed;
+}
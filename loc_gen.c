@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <limits.h>
+#include <stdarg.h>
 
 #if defined(_WIN32) || defined(_WIN64)
     #include <windows.h>
@@ -9,12 +10,13 @@
     #include <sys/stat.h>
     #include <unistd.h>
     #include <fcntl.h>
+    #include <pthread.h>
 #endif
 
 #define LOC_ARENA_PUSH_STRUCT(arena, T) (T*)loc_arena_push(arena, sizeof(T), 0)
-#define LOC_ARENA_PUSH_ARRAY(arena, T, n) (T*)loc_arena_push(arena, sizeof(T) * n, 0)
+#define LOC_ARENA_PUSH_ARRAY(arena, T, n) (T*)loc_arena_push(arena, sizeof(T) * (n), 0)
 #define LOC_ARENA_PUSH_STRUCT_ZERO(arena, T) (T*)loc_arena_push(arena, sizeof(T), 1)
-#define LOC_ARENA_PUSH_ARRAY_ZERO(arena, T, n) (T*)loc_arena_push(arena, sizeof(T) * n, 1)
+#define LOC_ARENA_PUSH_ARRAY_ZERO(arena, T, n) (T*)loc_arena_push(arena, sizeof(T) * (n), 1)
 
 typedef struct {
     size_t pos;
@@ -34,6 +36,18 @@ static loc_mem_arena *loc_arena_init(size_t size);
 static void *loc_arena_push(loc_mem_arena *arena, size_t size, loc_arena_bool zero_out_the_memory);
 static void loc_arena_destroy(loc_mem_arena *arena);
 
+/* Everything pushed after begin is released by end */
+static loc_arena_temp loc_arena_temp_begin(loc_mem_arena *arena) {
+    loc_arena_temp temp;
+    temp.arena = arena;
+    temp.start_pos = arena->pos;
+    return temp;
+}
+
+static void loc_arena_temp_end(loc_arena_temp temp) {
+    temp.arena->pos = temp.start_pos;
+}
+
 #ifndef LOC_ARENA_ALIGNMENT
 #define LOC_ARENA_ALIGNMENT 16
 #endif
@@ -98,8 +112,8 @@ void* loc_arena_push(loc_mem_arena* arena, size_t size, loc_arena_bool zero_out_
     size_t required = arena->pos + total_size;
 
     if (required > arena->reserved_size) {
-        fprintf(stderr, "ERROR: Allocation exceeds arena reserved_size!\n");
-        return NULL;
+        fprintf(stderr, "ERROR: Allocation exceeds arena reserved_size! (out of memory, or --mem-limit is too low)\n");
+        exit(EXIT_FAILURE);
     }
 
     if (required > arena->committed_size) {
@@ -143,7 +157,7 @@ loc_mem_arena *loc_arena_init(size_t size) {
     size = ALIGN_UP(size, page_size);
 
     loc_mem_arena *arena = (loc_mem_arena*)mmap(NULL, size, PROT_READ | PROT_WRITE,
-                                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
     if (arena == MAP_FAILED) {
         perror("mmap failed");
         exit(EXIT_FAILURE);
@@ -165,8 +179,8 @@ void* loc_arena_push(loc_mem_arena* arena, size_t size, loc_arena_bool zero_out_
     size_t required = arena->pos + total_size;
 
     if (required > arena->reserved_size) {
-        fprintf(stderr, "ERROR: Allocation exceeds arena reserved_size!\n");
-        return NULL;
+        fprintf(stderr, "ERROR: Allocation exceeds arena reserved_size! (out of memory, or --mem-limit is too low)\n");
+        exit(EXIT_FAILURE);
     }
 
     arena->pos += total_size;
@@ -202,6 +216,15 @@ static void *loc_memcpy(void *dest, const void *src, size_t n) {
     return dest;
 }
 
+static int loc_memcmp(const void *a, const void *b, size_t n) {
+    const unsigned char *x = (const unsigned char *)a;
+    const unsigned char *y = (const unsigned char *)b;
+    for (size_t i = 0; i < n; i++) {
+        if (x[i] != y[i]) return x[i] - y[i];
+    }
+    return 0;
+}
+
 #ifndef _STDINT_H
 /* 8-bit type */
 #if UCHAR_MAX == 0xFF
@@ -325,99 +348,587 @@ static unsigned char *loc_read_entire_file(loc_mem_arena *arena, const char *fil
     return file;
 }
 
-static loc_bool loc_write_entire_file(const char *file_path, size_t file_size, char *buffer) {
+/* Buffered writes and positioned reads, for the output files and the temporary files of --mem-limit.
+ * A file is written front to back and only read once it's done being written. */
+#define STREAM_BUFFER_SIZE (64 * 1024)
+
+#define STREAM_READ 0
+#define STREAM_WRITE 1
+#define STREAM_TEMP 2   // deleted once it's closed, the path is the directory to put it in
+
+typedef struct {
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE handle;
+#else
+    int fd;
+#endif
+    unsigned char *buffer;
+    size_t capacity;
+    size_t buffered;
+    size_t size;        // everything written so far, buffered or not
+    loc_bool failed;
+} stream_file;
+
+static loc_bool stream_open(loc_mem_arena *arena, stream_file *file, const char *path, int mode) {
+    file->buffer = NULL;
+    file->capacity = 0;
+    file->buffered = 0;
+    file->size = 0;
+    file->failed = loc_false;
+
 #if defined(_WIN32) || defined(_WIN64)
-    HANDLE hFile = CreateFileA(file_path, GENERIC_WRITE, 0, NULL,
-                               CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-    if (hFile == INVALID_HANDLE_VALUE) {
+    if(mode == STREAM_TEMP) {
+        char temp_path[MAX_PATH];
+        if(!GetTempFileNameA(path, "loc", 0, temp_path)) {
+            return loc_false;
+        }
+        file->handle = CreateFileA(temp_path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                                   FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    } else if(mode == STREAM_WRITE) {
+        file->handle = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    } else {
+        file->handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    }
+    if(file->handle == INVALID_HANDLE_VALUE) {
+        return loc_false;
+    }
+#else
+    if(mode == STREAM_TEMP) {
+        char temp_path[512];
+        snprintf(temp_path, sizeof(temp_path), "%s/.loc_gen_XXXXXX", path);
+        file->fd = mkstemp(temp_path);
+        if(file->fd != -1) {
+            unlink(temp_path);  // Gone once it's closed, even if we crash
+        }
+    } else if(mode == STREAM_WRITE) {
+        file->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    } else {
+        file->fd = open(path, O_RDONLY);
+    }
+    if(file->fd == -1) {
         return loc_false;
     }
+#endif
+
+    if(mode != STREAM_READ) {
+        file->buffer = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, STREAM_BUFFER_SIZE);
+        file->capacity = STREAM_BUFFER_SIZE;
+    }
+    return loc_true;
+}
 
+static loc_bool stream_flush(stream_file *file) {
     size_t total_written = 0;
-    while (total_written < file_size) {
-        DWORD to_write = (DWORD)((file_size - total_written) > 0xFFFFFFFFUL ? 0xFFFFFFFFUL : (file_size - total_written));
+    while(!file->failed && total_written < file->buffered) {
+#if defined(_WIN32) || defined(_WIN64)
         DWORD bytes_written_chunk = 0;
-        
-        if (!WriteFile(hFile, buffer + total_written, to_write, &bytes_written_chunk, NULL) || bytes_written_chunk == 0) {
-            CloseHandle(hFile);
-            return loc_false;
+        if(!WriteFile(file->handle, file->buffer + total_written, (DWORD)(file->buffered - total_written), &bytes_written_chunk, NULL) ||
+           bytes_written_chunk == 0) {
+            file->failed = loc_true;
+        }
+#else
+        ssize_t bytes_written_chunk = write(file->fd, file->buffer + total_written, file->buffered - total_written);
+        if(bytes_written_chunk <= 0) {
+            file->failed = loc_true;
+        }
+#endif
+        if(!file->failed) {
+            total_written += (size_t)bytes_written_chunk;
         }
-        total_written += bytes_written_chunk;
     }
+    file->buffered = 0;
+    return !file->failed;
+}
 
-    CloseHandle(hFile);
-    return loc_true;
+static void stream_write(stream_file *file, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    file->size += size;
+    while(size > 0) {
+        if(file->buffered == file->capacity && !stream_flush(file)) {
+            return;
+        }
+        size_t chunk = LOC_ARENA_MIN(size, file->capacity - file->buffered);
+        loc_memcpy(file->buffer + file->buffered, bytes, chunk);
+        file->buffered += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+}
+
+/* Zeros up to the next multiple of alignment, counted from start */
+static void stream_pad(stream_file *file, size_t start, size_t alignment) {
+    static const unsigned char zeros[64] = {0};
+    size_t pos = file->size - start;
+    size_t padding = ALIGN_UP(pos, alignment) - pos;
+    while(padding > 0) {
+        size_t chunk = LOC_ARENA_MIN(padding, sizeof(zeros));
+        stream_write(file, zeros, chunk);
+        padding -= chunk;
+    }
+}
+
+/* printf into the file, anything longer than STREAM_BUFFER_SIZE is cut off */
+static void stream_printf(stream_file *file, const char *format, ...) {
+    for(int attempt = 0; attempt < 2; attempt++) {
+        size_t room = file->capacity - file->buffered;
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf((char *)file->buffer + file->buffered, room, format, args);
+        va_end(args);
+        if(written < 0) {
+            return;
+        }
+
+        size_t fits = (size_t)written < room ? (size_t)written : (attempt == 0 ? 0 : room - 1);
+        file->buffered += fits;
+        file->size += fits;
+        if(fits == (size_t)written || attempt == 1 || !stream_flush(file)) {
+            return;
+        }
+    }
+}
+
+/* Done writing: flushes and gives the buffer up, the file can only be read from now on */
+static loc_bool stream_end_writing(stream_file *file) {
+    loc_bool flushed = stream_flush(file);
+    file->buffer = NULL;
+    file->capacity = 0;
+    return flushed;
+}
+
+/* Reads size bytes at offset, fewer only at the end of the file or on an error */
+static size_t stream_read_at(stream_file *file, size_t offset, void *data, size_t size) {
+    unsigned char *bytes = (unsigned char *)data;
+    size_t total_read = 0;
+    while(total_read < size) {
+#if defined(_WIN32) || defined(_WIN64)
+        OVERLAPPED overlapped = {0};
+        uint64_t position = (uint64_t)(offset + total_read);
+        overlapped.Offset = (DWORD)position;
+        overlapped.OffsetHigh = (DWORD)(position >> 32);
+        DWORD to_read = (DWORD)LOC_ARENA_MIN(size - total_read, (size_t)0x40000000);
+        DWORD bytes_read_chunk = 0;
+        if(!ReadFile(file->handle, bytes + total_read, to_read, &bytes_read_chunk, &overlapped)) {
+            if(GetLastError() != ERROR_HANDLE_EOF) file->failed = loc_true;
+            break;
+        }
 #else
-    int fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd == -1) {
-        return loc_false;
+        ssize_t bytes_read_chunk = pread(file->fd, bytes + total_read, size - total_read, (off_t)(offset + total_read));
+        if(bytes_read_chunk < 0) {
+            file->failed = loc_true;
+            break;
+        }
+#endif
+        if(bytes_read_chunk == 0) {
+            break;
+        }
+        total_read += (size_t)bytes_read_chunk;
     }
+    return total_read;
+}
 
-    size_t total_written = 0;
-    while (total_written < file_size) {
-        ssize_t result = write(fd, buffer + total_written, file_size - total_written);
-        if (result <= 0) {
-            close(fd);
-            return loc_false;
+/* Appends everything in from, which has to be done being written */
+static void stream_copy(stream_file *file, stream_file *from) {
+    size_t pos = 0;
+    while(pos < from->size && !file->failed) {
+        if(file->buffered == file->capacity && !stream_flush(file)) {
+            return;
+        }
+        size_t chunk = LOC_ARENA_MIN(from->size - pos, file->capacity - file->buffered);
+        if(stream_read_at(from, pos, file->buffer + file->buffered, chunk) != chunk) {
+            file->failed = loc_true;
+            return;
         }
-        total_written += result;
+        file->buffered += chunk;
+        file->size += chunk;
+        pos += chunk;
     }
+}
 
-    close(fd);
-    return loc_true;
+static loc_bool stream_close(stream_file *file) {
+    if(file->buffered) {
+        stream_flush(file);
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    CloseHandle(file->handle);
+#else
+    close(file->fd);
 #endif
+    return !file->failed;
 }
 
-/* consumes a string in the pipe-delimited file */
-static string consume_string(unsigned char **at, unsigned char *end) {
-    string string = {0};
-    
-    // Skip leading whitespace
-    while(*at != end && (**at == ' ' || **at == '\t')) {
-        (*at)++;
+/* Input scanning. Every '|' and '\n' in the input is a structural character, we find them 64 bytes
+ * at a time as a bitmask (one bit per byte) and then walk the set bits. Escapes (||) are sorted out
+ * while walking, they're two structurals next to each other. */
+#if !defined(LOC_NO_SIMD) && defined(__AVX2__)
+    #define SCAN_AVX2
+    #include <immintrin.h>
+#elif !defined(LOC_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #define SCAN_SSE2
+    #include <emmintrin.h>
+#elif !defined(LOC_NO_SIMD) && (defined(__aarch64__) || defined(_M_ARM64))
+    #define SCAN_NEON
+    #include <arm_neon.h>
+#endif
+
+#define SCAN_BLOCK_SIZE 64
+
+#if defined(SCAN_NEON)
+/* One bit per byte of the 16 comparison results, no movemask on NEON */
+static uint64_t scan_neon_mask(uint8x16_t m0, uint8x16_t m1, uint8x16_t m2, uint8x16_t m3) {
+    const uint8x16_t bits = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t sum0 = vpaddq_u8(vandq_u8(m0, bits), vandq_u8(m1, bits));
+    uint8x16_t sum1 = vpaddq_u8(vandq_u8(m2, bits), vandq_u8(m3, bits));
+    sum0 = vpaddq_u8(sum0, sum1);
+    sum0 = vpaddq_u8(sum0, sum0);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(sum0), 0);
+}
+#endif
+
+/* Bit i is set if p[i] is '|' or '\n'. p has to have SCAN_BLOCK_SIZE readable bytes. */
+static uint64_t scan_block(const unsigned char *p) {
+#if defined(SCAN_AVX2)
+    const __m256i pipe = _mm256_set1_epi8('|');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    __m256i lo = _mm256_loadu_si256((const __m256i *)p);
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(p + 32));
+    uint32_t lo_mask = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(lo, pipe), _mm256_cmpeq_epi8(lo, newline)));
+    uint32_t hi_mask = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(hi, pipe), _mm256_cmpeq_epi8(hi, newline)));
+    return (uint64_t)lo_mask | ((uint64_t)hi_mask << 32);
+#elif defined(SCAN_SSE2)
+    const __m128i pipe = _mm_set1_epi8('|');
+    const __m128i newline = _mm_set1_epi8('\n');
+    uint64_t mask = 0;
+    for(int i = 0; i < 4; i++) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(p + i * 16));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, pipe), _mm_cmpeq_epi8(chunk, newline));
+        mask |= (uint64_t)(uint32_t)_mm_movemask_epi8(hits) << (i * 16);
     }
-    
-    string.value = *at;
-    
-    // Consume until we hit a non-escaped pipe or end of file
-    while(*at != end) {
-        if(**at == '|') {
-            // Check if it's an escaped pipe (||)
-            if(*at + 1 != end && *(*at + 1) == '|') {
-                // Skip both pipes
-                (*at) += 2;
-            } else {
-                // Single pipe is a delimiter, stop here
-                break;
+    return mask;
+#elif defined(SCAN_NEON)
+    const uint8x16_t pipe = vdupq_n_u8('|');
+    const uint8x16_t newline = vdupq_n_u8('\n');
+    uint8x16_t c0 = vld1q_u8(p), c1 = vld1q_u8(p + 16), c2 = vld1q_u8(p + 32), c3 = vld1q_u8(p + 48);
+    return scan_neon_mask(vorrq_u8(vceqq_u8(c0, pipe), vceqq_u8(c0, newline)),
+                          vorrq_u8(vceqq_u8(c1, pipe), vceqq_u8(c1, newline)),
+                          vorrq_u8(vceqq_u8(c2, pipe), vceqq_u8(c2, newline)),
+                          vorrq_u8(vceqq_u8(c3, pipe), vceqq_u8(c3, newline)));
+#else
+    uint64_t mask = 0;
+    for(int i = 0; i < SCAN_BLOCK_SIZE; i++) {
+        if(p[i] == '|' || p[i] == '\n') mask |= (uint64_t)1 << i;
+    }
+    return mask;
+#endif
+}
+
+/* The last partial block, never read past end */
+static uint64_t scan_tail(const unsigned char *p, size_t n) {
+    uint64_t mask = 0;
+    for(size_t i = 0; i < n; i++) {
+        if(p[i] == '|' || p[i] == '\n') mask |= (uint64_t)1 << i;
+    }
+    return mask;
+}
+
+static unsigned scan_ctz64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctzll(x);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (unsigned)index;
+#else
+    unsigned n = 0;
+    while(!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+typedef struct {
+    unsigned char *start;
+    unsigned char *end;
+    size_t block;    // offset of the block mask came from
+    uint64_t mask;   // structurals of that block we haven't returned yet
+} scanner;
+
+static uint64_t scanner_mask(scanner *scan) {
+    size_t left = (size_t)(scan->end - scan->start) - scan->block;
+    return left >= SCAN_BLOCK_SIZE ? scan_block(scan->start + scan->block) : scan_tail(scan->start + scan->block, left);
+}
+
+static void scanner_init(scanner *scan, unsigned char *start, unsigned char *end) {
+    scan->start = start;
+    scan->end = end;
+    scan->block = 0;
+    scan->mask = start != end ? scanner_mask(scan) : 0;
+}
+
+/* The next '|' or '\n', end once there are none left */
+static unsigned char *scanner_next(scanner *scan) {
+    while(!scan->mask) {
+        scan->block += SCAN_BLOCK_SIZE;
+        if(scan->block >= (size_t)(scan->end - scan->start)) {
+            return scan->end;
+        }
+        scan->mask = scanner_mask(scan);
+    }
+
+    unsigned char *structural = scan->start + scan->block + scan_ctz64(scan->mask);
+    scan->mask &= scan->mask - 1;
+    return structural;
+}
+
+static int is_blank(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/* Field without the whitespace around it, still escaped */
+static string trim_field(unsigned char *start, unsigned char *end) {
+    while(start < end && is_blank(*start)) start++;
+    while(end > start && is_blank(*(end - 1))) end--;
+
+    string field;
+    field.value = start;
+    field.len = (size_t)(end - start);
+    return field;
+}
+
+/* Called with language_count fields, fields[0] is the key */
+typedef void (*row_callback)(void *user, string *fields);
+
+/* Splits the input into rows in one pass. A row is a line of | separated fields, || is a literal |.
+ * Missing fields are empty, blank lines and rows without a key are skipped. A line with more fields
+ * than languages holds several rows, so files written as one long line still work. A | at the end
+ * of a line is allowed.
+ * Returns how much of the input it used. Unless at_end more input follows, and a row that might go on
+ * past the end is left for the next call. */
+static size_t parse_rows(unsigned char *input, size_t input_size, int language_count, loc_bool at_end,
+                         row_callback callback, void *user) {
+    unsigned char *end = input + input_size;
+    string fields[32];
+    int field_count = 0;
+    size_t line_rows = 0;
+    unsigned char *field_start = input;
+    size_t used = 0;
+
+    scanner scan;
+    scanner_init(&scan, input, end);
+
+    for(;;) {
+        unsigned char *structural = scanner_next(&scan);
+
+        if(structural != end && *structural == '|') {
+            if(structural + 1 == end && !at_end) {
+                return used;  // Could be the first half of ||
             }
-        } else {
-            (*at)++;
+            if(structural + 1 != end && structural[1] == '|') {
+                scanner_next(&scan);  // Escaped, the second pipe is the next structural
+                continue;
+            }
+            fields[field_count++] = trim_field(field_start, structural);
+            field_start = structural + 1;
+            if(field_count == language_count) {
+                if(fields[0].len) callback(user, fields);
+                field_count = 0;
+                line_rows++;
+                used = (size_t)(field_start - input);
+            }
+            continue;
+        }
+
+        if(structural == end && !at_end) {
+            return used;
+        }
+
+        // End of the line, whatever's after the last pipe is one more field
+        string last = trim_field(field_start, structural);
+        if(last.len || (field_count > 0 && line_rows == 0)) {
+            fields[field_count++] = last;
+        }
+        if(field_count > 0) {
+            for(int i = field_count; i < language_count; i++) {
+                fields[i].value = last.value;
+                fields[i].len = 0;
+            }
+            if(fields[0].len) callback(user, fields);
+        }
+
+        if(structural == end) {
+            return input_size;
         }
+        field_start = structural + 1;
+        field_count = 0;
+        line_rows = 0;
+        used = (size_t)(field_start - input);
     }
-    
-    // Trim trailing whitespace from the value
-    unsigned char *value_end = *at;
-    while(value_end > string.value && (*(value_end - 1) == ' ' || *(value_end - 1) == '\t')) {
-        value_end--;
+}
+
+typedef struct {
+    loc_mem_arena *arena;
+    int language_count;
+    loc_bool shared_keys;
+    string *values;     // language_count strings per row, one row after the other
+    size_t row_count;
+    size_t lang_sizes[32];
+    size_t keys_size;
+} parsed_rows;
+
+static void parsed_rows_init(parsed_rows *rows, loc_mem_arena *arena, int language_count, loc_bool shared_keys) {
+    rows->arena = arena;
+    rows->language_count = language_count;
+    rows->shared_keys = shared_keys;
+    rows->values = NULL;
+    rows->row_count = 0;
+    rows->keys_size = 0;
+    for(int i = 0; i < 32; i++) rows->lang_sizes[i] = 0;
+}
+
+/* row_callback, adds a row to the end of rows->values, which has to be the last thing on the arena */
+static void push_row(void *user, string *fields) {
+    parsed_rows *rows = (parsed_rows *)user;
+    string *row = LOC_ARENA_PUSH_ARRAY(rows->arena, string, rows->language_count);
+    if(rows->row_count == 0) {
+        rows->values = row;
     }
-    
-    string.len = value_end - string.value;
-    
-    // Skip the pipe delimiter if present
-    if(*at != end && **at == '|') {
-        (*at)++;
+
+    // Every language stores the key and its translation, unescaping only makes them shorter.
+    // With shared keys the keys go into their own buffer instead.
+    size_t key_size = rows->shared_keys ? 0 : fields[0].len + 1;
+    rows->keys_size += fields[0].len + 1;
+    for(int i = 0; i < rows->language_count; i++) {
+        row[i] = fields[i];
+        rows->lang_sizes[i] += key_size + fields[i].len + 1;
     }
-    
-    return string;
+    rows->row_count++;
+}
+
+
+/* loc.h's loc_mix64, these have to stay in sync with the loader */
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
 }
 
-static uint32_t fnv1a_hash(string string) {
-    uint32_t hash = 2166136261;
+/* loc.h's loc_hash64 */
+static uint64_t fnv1a_hash64(string string) {
+    uint64_t hash = 14695981039346656037ull;
     for(size_t i = 0; i < string.len; i++) {
         hash = hash ^ string.value[i];
-        hash = hash * 16777619;
+        hash = hash * 1099511628211ull;
+    }
+    return mix64(hash);
+}
+
+/* loc.h's loc_mph_slot */
+static size_t mph_slot(uint64_t hash, uint32_t displacement, size_t slot_count) {
+    return (size_t)(mix64(hash + (uint64_t)displacement * 0x9e3779b97f4a7c15ull) % slot_count);
+}
+
+/* Content hashes for the manifest of incremental builds, a digest folds hashes in order */
+static uint64_t digest_add(uint64_t digest, uint64_t hash) {
+    return mix64(digest ^ (hash + 0x9e3779b97f4a7c15ull));
+}
+
+/* Digest of a row's fields as they go into the files, each field also goes into its language's digest.
+ * A field filled from a fallback language digests differently from the same text translated, its entry is flagged. */
+static uint64_t digest_row(string *fields, int language_count, uint64_t *lang_digests, uint32_t fallback_mask) {
+    uint64_t row_digest = 0;
+    for(int i = 0; i < language_count; i++) {
+        uint64_t hash = fnv1a_hash64(fields[i]);
+        if(fallback_mask & ((uint32_t)1 << i)) {
+            hash = mix64(hash + 1);
+        }
+        row_digest = digest_add(row_digest, hash);
+        lang_digests[i] = digest_add(lang_digests[i], hash);
+    }
+    return row_digest;
+}
+
+/* Fallback languages (--fallback). fallbacks[lang] is the language a missing translation is taken from,
+ * NO_FALLBACK if there's none. Chains are followed at build time, so a file already has a string for every
+ * row and the loader never looks anywhere else. */
+#define NO_FALLBACK -1
+
+/* "pt-BR:pt:en,es-MX:es", every language in a chain falls back to the next one. Prints what's wrong and
+ * returns false if spec names a language that isn't being built, gives one two fallbacks, or goes in a circle. */
+static loc_bool parse_fallbacks(const char *spec, char **lang_codes, int language_count, int *fallbacks) {
+    for(int i = 0; i < language_count; i++) {
+        fallbacks[i] = NO_FALLBACK;
+    }
+
+    int previous = NO_FALLBACK;
+    const char *start = spec;
+    for(const char *p = spec;; p++) {
+        if(*p != ':' && *p != ',' && *p != '\0') {
+            continue;
+        }
+
+        size_t len = (size_t)(p - start);
+        int lang = NO_FALLBACK;
+        for(int i = 0; i < language_count; i++) {
+            if(loc_strlen(lang_codes[i]) == len && loc_memcmp(lang_codes[i], start, len) == 0) {
+                lang = i;
+            }
+        }
+        if(lang == NO_FALLBACK) {
+            printf("Error: --fallback names \"%.*s\", which isn't one of the languages\n", (int)len, start);
+            return loc_false;
+        }
+        if(previous != NO_FALLBACK) {
+            if(fallbacks[previous] != NO_FALLBACK && fallbacks[previous] != lang) {
+                printf("Error: --fallback gives %s two fallbacks, %s and %s\n", lang_codes[previous],
+                       lang_codes[fallbacks[previous]], lang_codes[lang]);
+                return loc_false;
+            }
+            fallbacks[previous] = lang;
+        }
+
+        previous = *p == ':' ? lang : NO_FALLBACK;
+        start = p + 1;
+        if(*p == '\0') {
+            break;
+        }
+    }
+
+    // A chain that hasn't ended after language_count steps never will
+    for(int i = 0; i < language_count; i++) {
+        int lang = i;
+        for(int step = 0; step < language_count && lang != NO_FALLBACK; step++) {
+            lang = fallbacks[lang];
+        }
+        if(lang != NO_FALLBACK) {
+            printf("Error: --fallback goes in a circle through %s\n", lang_codes[i]);
+            return loc_false;
+        }
+    }
+    return loc_true;
+}
+
+/* Fills the row's missing translations from their fallback languages and returns which ones it filled,
+ * bit lang for each. A filled field points at its fallback's text in the input, it's unescaped like any other. */
+static uint32_t resolve_fallbacks(string *fields, int language_count, const int *fallbacks) {
+    uint32_t filled = 0;
+    for(int i = 0; i < language_count; i++) {
+        if(fields[i].len) {
+            continue;
+        }
+        for(int lang = fallbacks[i]; lang != NO_FALLBACK; lang = fallbacks[lang]) {
+            if(fields[lang].len) {
+                fields[i] = fields[lang];
+                filled |= (uint32_t)1 << i;
+                break;
+            }
+        }
     }
-    return hash;
+    return filled;
 }
 
 /* Unescape pipes (|| -> |) and copy to buffer */
@@ -432,231 +943,3393 @@ static void unescape_and_copy(unsigned char *dest, size_t *dest_size, unsigned c
     }
 }
 
+/* Plural forms (--plurals). A row whose key starts with a category has a form per category:
+ *   [one] {0} file deleted [other] {0} files deleted | [one] {0} fichier supprimé [other] {0} fichiers supprimés
+ * and its key is the key's [other] form. A language stores the forms one after the other, null-separated: [other]
+ * first, so loc_get_string still gets a whole sentence, then the other categories its rules have, in CLDR's order.
+ * A form a translation doesn't give is empty, the loader returns the [other] form for it, and a translation without
+ * categories is the [other] form. The rules are CLDR's (plurals.xml) for the integers loc_get_plural takes: i is n,
+ * and v w f t e c are always 0. */
+#define PLURAL_CATEGORY_COUNT 6
+#define PLURAL_OTHER 0
+#define PLURAL_TABLE_SIZE 256
+#define PLURAL_MAX_WORDS 512
+
+static const char *plural_category_names[PLURAL_CATEGORY_COUNT] = { "other", "zero", "one", "two", "few", "many" };
+
+/* Languages with the same rules are listed together, by their CLDR codes */
 typedef struct {
-    size_t count;
-    size_t *offsets;
-} bucket;
+    const char *languages;
+    const char *rules;
+} plural_rule_set;
 
-int main(int argc, char **argv) {
-    size_t input_size = 0;
-    unsigned char *input, *at, *end;
-    int language_count = 0;
-    loc_mem_arena *arena;
+static const plural_rule_set plural_rule_sets[] = {
+    { "bm bo dz id ig ii in ja jbo jv jw kde kea km ko lkt lo ms my nqo osa sah ses sg su th to tpi vi wo yo yue zh", "" },
+    { "am as bn doi fa gu hi kn pcm zu", "one: i = 0 or n = 1" },
+    { "ff hy kab", "one: i = 0,1" },
+    { "ast de en et fi fy gl ia io ji lij nl sc sv sw ur yi", "one: i = 1 and v = 0" },
+    { "si", "one: n = 0,1 or i = 0 and f = 1" },
+    { "ak bho guw ln mg nso pa ti wa", "one: n = 0..1" },
+    { "af an asa az bal bem bez bg brx ce cgg chr ckb dv ee el eo eu fo fur gsw ha haw hu jgo jmc ka kaj kcg kk kkj kl ks "
+      "ksb ku ky lb lg mas mgo ml mn mr nah nb nd ne nn nnh no nr ny nyn om or os pap ps rm rof rwk saq sd sdh seh sn so sq "
+      "ss ssy st syr ta te teo tig tk tn tr ts ug uz ve vo vun wae xh xog", "one: n = 1" },
+    { "da", "one: n = 1 or t != 0 and i = 0,1" },
+    { "is", "one: t = 0 and i % 10 = 1 and i % 100 != 11 or t % 10 = 1 and t % 100 != 11" },
+    { "mk", "one: v = 0 and i % 10 = 1 and i % 100 != 11 or f % 10 = 1 and f % 100 != 11" },
+    { "ceb fil tl", "one: v = 0 and i = 1,2,3 or v = 0 and i % 10 != 4,6,9 or v != 0 and f % 10 != 4,6,9" },
+    { "lv prg", "zero: n % 10 = 0 or n % 100 = 11..19 or v = 2 and f % 100 = 11..19; "
+                "one: n % 10 = 1 and n % 100 != 11 or v = 2 and f % 10 = 1 and f % 100 != 11 or v != 2 and f % 10 = 1" },
+    { "lag", "zero: n = 0; one: i = 0,1 and n != 0" },
+    { "ksh", "zero: n = 0; one: n = 1" },
+    { "he", "one: i = 1 and v = 0 or i = 0 and v != 0; two: i = 2 and v = 0" },
+    { "iu naq sat se sma smi smj smn sms", "one: n = 1; two: n = 2" },
+    { "mo ro", "one: i = 1 and v = 0; few: v != 0 or n = 0 or n != 1 and n % 100 = 1..19" },
+    { "bs hr sh sr", "one: v = 0 and i % 10 = 1 and i % 100 != 11 or f % 10 = 1 and f % 100 != 11; "
+                     "few: v = 0 and i % 10 = 2..4 and i % 100 != 12..14 or f % 10 = 2..4 and f % 100 != 12..14" },
+    { "fr", "one: i = 0,1; many: e = 0 and i != 0 and i % 1000000 = 0 and v = 0 or e != 0..5" },
+    { "pt", "one: i = 0..1; many: e = 0 and i != 0 and i % 1000000 = 0 and v = 0 or e != 0..5" },
+    { "ca it pt_PT vec", "one: i = 1 and v = 0; many: e = 0 and i != 0 and i % 1000000 = 0 and v = 0 or e != 0..5" },
+    { "es", "one: n = 1; many: e = 0 and i != 0 and i % 1000000 = 0 and v = 0 or e != 0..5" },
+    { "gd", "one: n = 1,11; two: n = 2,12; few: n = 3..10,13..19" },
+    { "sl", "one: v = 0 and i % 100 = 1; two: v = 0 and i % 100 = 2; few: v = 0 and i % 100 = 3..4 or v != 0" },
+    { "dsb hsb", "one: v = 0 and i % 100 = 1 or f % 100 = 1; two: v = 0 and i % 100 = 2 or f % 100 = 2; "
+                 "few: v = 0 and i % 100 = 3..4 or f % 100 = 3..4" },
+    { "cs sk", "one: i = 1 and v = 0; few: i = 2..4 and v = 0; many: v != 0" },
+    { "pl", "one: i = 1 and v = 0; few: v = 0 and i % 10 = 2..4 and i % 100 != 12..14; "
+            "many: v = 0 and i != 1 and i % 10 = 0..1 or v = 0 and i % 10 = 5..9 or v = 0 and i % 100 = 12..14" },
+    { "be", "one: n % 10 = 1 and n % 100 != 11; few: n % 10 = 2..4 and n % 100 != 12..14; "
+            "many: n % 10 = 0 or n % 10 = 5..9 or n % 100 = 11..14" },
+    { "lt", "one: n % 10 = 1 and n % 100 != 11..19; few: n % 10 = 2..9 and n % 100 != 11..19; many: f != 0" },
+    { "ru uk", "one: v = 0 and i % 10 = 1 and i % 100 != 11; few: v = 0 and i % 10 = 2..4 and i % 100 != 12..14; "
+               "many: v = 0 and i % 10 = 0 or v = 0 and i % 10 = 5..9 or v = 0 and i % 100 = 11..14" },
+    { "mt", "one: n = 1; two: n = 2; few: n = 0 or n % 100 = 3..10; many: n % 100 = 11..19" },
+    { "ga", "one: n = 1; two: n = 2; few: n = 3..6; many: n = 7..10" },
+    { "ar ars", "zero: n = 0; one: n = 1; two: n = 2; few: n % 100 = 3..10; many: n % 100 = 11..99" },
+    { "cy", "zero: n = 0; one: n = 1; two: n = 2; few: n = 3; many: n = 6" },
+};
 
-    if(argc < 3) {
-        printf("Invalid Usage.\n");
-        printf("Usage: loc [input_file_path] [lang1] [lang2] [lang3] ...\n");
-        printf("Input file format: pipe-delimited (|) with optional whitespace around pipes\n");
-        printf("Use || to include a literal pipe character in a string\n");
-        printf("Example: loc strings.txt en fr jp\n");
-        printf("  Produces: strings.en.loc, strings.fr.loc, strings.jp.loc\n");
-        return -1;
+/* A language's rules, compiled. words has the condition of every form after [other], each is: or_count, then
+ * per or'ed group and_count, then per relation modulus (0 for none), negate, range_count, range_count x {low, high}.
+ * A form's condition holds if any group has all of its relations, a relation if n (mod modulus) is in a range,
+ * or isn't with negate. table is the form of every n below PLURAL_TABLE_SIZE. See LOC_SECTION_PLURAL_RULES. */
+typedef struct {
+    int form_count;
+    int forms[PLURAL_CATEGORY_COUNT];       // the form of each category, -1 if the language doesn't have it
+    int categories[PLURAL_CATEGORY_COUNT];  // the category of each form
+    uint32_t words[PLURAL_MAX_WORDS];
+    size_t word_count;
+    u8 table[PLURAL_TABLE_SIZE];
+} plural_language;
+
+static loc_bool rule_accept(const char **p, const char *token) {
+    while(**p == ' ') (*p)++;
+    size_t len = loc_strlen(token);
+    if(loc_memcmp(*p, token, len) != 0) {
+        return loc_false;
     }
+    *p += len;
+    return loc_true;
+}
 
-    language_count = argc - 2;
-    
-    arena = loc_arena_init(1024 * 1024 * 1024 * 16);
+static loc_bool rule_number(const char **p, uint32_t *number) {
+    while(**p == ' ') (*p)++;
+    uint64_t value = 0;
+    const char *start = *p;
+    while(**p >= '0' && **p <= '9' && value <= UINT32_MAX) {
+        value = value * 10 + (uint64_t)(*(*p)++ - '0');
+    }
+    *number = (uint32_t)value;
+    return *p != start && value <= UINT32_MAX;
+}
 
-    input = loc_read_entire_file(arena, argv[1], &input_size);
-    if(!input) {
-        printf("Failed to read file: %s\n", argv[1]);
-        loc_arena_destroy(arena);
-        return -1;
+static loc_bool rule_word(plural_language *language, uint32_t word) {
+    if(language->word_count == PLURAL_MAX_WORDS) {
+        return loc_false;
     }
+    language->words[language->word_count++] = word;
+    return loc_true;
+}
 
-    // First pass: count rows
-    at = input;
-    end = input + input_size;
-    size_t row_count = 0;
-    
-    while(at < end) {
-        string first_value = consume_string(&at, end);
-        if(first_value.len == 0) break;
-        
-        for(int i = 1; i < language_count; i++) {
-            consume_string(&at, end);
+/* One category's condition, up to the ';' after it. Relations on an operand that's always 0 are decided here
+ * and left out, along with the groups they make false. */
+static loc_bool compile_plural_condition(const char **p, plural_language *language) {
+    size_t or_count_at = language->word_count;
+    uint32_t or_count = 0;
+    if(!rule_word(language, 0)) return loc_false;
+    do {
+        size_t and_count_at = language->word_count;
+        uint32_t and_count = 0;
+        loc_bool possible = loc_true;
+        if(!rule_word(language, 0)) return loc_false;
+        do {
+            while(**p == ' ') (*p)++;
+            char operand = **p;
+            loc_bool integer = operand == 'n' || operand == 'i';
+            if(!integer && operand != 'v' && operand != 'w' && operand != 'f' && operand != 't' && operand != 'e' && operand != 'c') {
+                return loc_false;
+            }
+            (*p)++;
+
+            uint32_t modulus = 0;
+            if(rule_accept(p, "%") && (!rule_number(p, &modulus) || modulus == 0)) {
+                return loc_false;
+            }
+            uint32_t negate = 0;
+            if(rule_accept(p, "!=")) {
+                negate = 1;
+            } else if(!rule_accept(p, "=")) {
+                return loc_false;
+            }
+
+            size_t relation_at = language->word_count;
+            uint32_t range_count = 0;
+            loc_bool zero_in_range = loc_false;
+            if(!rule_word(language, modulus) || !rule_word(language, negate) || !rule_word(language, 0)) return loc_false;
+            do {
+                uint32_t low;
+                uint32_t high;
+                if(!rule_number(p, &low)) return loc_false;
+                high = low;
+                if(rule_accept(p, "..") && (!rule_number(p, &high) || high < low)) return loc_false;
+                if(!rule_word(language, low) || !rule_word(language, high)) return loc_false;
+                zero_in_range |= low == 0;
+                range_count++;
+            } while(rule_accept(p, ","));
+
+            if(integer) {
+                language->words[relation_at + 2] = range_count;
+                and_count++;
+            } else {
+                language->word_count = relation_at;  // 0 % modulus is 0 too
+                possible &= zero_in_range != (negate != 0);
+            }
+        } while(rule_accept(p, "and"));
+
+        if(possible) {
+            language->words[and_count_at] = and_count;
+            or_count++;
+        } else {
+            language->word_count = and_count_at;
         }
-        row_count++;
-    }
+    } while(rule_accept(p, "or"));
 
-    printf("Found %zu strings\n", row_count);
+    language->words[or_count_at] = or_count;
+    return loc_true;
+}
 
-    size_t bucket_table_size = row_count;
-    
-    typedef struct {
-        unsigned char *data;
-        size_t size;
-        size_t capacity;
-    } language_buffer;
-    
-    language_buffer *lang_buffers = LOC_ARENA_PUSH_ARRAY_ZERO(arena, language_buffer, language_count);
-    for(int i = 0; i < language_count; i++) {
-        lang_buffers[i].capacity = input_size;
-        lang_buffers[i].data = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, lang_buffers[i].capacity);
-        lang_buffers[i].size = 0;
+/* loc.h's loc_plural_form, for the table */
+static int plural_form(const plural_language *language, uint64_t n) {
+    size_t pos = 0;
+    for(int form = 1; form < language->form_count; form++) {
+        uint32_t or_count = language->words[pos++];
+        loc_bool matches = loc_false;
+        for(uint32_t group = 0; group < or_count; group++) {
+            uint32_t and_count = language->words[pos++];
+            loc_bool all = loc_true;
+            for(uint32_t relation = 0; relation < and_count; relation++) {
+                uint64_t modulus = language->words[pos];
+                loc_bool negate = language->words[pos + 1] != 0;
+                uint32_t range_count = language->words[pos + 2];
+                uint64_t value = modulus ? n % modulus : n;
+                loc_bool in_range = loc_false;
+                pos += 3;
+                for(uint32_t range = 0; range < range_count; range++, pos += 2) {
+                    in_range |= value >= language->words[pos] && value <= language->words[pos + 1];
+                }
+                all &= in_range != negate;
+            }
+            matches |= all;
+        }
+        if(matches) {
+            return form;
+        }
     }
+    return 0;
+}
 
-    // Allocate buckets for each language
-    bucket **lang_buckets = LOC_ARENA_PUSH_ARRAY(arena, bucket*, language_count);
-    for(int i = 0; i < language_count; i++) {
-        lang_buckets[i] = LOC_ARENA_PUSH_ARRAY_ZERO(arena, bucket, bucket_table_size);
+/* "one: i = 1 and v = 0; many: ..." */
+static loc_bool compile_plural_rules(const char *rules, plural_language *language) {
+    language->form_count = 1;
+    language->word_count = 0;
+    for(int i = 0; i < PLURAL_CATEGORY_COUNT; i++) {
+        language->forms[i] = -1;
     }
+    language->forms[PLURAL_OTHER] = 0;
+    language->categories[0] = PLURAL_OTHER;
 
-    // Second pass: build buckets and strings
-    at = input;
-    
-    while(at < end) {
-        string values[32];
-        if(language_count > 32) {
-            printf("Error: Too many languages (max 32)\n");
-            loc_arena_destroy(arena);
-            return -1;
+    const char *p = rules;
+    while(*p) {
+        int category = -1;
+        for(int i = 1; i < PLURAL_CATEGORY_COUNT && category < 0; i++) {
+            const char *q = p;
+            if(rule_accept(&q, plural_category_names[i]) && rule_accept(&q, ":")) {
+                category = i;
+                p = q;
+            }
         }
-        
-        for(int i = 0; i < language_count; i++) {
-            values[i] = consume_string(&at, end);
+        if(category < 0 || language->forms[category] >= 0 || !compile_plural_condition(&p, language)) {
+            return loc_false;
         }
-        
-        if(values[0].len == 0) break;
-        
-        uint32_t hash = fnv1a_hash(values[0]);
-        uint32_t bucket_index = hash % bucket_table_size;
-        
-        // For each language, add offset to bucket and store string
-        for(int lang_idx = 0; lang_idx < language_count; lang_idx++) {
-            bucket *b = &lang_buckets[lang_idx][bucket_index];
-            
-            // Expand bucket offsets array
-            if(b->count == 0) {
-                b->offsets = LOC_ARENA_PUSH_ARRAY(arena, size_t, 1);
+        language->forms[category] = language->form_count;
+        language->categories[language->form_count++] = category;
+
+        while(*p == ' ') p++;
+        if(*p == ';') {
+            p++;
+        } else if(*p) {
+            return loc_false;
+        }
+    }
+
+    for(int n = 0; n < PLURAL_TABLE_SIZE; n++) {
+        language->table[n] = (u8)plural_form(language, (uint64_t)n);
+    }
+    return loc_true;
+}
+
+/* Language codes are compared like CLDR's: pt-BR is pt_BR, and case doesn't matter */
+static loc_bool same_language_code(const char *a, size_t a_len, const char *b, size_t b_len) {
+    if(a_len != b_len) {
+        return loc_false;
+    }
+    for(size_t i = 0; i < a_len; i++) {
+        char x = a[i] == '-' ? '_' : (a[i] >= 'A' && a[i] <= 'Z') ? (char)(a[i] - 'A' + 'a') : a[i];
+        char y = b[i] == '-' ? '_' : (b[i] >= 'A' && b[i] <= 'Z') ? (char)(b[i] - 'A' + 'a') : b[i];
+        if(x != y) {
+            return loc_false;
+        }
+    }
+    return loc_true;
+}
+
+/* The rules of a language, -1 if there are none. pt-PT has its own, pt-BR is pt's. */
+static int find_plural_rule_set(const char *code, size_t len) {
+    size_t set_count = sizeof(plural_rule_sets) / sizeof(plural_rule_sets[0]);
+    for(int attempt = 0; attempt < 2; attempt++) {
+        for(size_t set = 0; set < set_count; set++) {
+            const char *name = plural_rule_sets[set].languages;
+            while(*name) {
+                size_t name_len = 0;
+                while(name[name_len] && name[name_len] != ' ') name_len++;
+                if(same_language_code(name, name_len, code, len)) {
+                    return (int)set;
+                }
+                name += name_len;
+                while(*name == ' ') name++;
+            }
+        }
+
+        // Then without the region
+        size_t base_len = 0;
+        while(base_len < len && code[base_len] != '-' && code[base_len] != '_') base_len++;
+        if(base_len == len) {
+            break;
+        }
+        len = base_len;
+    }
+    return -1;
+}
+
+/* Compiles the rules of every language. spec is --plural-rules, "sp:es,jp:ja": the CLDR language a code follows,
+ * for codes that aren't CLDR's. Prints what's wrong and returns false if a language has no rules. */
+static loc_bool resolve_plural_languages(const char *spec, char **lang_codes, int language_count, plural_language *languages) {
+    const char *codes[32];
+    size_t code_lens[32];
+    for(int i = 0; i < language_count; i++) {
+        codes[i] = lang_codes[i];
+        code_lens[i] = loc_strlen(lang_codes[i]);
+    }
+
+    for(const char *p = spec; p && *p;) {
+        const char *entry = p;
+        while(*p && *p != ':' && *p != ',') p++;
+        size_t len = (size_t)(p - entry);
+        if(*p != ':') {
+            printf("Error: --plural-rules needs CODE:LANGUAGE pairs, like sp:es,jp:ja\n");
+            return loc_false;
+        }
+        const char *language = ++p;
+        while(*p && *p != ',') p++;
+
+        int lang = -1;
+        for(int i = 0; i < language_count; i++) {
+            if(loc_strlen(lang_codes[i]) == len && loc_memcmp(lang_codes[i], entry, len) == 0) {
+                lang = i;
+            }
+        }
+        if(lang < 0) {
+            printf("Error: --plural-rules names \"%.*s\", which isn't one of the languages\n", (int)len, entry);
+            return loc_false;
+        }
+        codes[lang] = language;
+        code_lens[lang] = (size_t)(p - language);
+        if(*p == ',') p++;
+    }
+
+    for(int i = 0; i < language_count; i++) {
+        int set = find_plural_rule_set(codes[i], code_lens[i]);
+        if(set < 0) {
+            printf("Error: there are no plural rules for \"%.*s\", say which language %s follows with --plural-rules=%s:LANGUAGE\n",
+                   (int)code_lens[i], codes[i], lang_codes[i], lang_codes[i]);
+            return loc_false;
+        }
+        if(!compile_plural_rules(plural_rule_sets[set].rules, &languages[i])) {
+            printf("Error: the plural rules of %s don't compile: %s\n", lang_codes[i], plural_rule_sets[set].rules);
+            return loc_false;
+        }
+    }
+    return loc_true;
+}
+
+/* Splits a field into its forms by category, where "[one]" and the like start them. False if the field doesn't
+ * start with a category, it's one text then. */
+static loc_bool split_plural_forms(string field, string *forms) {
+    for(int i = 0; i < PLURAL_CATEGORY_COUNT; i++) {
+        forms[i].value = field.value;
+        forms[i].len = 0;
+    }
+
+    unsigned char *end = field.value + field.len;
+    unsigned char *form_start = NULL;
+    int category = -1;
+    for(unsigned char *p = field.value;; p++) {
+        int next = -1;
+        size_t label_len = 0;
+        for(int i = 0; p < end && *p == '[' && i < PLURAL_CATEGORY_COUNT && next < 0; i++) {
+            size_t name_len = loc_strlen(plural_category_names[i]);
+            if((size_t)(end - p) >= name_len + 2 && loc_memcmp(p + 1, plural_category_names[i], name_len) == 0 && p[name_len + 1] == ']') {
+                next = i;
+                label_len = name_len + 2;
+            }
+        }
+        if(p == end || next >= 0) {
+            if(category >= 0) {
+                forms[category] = trim_field(form_start, p);
+            } else if(p != field.value) {
+                return loc_false;  // Text before the first category
+            }
+            if(p == end) {
+                return category >= 0;
+            }
+            category = next;
+            form_start = p + label_len;
+            p += label_len - 1;
+        }
+    }
+}
+
+/* The key of a row: the [other] form of a plural row's */
+static string plural_row_key(string key) {
+    string forms[PLURAL_CATEGORY_COUNT];
+    return split_plural_forms(key, forms) ? forms[PLURAL_OTHER] : key;
+}
+
+/* Unescapes a plural row's translation as the language stores it, the caller terminates it like any other */
+static void unescape_plural_forms(unsigned char *dest, size_t *dest_size, string field, const plural_language *language) {
+    string forms[PLURAL_CATEGORY_COUNT];
+    if(!split_plural_forms(field, forms)) {
+        forms[PLURAL_OTHER] = field;
+    }
+    for(int form = 0; form < language->form_count; form++) {
+        if(form) {
+            dest[(*dest_size)++] = '\0';
+        }
+        string text = forms[language->categories[form]];
+        unescape_and_copy(dest, dest_size, text.value, text.len);
+    }
+}
+
+static int loc_strcmp(const char *s1, const char *s2) {
+    while (*s1 && (*s1 == *s2)) {
+        s1++;
+        s2++;
+    }
+    return *(unsigned char *)s1 - *(unsigned char *)s2;
+}
+
+/* Every row's unescaped key, [key\0] one after the other. In memory, or with --mem-limit in a temporary file. */
+typedef struct {
+    unsigned char *data;
+    stream_file *spill;     // when data is NULL
+    size_t size;
+    size_t *offsets;
+    uint32_t *lens;
+    uint32_t max_len;
+} key_table;
+
+/* The key of row, null-terminated. A spilled key is read into buffer, which needs room for max_len + 1 bytes. */
+static unsigned char *row_key(key_table *keys, size_t row, unsigned char *buffer) {
+    if(keys->data) {
+        return keys->data + keys->offsets[row];
+    }
+    size_t size = (size_t)keys->lens[row] + 1;
+    if(stream_read_at(keys->spill, keys->offsets[row], buffer, size) != size) {
+        buffer[0] = '\0';
+    }
+    return buffer;
+}
+
+typedef struct {
+    size_t count;
+    size_t *rows;
+} bucket;
+
+/* Counting sort of the rows by bucket: count every bucket's rows, turn the counts into where each
+ * bucket starts, then drop every row into place. Linear in the rows however skewed the buckets are,
+ * and rows stay in input order within their bucket. */
+static bucket *build_buckets(loc_mem_arena *arena, uint64_t *hashes, size_t row_count, size_t bucket_count) {
+    bucket *buckets = LOC_ARENA_PUSH_ARRAY_ZERO(arena, bucket, bucket_count);
+    size_t *rows = LOC_ARENA_PUSH_ARRAY(arena, size_t, row_count);
+
+    for(size_t row = 0; row < row_count; row++) {
+        buckets[hashes[row] % bucket_count].count++;
+    }
+
+    size_t start = 0;
+    for(size_t i = 0; i < bucket_count; i++) {
+        buckets[i].rows = rows + start;
+        start += buckets[i].count;
+        buckets[i].count = 0;
+    }
+
+    for(size_t row = 0; row < row_count; row++) {
+        bucket *b = &buckets[hashes[row] % bucket_count];
+        b->rows[b->count++] = row;
+    }
+
+    return buckets;
+}
+
+/* File format, see the top of loc.h */
+#define LOC_MAGIC "LOCF"
+#define LOC_VERSION 4
+
+#define LOC_FLAG_MPH 0x1
+#define LOC_FLAG_FLAT 0x2
+#define LOC_FLAG_WIDE_OFFSETS 0x4
+#define LOC_FLAG_KEYS 0x8
+#define LOC_FLAG_VALUES 0x10
+#define LOC_FLAG_COMPRESSED 0x20
+#define LOC_FLAG_DEDUP 0x40
+#define LOC_FLAG_FALLBACK 0x80
+#define LOC_FLAG_TEMPLATES 0x100
+#define LOC_FLAG_PLURALS 0x200
+
+#define LOC_SECTION_STRINGS 1
+#define LOC_SECTION_BUCKET_OFFSETS 2
+#define LOC_SECTION_BUCKET_LIST 3
+#define LOC_SECTION_MPH_DISPLACEMENTS 4
+#define LOC_SECTION_MPH_SLOTS 5
+#define LOC_SECTION_FLAT_CONTROL 6
+#define LOC_SECTION_FLAT_SLOTS 7
+#define LOC_SECTION_IDS 8
+#define LOC_SECTION_BLOCKS 9
+#define LOC_SECTION_BLOCK_TABLE 10
+#define LOC_SECTION_DICTIONARY 11
+#define LOC_SECTION_TEMPLATE_SLOTS 12
+#define LOC_SECTION_TEMPLATES 13
+#define LOC_SECTION_PLURAL_RULES 14
+
+#define LOC_HEADER_SIZE 24
+#define LOC_DIRECTORY_ENTRY_SIZE 24
+#define LOC_SECTION_ALIGNMENT 8
+
+#define LOC_ENTRY_SIZE 16
+#define LOC_WIDE_ENTRY_SIZE 24
+#define LOC_ENTRY_FALLBACK 0x80000000u
+#define LOC_ENTRY_PLURAL 0x40000000u
+
+#define LOC_TEMPLATE_SLOT_SIZE 16
+#define LOC_TEMPLATE_HEADER_SIZE 12
+#define LOC_TEMPLATE_EMPTY_SLOT 0xffffffffffffffffull
+#define LOC_OP_LITERAL 0
+#define LOC_OP_SKIP 1
+#define LOC_OP_ARG 2
+
+/* Everything in a .loc file is little-endian, whatever machine made it */
+static void put_u32(unsigned char *p, uint32_t value) {
+    p[0] = (unsigned char)value;
+    p[1] = (unsigned char)(value >> 8);
+    p[2] = (unsigned char)(value >> 16);
+    p[3] = (unsigned char)(value >> 24);
+}
+
+static void put_u64(unsigned char *p, uint64_t value) {
+    put_u32(p, (uint32_t)value);
+    put_u32(p + 4, (uint32_t)(value >> 32));
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_u64(const unsigned char *p) {
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+/* Offsets and counts are 4 bytes, or 8 with LOC_FLAG_WIDE_OFFSETS */
+static void put_offset(unsigned char *p, size_t value, size_t offset_size) {
+    if(offset_size == 8) {
+        put_u64(p, value);
+    } else {
+        put_u32(p, (uint32_t)value);
+    }
+}
+
+static void put_entry(unsigned char *p, uint64_t hash, uint32_t key_len, uint32_t value_len, size_t offset, size_t entry_size) {
+    put_u32(p, (uint32_t)(hash >> 32));
+    put_u32(p + 4, key_len);
+    put_u32(p + 8, value_len);
+    if(entry_size == LOC_WIDE_ENTRY_SIZE) {
+        put_u32(p + 12, 0);
+        put_u64(p + 16, offset);
+    } else {
+        put_u32(p + 12, (uint32_t)offset);
+    }
+}
+
+typedef struct {
+    uint32_t id;
+    unsigned char *data;
+    stream_file *spill;     // with --mem-limit the strings are in a temporary file, data is NULL then
+    size_t size;
+} section;
+
+static size_t sections_file_size(section *sections, uint32_t section_count) {
+    size_t size = LOC_HEADER_SIZE + section_count * LOC_DIRECTORY_ENTRY_SIZE;
+    for(uint32_t i = 0; i < section_count; i++) {
+        size = ALIGN_UP(size, LOC_SECTION_ALIGNMENT);
+        size += sections[i].size;
+    }
+    return size;
+}
+
+#define LOC_MAX_SECTIONS 9
+
+/* Writes the header, the section directory and the sections */
+static void write_sections(stream_file *output, uint32_t flags, section *sections, uint32_t section_count) {
+    unsigned char header[LOC_HEADER_SIZE + LOC_MAX_SECTIONS * LOC_DIRECTORY_ENTRY_SIZE];
+    loc_memcpy(header, LOC_MAGIC, 4);
+    put_u32(header + 4, LOC_VERSION);
+    put_u32(header + 8, flags);
+    put_u32(header + 12, section_count);
+    put_u64(header + 16, sections_file_size(sections, section_count));
+
+    unsigned char *directory = header + LOC_HEADER_SIZE;
+    size_t output_pos = LOC_HEADER_SIZE + section_count * LOC_DIRECTORY_ENTRY_SIZE;
+    for(uint32_t i = 0; i < section_count; i++) {
+        output_pos = ALIGN_UP(output_pos, LOC_SECTION_ALIGNMENT);
+
+        unsigned char *dir_entry = directory + i * LOC_DIRECTORY_ENTRY_SIZE;
+        put_u32(dir_entry, sections[i].id);
+        put_u32(dir_entry + 4, 0);
+        put_u64(dir_entry + 8, output_pos);
+        put_u64(dir_entry + 16, sections[i].size);
+        output_pos += sections[i].size;
+    }
+
+    size_t start = output->size;
+    stream_write(output, header, LOC_HEADER_SIZE + section_count * LOC_DIRECTORY_ENTRY_SIZE);
+    for(uint32_t i = 0; i < section_count; i++) {
+        stream_pad(output, start, LOC_SECTION_ALIGNMENT);
+        if(sections[i].spill) {
+            stream_copy(output, sections[i].spill);
+        } else {
+            stream_write(output, sections[i].data, sections[i].size);
+        }
+    }
+}
+
+/* Minimal perfect hash (hash and displace, like CHD).
+ * Keys are split into buckets of ~MPH_KEYS_PER_BUCKET keys by the high half of their hash.
+ * Going from the largest bucket to the smallest, we search for a displacement that sends
+ * every key of the bucket to a free slot. The loader recomputes the same slot from the
+ * displacement, so every key is found with one probe. */
+#define MPH_KEYS_PER_BUCKET 4
+#define MPH_MAX_DISPLACEMENT 0x7fffffffu
+#define MPH_NO_SLOT ((size_t)-1)
+
+typedef struct {
+    size_t bucket_count;
+    uint32_t *displacements;
+    size_t slot_count;
+    size_t *row_slots;  // slot of each row, MPH_NO_SLOT for rows that repeat an earlier key
+} mph_table;
+
+static loc_bool mph_build(loc_mem_arena *arena, uint64_t *hashes, key_table *keys, size_t row_count, mph_table *mph) {
+    size_t bucket_count = (row_count + MPH_KEYS_PER_BUCKET - 1) / MPH_KEYS_PER_BUCKET;
+    if(bucket_count == 0) bucket_count = 1;
+
+    mph->bucket_count = bucket_count;
+    mph->displacements = LOC_ARENA_PUSH_ARRAY_ZERO(arena, uint32_t, bucket_count);
+    mph->row_slots = LOC_ARENA_PUSH_ARRAY(arena, size_t, row_count);
+
+    // Sort rows by bucket
+    size_t *bucket_starts = LOC_ARENA_PUSH_ARRAY_ZERO(arena, size_t, bucket_count + 1);
+    size_t *bucket_sizes = LOC_ARENA_PUSH_ARRAY_ZERO(arena, size_t, bucket_count);
+    size_t *bucket_rows = LOC_ARENA_PUSH_ARRAY(arena, size_t, row_count);
+    for(size_t row = 0; row < row_count; row++) {
+        bucket_starts[(hashes[row] >> 32) % bucket_count + 1]++;
+    }
+    for(size_t i = 0; i < bucket_count; i++) {
+        bucket_starts[i + 1] += bucket_starts[i];
+    }
+    for(size_t row = 0; row < row_count; row++) {
+        size_t b = (size_t)((hashes[row] >> 32) % bucket_count);
+        bucket_rows[bucket_starts[b] + bucket_sizes[b]++] = row;
+    }
+
+    // Drop repeated keys, the chained index returns the first one so we do too.
+    // Two different keys with the same 64 bit hash can never be separated.
+    size_t unique_count = 0;
+    size_t max_bucket_size = 0;
+    unsigned char *key_buffer = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, keys->max_len + 1);
+    unsigned char *other_key_buffer = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, keys->max_len + 1);
+    for(size_t b = 0; b < bucket_count; b++) {
+        size_t *rows = bucket_rows + bucket_starts[b];
+        size_t size = 0;
+        for(size_t i = 0; i < bucket_sizes[b]; i++) {
+            loc_bool repeated = loc_false;
+            for(size_t j = 0; j < size; j++) {
+                if(hashes[rows[j]] != hashes[rows[i]]) continue;
+                unsigned char *key = row_key(keys, rows[i], key_buffer);
+                unsigned char *other_key = row_key(keys, rows[j], other_key_buffer);
+                if(loc_strcmp((char *)other_key, (char *)key) != 0) {
+                    printf("Error: keys \"%s\" and \"%s\" have the same hash\n", other_key, key);
+                    return loc_false;
+                }
+                printf("Warning: duplicate key \"%s\" ignored\n", key);
+                repeated = loc_true;
+                break;
+            }
+            if(repeated) {
+                mph->row_slots[rows[i]] = MPH_NO_SLOT;
+            } else {
+                rows[size++] = rows[i];
+            }
+        }
+        bucket_sizes[b] = size;
+        unique_count += size;
+        max_bucket_size = LOC_ARENA_MAX(max_bucket_size, size);
+    }
+    mph->slot_count = unique_count;
+
+    // Order buckets from largest to smallest, big buckets are hard to place once the table fills up
+    size_t *size_starts = LOC_ARENA_PUSH_ARRAY_ZERO(arena, size_t, max_bucket_size + 2);
+    size_t *bucket_order = LOC_ARENA_PUSH_ARRAY(arena, size_t, bucket_count);
+    for(size_t b = 0; b < bucket_count; b++) {
+        size_starts[max_bucket_size - bucket_sizes[b] + 1]++;
+    }
+    for(size_t i = 0; i <= max_bucket_size; i++) {
+        size_starts[i + 1] += size_starts[i];
+    }
+    for(size_t b = 0; b < bucket_count; b++) {
+        bucket_order[size_starts[max_bucket_size - bucket_sizes[b]]++] = b;
+    }
+
+    u8 *taken = LOC_ARENA_PUSH_ARRAY_ZERO(arena, u8, unique_count);
+    size_t *slots = LOC_ARENA_PUSH_ARRAY(arena, size_t, max_bucket_size + 1);
+    for(size_t i = 0; i < bucket_count; i++) {
+        size_t b = bucket_order[i];
+        size_t size = bucket_sizes[b];
+        size_t *rows = bucket_rows + bucket_starts[b];
+        if(size == 0) break;  // Only empty buckets are left
+
+        uint32_t displacement = 0;
+        for(;;) {
+            size_t placed = 0;
+            for(; placed < size; placed++) {
+                size_t slot = mph_slot(hashes[rows[placed]], displacement, unique_count);
+                if(taken[slot]) break;
+
+                loc_bool collides = loc_false;
+                for(size_t j = 0; j < placed; j++) {
+                    if(slots[j] == slot) collides = loc_true;
+                }
+                if(collides) break;
+                slots[placed] = slot;
+            }
+            if(placed == size) break;
+
+            if(displacement == MPH_MAX_DISPLACEMENT) {
+                printf("Error: could not build the perfect hash\n");
+                return loc_false;
+            }
+            displacement++;
+        }
+
+        mph->displacements[b] = displacement;
+        for(size_t j = 0; j < size; j++) {
+            taken[slots[j]] = 1;
+            mph->row_slots[rows[j]] = slots[j];
+        }
+    }
+
+    return loc_true;
+}
+
+/* Flat open addressing table (Swiss table style). Slots come in groups of FLAT_GROUP_SIZE with
+ * one control byte per slot, either FLAT_CTRL_EMPTY or the low 7 bits of the key's hash.
+ * A key goes into the first free slot of the first group on its probe sequence that has one,
+ * so groups fill front to back and the loader can stop at the first empty control byte. */
+#define FLAT_GROUP_SIZE 16
+#define FLAT_CTRL_EMPTY 0x80
+#define FLAT_DEFAULT_LOAD_FACTOR 0.875
+
+typedef struct {
+    size_t capacity;
+    u8 *control;
+    size_t *row_slots;  // slot of each row
+} flat_table;
+
+static void flat_build(loc_mem_arena *arena, uint64_t *hashes, size_t row_count, double load_factor, flat_table *flat) {
+    size_t min_capacity = (size_t)((double)row_count / load_factor) + 1;
+    size_t capacity = FLAT_GROUP_SIZE;
+    while(capacity < min_capacity) {
+        capacity *= 2;
+    }
+
+    flat->capacity = capacity;
+    flat->control = LOC_ARENA_PUSH_ARRAY(arena, u8, capacity);
+    flat->row_slots = LOC_ARENA_PUSH_ARRAY(arena, size_t, row_count);
+    loc_arena_memset(flat->control, FLAT_CTRL_EMPTY, capacity);
+
+    // Same probe sequence as loc.h's loc_get_string_flat
+    size_t group_mask = capacity / FLAT_GROUP_SIZE - 1;
+    for(size_t row = 0; row < row_count; row++) {
+        size_t group = (size_t)(hashes[row] >> 7) & group_mask;
+        size_t probe = 1;
+        for(;;) {
+            u8 *control = flat->control + group * FLAT_GROUP_SIZE;
+            size_t i = 0;
+            while(i < FLAT_GROUP_SIZE && control[i] != FLAT_CTRL_EMPTY) i++;
+            if(i < FLAT_GROUP_SIZE) {
+                control[i] = (u8)(hashes[row] & 0x7f);
+                flat->row_slots[row] = group * FLAT_GROUP_SIZE + i;
+                break;
+            }
+            group = (group + probe++) & group_mask;
+        }
+    }
+}
+
+/* How full the index came out. Every language uses the same index, so it's printed once.
+ * The last bin of a histogram counts everything from there up. */
+#define OCCUPANCY_BINS 9
+
+static void print_histogram(const char *unit, size_t *histogram, size_t total) {
+    for(size_t i = 0; i < OCCUPANCY_BINS; i++) {
+        double share = total ? 100.0 * (double)histogram[i] / (double)total : 0.0;
+        printf("  %2zu%s %-8s %10zu  %5.1f%%\n", i, i == OCCUPANCY_BINS - 1 ? "+" : " ", unit, histogram[i], share);
+    }
+}
+
+/* Buckets by how many entries they hold, a hit walks the bucket up to its key and a miss walks all of it */
+static void print_bucket_occupancy(bucket *buckets, size_t bucket_count, size_t row_count) {
+    size_t histogram[OCCUPANCY_BINS] = {0};
+    size_t longest = 0;
+    double hit_entries = 0.0;
+    for(size_t i = 0; i < bucket_count; i++) {
+        size_t count = buckets[i].count;
+        histogram[LOC_ARENA_MIN(count, OCCUPANCY_BINS - 1)]++;
+        longest = LOC_ARENA_MAX(longest, count);
+        hit_entries += (double)count * (double)(count + 1) / 2.0;
+    }
+
+    printf("Bucket occupancy (%zu keys in %zu buckets):\n", row_count, bucket_count);
+    print_histogram("entries", histogram, bucket_count);
+    printf("  longest chain %zu, a hit looks at %.2f entries on average and a miss at %.2f\n", longest,
+           row_count ? hit_entries / (double)row_count : 0.0, bucket_count ? (double)row_count / (double)bucket_count : 0.0);
+}
+
+/* Keys by how many entries their mph bucket has, big buckets are the ones that need long displacement searches */
+static void print_mph_occupancy(loc_mem_arena *arena, uint64_t *hashes, size_t row_count, mph_table *mph) {
+    size_t histogram[OCCUPANCY_BINS] = {0};
+    loc_arena_temp temp = loc_arena_temp_begin(arena);
+    size_t *bucket_sizes = LOC_ARENA_PUSH_ARRAY_ZERO(arena, size_t, mph->bucket_count);
+    for(size_t row = 0; row < row_count; row++) {
+        if(mph->row_slots[row] != MPH_NO_SLOT) {
+            bucket_sizes[(hashes[row] >> 32) % mph->bucket_count]++;
+        }
+    }
+
+    size_t largest = 0;
+    uint32_t max_displacement = 0;
+    for(size_t b = 0; b < mph->bucket_count; b++) {
+        histogram[LOC_ARENA_MIN(bucket_sizes[b], OCCUPANCY_BINS - 1)]++;
+        largest = LOC_ARENA_MAX(largest, bucket_sizes[b]);
+        max_displacement = LOC_ARENA_MAX(max_displacement, mph->displacements[b]);
+    }
+    loc_arena_temp_end(temp);
+
+    printf("Perfect hash bucket occupancy (%zu keys in %zu buckets, every lookup is one probe):\n", mph->slot_count, mph->bucket_count);
+    print_histogram("keys", histogram, mph->bucket_count);
+    printf("  largest bucket %zu, largest displacement %u\n", largest, max_displacement);
+}
+
+/* Keys by how many groups a lookup scans before it reaches them, following loc.h's probe sequence */
+static void print_flat_occupancy(uint64_t *hashes, size_t row_count, flat_table *flat) {
+    size_t histogram[OCCUPANCY_BINS] = {0};
+    size_t group_mask = flat->capacity / FLAT_GROUP_SIZE - 1;
+    size_t longest = 0;
+    double total_groups = 0.0;
+    for(size_t row = 0; row < row_count; row++) {
+        size_t group = (size_t)(hashes[row] >> 7) & group_mask;
+        size_t groups = 1;
+        while(group != flat->row_slots[row] / FLAT_GROUP_SIZE) {
+            group = (group + groups++) & group_mask;
+        }
+        histogram[LOC_ARENA_MIN(groups, OCCUPANCY_BINS - 1)]++;
+        longest = LOC_ARENA_MAX(longest, groups);
+        total_groups += (double)groups;
+    }
+
+    printf("Flat table occupancy (%zu keys in %zu groups of %d):\n", row_count, flat->capacity / FLAT_GROUP_SIZE, FLAT_GROUP_SIZE);
+    print_histogram("groups", histogram, row_count);
+    printf("  longest probe %zu groups, a hit scans %.2f groups on average\n", longest,
+           row_count ? total_groups / (double)row_count : 0.0);
+}
+
+/* Returns the value of an option given as --name=value or --name value, NULL if argv[*i] isn't that option */
+static const char *option_value(int argc, char **argv, int *i, const char *name) {
+    const char *arg = argv[*i];
+    while(*name && *arg == *name) {
+        arg++;
+        name++;
+    }
+    if(*name) return NULL;
+
+    if(*arg == '=') return arg + 1;
+    if(*arg == '\0' && *i + 1 < argc) return argv[++(*i)];
+    return NULL;
+}
+
+#define KEY_NAME_MAX 48
+
+/* Turns a key into an identifier: "Thank you!" -> THANK_YOU */
+static void key_identifier(char *out, const unsigned char *key, size_t key_len) {
+    size_t len = 0;
+    for(size_t i = 0; i < key_len && len < KEY_NAME_MAX; i++) {
+        unsigned char c = key[i];
+        if((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+            out[len++] = (char)((c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c);
+        } else if(len > 0 && out[len - 1] != '_') {
+            out[len++] = '_';
+        }
+    }
+    while(len > 0 && out[len - 1] == '_') len--;
+    if(len == 0) {
+        loc_memcpy(out, "KEY", 3);
+        len = 3;
+    }
+    out[len] = '\0';
+}
+
+/* Set of identifiers that are already taken, so two keys never end up with the same name */
+typedef struct {
+    char **names;
+    size_t mask;
+} name_set;
+
+static loc_bool name_set_insert(name_set *set, char *name) {
+    string s;
+    s.value = (unsigned char *)name;
+    s.len = loc_strlen(name);
+    size_t i = (size_t)fnv1a_hash64(s) & set->mask;
+    while(set->names[i]) {
+        if(loc_strcmp(set->names[i], name) == 0) return loc_false;
+        i = (i + 1) & set->mask;
+    }
+    set->names[i] = name;
+    return loc_true;
+}
+
+/* Writes a C/C++ header with an id and a precomputed hash for every key:
+ *   LOC_KEY_HELLO    - the key's row, for loc_get_by_id
+ *   LOC_HASH_HELLO   - loc_hash64 of the key, for loc_get_string_hashed */
+static loc_bool write_key_header(loc_mem_arena *arena, const char *header_path, const char *input_path,
+                                 key_table *keys, uint64_t *hashes, size_t row_count) {
+    stream_file text;
+    if(!stream_open(arena, &text, header_path, STREAM_WRITE)) {
+        return loc_false;
+    }
+
+    name_set set;
+    size_t set_size = 16;
+    while(set_size < row_count * 2 + 2) set_size *= 2;
+    set.names = LOC_ARENA_PUSH_ARRAY_ZERO(arena, char*, set_size);
+    set.mask = set_size - 1;
+    name_set_insert(&set, "COUNT");
+
+    // Include guard from the header's file name
+    const char *base = header_path;
+    for(const char *p = header_path; *p; p++) {
+        if(*p == '/' || *p == '\\') base = p + 1;
+    }
+    char guard[KEY_NAME_MAX + 1];
+    key_identifier(guard, (const unsigned char *)base, loc_strlen(base));
+
+    stream_printf(&text, "/* Generated by loc_gen from %s, do not edit.\n", input_path);
+    stream_printf(&text, " * Ids are rows of the input file, they index the id table of every .loc file made in the same run. */\n");
+    stream_printf(&text, "#ifndef %s\n#define %s\n\nenum {\n", guard, guard);
+
+    char **names = LOC_ARENA_PUSH_ARRAY(arena, char*, row_count);
+    unsigned char *key_buffer = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, keys->max_len + 1);
+    for(size_t row = 0; row < row_count; row++) {
+        unsigned char *key = row_key(keys, row, key_buffer);
+        size_t key_len = keys->lens[row];
+
+        char base_name[KEY_NAME_MAX + 1];
+        key_identifier(base_name, key, key_len);
+
+        char *name = LOC_ARENA_PUSH_ARRAY(arena, char, KEY_NAME_MAX + 64);
+        snprintf(name, KEY_NAME_MAX + 64, "%s", base_name);
+        for(unsigned attempt = 0; !name_set_insert(&set, name); attempt++) {
+            if(attempt == 0) {
+                snprintf(name, KEY_NAME_MAX + 64, "%s_%zu", base_name, row);
+            } else {
+                snprintf(name, KEY_NAME_MAX + 64, "%s_%zu_%u", base_name, row, attempt);
+            }
+        }
+        names[row] = name;
+
+        // The key goes in a comment, make sure it can't end it
+        stream_printf(&text, "    LOC_KEY_%s = %zu, /* ", name, row);
+        for(size_t i = 0; i < key_len; i++) {
+            stream_printf(&text, "%c", key[i]);
+            if(key[i] == '*' && i + 1 < key_len && key[i + 1] == '/') {
+                stream_printf(&text, " ");
+            }
+        }
+        stream_printf(&text, " */\n");
+    }
+    stream_printf(&text, "    LOC_KEY_COUNT = %zu\n};\n\n", row_count);
+
+    for(size_t row = 0; row < row_count; row++) {
+        stream_printf(&text, "#define LOC_HASH_%s 0x%016llxull\n", names[row], (unsigned long long)hashes[row]);
+    }
+    stream_printf(&text, "\n#endif /* %s */\n", guard);
+
+    return stream_close(&text);
+}
+
+/* What the index needs to know about every row of one output file */
+typedef struct {
+    size_t count;
+    uint64_t *hashes;
+    uint32_t *key_lens;
+    uint32_t *extras;   // value length, or the row itself in a keys file
+    size_t *offsets;    // where the row's key starts in the strings section
+} index_rows;
+
+/* Appends the index sections for flags to sections. mph, flat or buckets has to be built already. */
+static void append_index_sections(loc_mem_arena *arena, uint32_t flags, mph_table *mph, flat_table *flat,
+                                  bucket *buckets, size_t bucket_count, index_rows *rows,
+                                  size_t offset_size, size_t entry_size, section *sections, uint32_t *section_count) {
+    if(flags & LOC_FLAG_MPH) {
+        // Each slot points at the entry of the row that hashed there
+        unsigned char *slots = LOC_ARENA_PUSH_ARRAY_ZERO(arena, unsigned char, mph->slot_count * entry_size);
+        for(size_t row = 0; row < rows->count; row++) {
+            if(mph->row_slots[row] != MPH_NO_SLOT) {
+                put_entry(slots + mph->row_slots[row] * entry_size, rows->hashes[row], rows->key_lens[row],
+                          rows->extras[row], rows->offsets[row], entry_size);
+            }
+        }
+
+        unsigned char *displacements = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, mph->bucket_count * sizeof(uint32_t));
+        for(size_t i = 0; i < mph->bucket_count; i++) {
+            put_u32(displacements + i * sizeof(uint32_t), mph->displacements[i]);
+        }
+
+        sections[*section_count].id = LOC_SECTION_MPH_DISPLACEMENTS;
+        sections[*section_count].data = displacements;
+        sections[*section_count].size = mph->bucket_count * sizeof(uint32_t);
+        (*section_count)++;
+
+        sections[*section_count].id = LOC_SECTION_MPH_SLOTS;
+        sections[*section_count].data = slots;
+        sections[*section_count].size = mph->slot_count * entry_size;
+        (*section_count)++;
+    } else if(flags & LOC_FLAG_FLAT) {
+        unsigned char *slots = LOC_ARENA_PUSH_ARRAY_ZERO(arena, unsigned char, flat->capacity * entry_size);
+        for(size_t row = 0; row < rows->count; row++) {
+            put_entry(slots + flat->row_slots[row] * entry_size, rows->hashes[row], rows->key_lens[row],
+                      rows->extras[row], rows->offsets[row], entry_size);
+        }
+
+        sections[*section_count].id = LOC_SECTION_FLAT_CONTROL;
+        sections[*section_count].data = flat->control;
+        sections[*section_count].size = flat->capacity;
+        (*section_count)++;
+
+        sections[*section_count].id = LOC_SECTION_FLAT_SLOTS;
+        sections[*section_count].data = slots;
+        sections[*section_count].size = flat->capacity * entry_size;
+        (*section_count)++;
+    } else {
+        size_t bucket_list_size = 0;
+        for(size_t i = 0; i < bucket_count; i++) {
+            bucket_list_size += offset_size + buckets[i].count * entry_size;
+        }
+
+        // Bucket offset table, offsets are relative to the start of the bucket list
+        unsigned char *bucket_offsets = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, bucket_count * offset_size);
+        unsigned char *bucket_list = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, bucket_list_size);
+        size_t bucket_list_pos = 0;
+
+        for(size_t i = 0; i < bucket_count; i++) {
+            bucket *b = &buckets[i];
+            put_offset(bucket_offsets + i * offset_size, bucket_list_pos, offset_size);
+
+            // Write count
+            put_offset(bucket_list + bucket_list_pos, b->count, offset_size);
+            bucket_list_pos += offset_size;
+
+            // Write entries, the fingerprint and lengths let the loader skip most string compares
+            for(size_t j = 0; j < b->count; j++) {
+                size_t r = b->rows[j];
+                put_entry(bucket_list + bucket_list_pos, rows->hashes[r], rows->key_lens[r],
+                          rows->extras[r], rows->offsets[r], entry_size);
+                bucket_list_pos += entry_size;
+            }
+        }
+
+        sections[*section_count].id = LOC_SECTION_BUCKET_OFFSETS;
+        sections[*section_count].data = bucket_offsets;
+        sections[*section_count].size = bucket_count * offset_size;
+        (*section_count)++;
+
+        sections[*section_count].id = LOC_SECTION_BUCKET_LIST;
+        sections[*section_count].data = bucket_list;
+        sections[*section_count].size = bucket_list_size;
+        (*section_count)++;
+    }
+}
+
+/* Compressed string pools (--compress). The strings are cut into blocks of whole entries, about
+ * LOC_BLOCK_SIZE each, and every block is compressed on its own in the LZ4 block format, so the loader
+ * only decompresses the blocks lookups touch. Matches may reach back into a dictionary sampled from the
+ * whole pool, which is what makes small blocks compress nearly as well as big ones.
+ * Offsets in the index and the id table still point into the uncompressed pool. */
+#define LOC_BLOCK_SIZE (4 * 1024)
+#define LOC_DICTIONARY_SIZE (64 * 1024)
+#define LOC_DICTIONARY_SAMPLE 256
+#define LZ4_HASH_BITS 16
+#define LZ4_SEARCH_DEPTH 128
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_NO_POSITION 0xffffffffu
+
+static uint32_t lz4_hash(const unsigned char *p) {
+    return (get_u32(p) * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+static void lz4_put_length(unsigned char *out, size_t *out_pos, size_t length) {
+    while(length >= 255) {
+        out[(*out_pos)++] = 255;
+        length -= 255;
+    }
+    out[(*out_pos)++] = (unsigned char)length;
+}
+
+static void lz4_put_sequence(unsigned char *out, size_t *out_pos, const unsigned char *literals, size_t literal_len,
+                             size_t offset, size_t match_len) {
+    size_t match_code = match_len ? match_len - 4 : 0;
+    out[(*out_pos)++] = (unsigned char)((LOC_ARENA_MIN(literal_len, 15) << 4) | LOC_ARENA_MIN(match_code, 15));
+    if(literal_len >= 15) lz4_put_length(out, out_pos, literal_len - 15);
+    loc_memcpy(out + *out_pos, literals, literal_len);
+    *out_pos += literal_len;
+    if(match_len) {
+        out[(*out_pos)++] = (unsigned char)offset;
+        out[(*out_pos)++] = (unsigned char)(offset >> 8);
+        if(match_code >= 15) lz4_put_length(out, out_pos, match_code - 15);
+    }
+}
+
+/* Adds position pos of src to the match chains: heads is the last position of every hash, chain the one before each position */
+static void lz4_insert(const unsigned char *src, size_t pos, uint32_t *heads, uint32_t *chain) {
+    uint32_t h = lz4_hash(src + pos);
+    chain[pos] = heads[h];
+    heads[h] = (uint32_t)pos;
+}
+
+/* LZ4 of src[start, end), taking the longest of LZ4_SEARCH_DEPTH earlier matches at every position (like lz4 -9,
+ * which compresses text about half again as well as taking the first). Everything before start is history
+ * matches can point into, and the chains have its positions already. Returns the compressed size, out needs
+ * room for lz4_bound of the block. */
+static size_t lz4_compress(const unsigned char *src, size_t start, size_t end, uint32_t *heads, uint32_t *chain, unsigned char *out) {
+    size_t out_pos = 0;
+    size_t anchor = start;
+    size_t pos = start;
+
+    // The format wants the last 5 bytes as literals and no match starting in the last 12
+    if(end - start >= 13) {
+        size_t match_limit = end - 5;
+        size_t last_match = end - 12;
+        while(pos < last_match) {
+            size_t match_len = 0;
+            size_t match_pos = 0;
+            uint32_t candidate = heads[lz4_hash(src + pos)];
+            for(int depth = 0; depth < LZ4_SEARCH_DEPTH && candidate != LZ4_NO_POSITION && pos - candidate <= LZ4_MAX_OFFSET; depth++) {
+                // Only a candidate that beats the best so far at its last byte is worth comparing
+                if(src[candidate + match_len] == src[pos + match_len] && get_u32(src + candidate) == get_u32(src + pos)) {
+                    size_t len = 4;
+                    while(pos + len < match_limit && src[candidate + len] == src[pos + len]) {
+                        len++;
+                    }
+                    if(len > match_len) {
+                        match_len = len;
+                        match_pos = candidate;
+                    }
+                }
+                candidate = chain[candidate];
+            }
+
+            if(match_len < 4) {
+                lz4_insert(src, pos++, heads, chain);
+                continue;
+            }
+            lz4_put_sequence(out, &out_pos, src + anchor, pos - anchor, pos - match_pos, match_len);
+            size_t match_end = pos + match_len;
+            for(; pos < match_end && pos < last_match; pos++) {
+                lz4_insert(src, pos, heads, chain);
+            }
+            pos = anchor = match_end;
+        }
+    }
+
+    lz4_put_sequence(out, &out_pos, src + anchor, end - anchor, 0, 0);
+    return out_pos;
+}
+
+static size_t lz4_bound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+/* Evenly spaced samples of the pool. Translations repeat words, markup and placeholders across the
+ * whole file, a block finds most of what it has in common with the others in here. Small pools get a
+ * smaller dictionary, a quarter of the pool, so it doesn't cost more than it saves. */
+static size_t sample_dictionary(unsigned char *dictionary, const unsigned char *strings, size_t strings_size) {
+    size_t sample_count = LOC_ARENA_MIN(LOC_DICTIONARY_SIZE, strings_size / 4) / LOC_DICTIONARY_SAMPLE;
+    if(sample_count == 0) {
+        return 0;
+    }
+
+    size_t stride = strings_size / sample_count;
+    for(size_t i = 0; i < sample_count; i++) {
+        loc_memcpy(dictionary + i * LOC_DICTIONARY_SAMPLE, strings + i * stride, LOC_DICTIONARY_SAMPLE);
+    }
+    return sample_count * LOC_DICTIONARY_SAMPLE;
+}
+
+/* Replaces the strings section with its compressed blocks, the block table and the dictionary.
+ * starts are where every entry starts (in order), blocks never split one. */
+static void compress_strings(loc_mem_arena *arena, section *sections, uint32_t *section_count, size_t strings_index,
+                             size_t *starts, size_t start_count) {
+    const unsigned char *strings = sections[strings_index].data;
+    size_t strings_size = sections[strings_index].size;
+
+    unsigned char *dictionary = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, LOC_DICTIONARY_SIZE);
+    size_t dictionary_size = sample_dictionary(dictionary, strings, strings_size);
+
+    // Blocks start at entry starts, a block is as many entries as fit in LOC_BLOCK_SIZE (or one bigger entry)
+    size_t *block_starts = LOC_ARENA_PUSH_ARRAY(arena, size_t, start_count + 2);
+    size_t block_count = 0;
+    block_starts[block_count++] = 0;
+    for(size_t i = 0; i < start_count; i++) {
+        size_t entry_end = i + 1 < start_count ? starts[i + 1] : strings_size;
+        size_t block_start = block_starts[block_count - 1];
+        if(entry_end - block_start > LOC_BLOCK_SIZE && starts[i] > block_start) {
+            block_starts[block_count++] = starts[i];
+        }
+    }
+    if(strings_size == 0) block_count = 0;
+    block_starts[block_count] = strings_size;
+
+    // The dictionary goes right before every block, and its positions in the match table
+    size_t largest_block = 0;
+    for(size_t i = 0; i < block_count; i++) {
+        largest_block = LOC_ARENA_MAX(largest_block, block_starts[i + 1] - block_starts[i]);
+    }
+    unsigned char *window = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, dictionary_size + largest_block);
+    loc_memcpy(window, dictionary, dictionary_size);
+    // Blocks only add to the chains after the dictionary, its part of them is the same for every block
+    uint32_t *dictionary_heads = LOC_ARENA_PUSH_ARRAY(arena, uint32_t, (size_t)1 << LZ4_HASH_BITS);
+    uint32_t *heads = LOC_ARENA_PUSH_ARRAY(arena, uint32_t, (size_t)1 << LZ4_HASH_BITS);
+    uint32_t *chain = LOC_ARENA_PUSH_ARRAY(arena, uint32_t, dictionary_size + largest_block);
+    for(size_t i = 0; i < ((size_t)1 << LZ4_HASH_BITS); i++) {
+        dictionary_heads[i] = LZ4_NO_POSITION;
+    }
+    for(size_t pos = 0; pos + 4 <= dictionary_size; pos++) {
+        lz4_insert(window, pos, dictionary_heads, chain);
+    }
+
+    unsigned char *blocks = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, lz4_bound(strings_size) + block_count * 16);
+    unsigned char *block_table = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, (block_count + 1) * 16);
+    size_t blocks_size = 0;
+    for(size_t i = 0; i < block_count; i++) {
+        size_t block_size = block_starts[i + 1] - block_starts[i];
+        loc_memcpy(window + dictionary_size, strings + block_starts[i], block_size);
+        loc_memcpy(heads, dictionary_heads, sizeof(uint32_t) << LZ4_HASH_BITS);
+
+        put_u64(block_table + i * 16, block_starts[i]);
+        put_u64(block_table + i * 16 + 8, blocks_size);
+        blocks_size += lz4_compress(window, dictionary_size, dictionary_size + block_size, heads, chain, blocks + blocks_size);
+    }
+    put_u64(block_table + block_count * 16, strings_size);
+    put_u64(block_table + block_count * 16 + 8, blocks_size);
+
+    sections[strings_index].id = LOC_SECTION_BLOCKS;
+    sections[strings_index].data = blocks;
+    sections[strings_index].size = blocks_size;
+
+    sections[*section_count].id = LOC_SECTION_BLOCK_TABLE;
+    sections[*section_count].data = block_table;
+    sections[*section_count].size = (block_count + 1) * 16;
+    (*section_count)++;
+
+    sections[*section_count].id = LOC_SECTION_DICTIONARY;
+    sections[*section_count].data = dictionary;
+    sections[*section_count].size = dictionary_size;
+    (*section_count)++;
+}
+
+/* 32 bit offsets unless the strings or the bucket list don't fit in them. buckets is NULL without a chained index. */
+static loc_bool needs_wide_offsets(size_t strings_size, bucket *buckets, size_t bucket_count) {
+    size_t bucket_list_size = 0;
+    if(buckets) {
+        for(size_t i = 0; i < bucket_count; i++) {
+            bucket_list_size += 4 + buckets[i].count * LOC_ENTRY_SIZE;
+        }
+    }
+    return strings_size > 0xffffffffu || bucket_list_size > 0xffffffffu;
+}
+
+/* input.txt + ".manifest" -> input.manifest */
+static void make_sibling_path(char *path, const char *input_path, const char *suffix) {
+    const char *dot = input_path;
+    const char *last_dot = NULL;
+    while(*dot) {
+        if(*dot == '.') last_dot = dot;
+        dot++;
+    }
+
+    size_t prefix_len = last_dot ? (size_t)(last_dot - input_path) : loc_strlen(input_path);
+    loc_memcpy(path, input_path, prefix_len);
+    loc_memcpy(path + prefix_len, suffix, loc_strlen(suffix) + 1);
+}
+
+/* input.txt + "fr" -> input.fr.loc */
+static void make_output_path(char *output_path, const char *input_path, const char *name) {
+    char suffix[256];
+    snprintf(suffix, sizeof(suffix), ".%s.loc", name);
+    make_sibling_path(output_path, input_path, suffix);
+}
+
+/* A finished .loc file, written on its own or into the bundle */
+typedef struct {
+    const char *name;
+    uint32_t flags;
+    section sections[LOC_MAX_SECTIONS];
+    uint32_t section_count;
+    size_t size;
+    loc_bool parked;        // written to parked_file already, waiting for the bundle
+    stream_file parked_file;
+    loc_bool failed;
+} output_file;
+
+static output_file make_output(const char *name, uint32_t flags, section *sections, uint32_t section_count) {
+    output_file file;
+    file.name = name;
+    file.flags = flags;
+    file.section_count = section_count;
+    for(uint32_t i = 0; i < section_count; i++) {
+        file.sections[i] = sections[i];
+    }
+    file.size = sections_file_size(sections, section_count);
+    file.parked = loc_false;
+    file.failed = loc_false;
+    return file;
+}
+
+static void write_output(stream_file *output, output_file *file) {
+    if(file->parked) {
+        stream_copy(output, &file->parked_file);
+    } else {
+        write_sections(output, file->flags, file->sections, file->section_count);
+    }
+}
+
+/* Bundle format, see the top of loc.h */
+#define LOC_BUNDLE_MAGIC "LOCB"
+#define LOC_BUNDLE_VERSION 1
+#define LOC_BUNDLE_HEADER_SIZE 24
+#define LOC_BUNDLE_ENTRY_SIZE 32
+#define LOC_BUNDLE_CODE_SIZE 16
+#define LOC_BUNDLE_ALIGNMENT 4096
+#define LOC_BUNDLE_KEYS "keys"
+
+/* Every file of the run in one, each on its own page so it can be mapped and paged in separately */
+static loc_bool write_bundle(loc_mem_arena *arena, const char *output_path, output_file *files, uint32_t file_count) {
+    size_t directory_size = LOC_BUNDLE_HEADER_SIZE + file_count * LOC_BUNDLE_ENTRY_SIZE;
+    size_t total_size = directory_size;
+    for(uint32_t i = 0; i < file_count; i++) {
+        total_size = ALIGN_UP(total_size, LOC_BUNDLE_ALIGNMENT) + files[i].size;
+    }
+
+    unsigned char *directory = LOC_ARENA_PUSH_ARRAY_ZERO(arena, unsigned char, directory_size);
+    loc_memcpy(directory, LOC_BUNDLE_MAGIC, 4);
+    put_u32(directory + 4, LOC_BUNDLE_VERSION);
+    put_u32(directory + 8, file_count);
+    put_u32(directory + 12, 0);
+    put_u64(directory + 16, total_size);
+
+    size_t output_pos = directory_size;
+    for(uint32_t i = 0; i < file_count; i++) {
+        output_pos = ALIGN_UP(output_pos, LOC_BUNDLE_ALIGNMENT);
+
+        unsigned char *entry = directory + LOC_BUNDLE_HEADER_SIZE + i * LOC_BUNDLE_ENTRY_SIZE;
+        loc_memcpy(entry, files[i].name, loc_strlen(files[i].name));
+        put_u64(entry + LOC_BUNDLE_CODE_SIZE, output_pos);
+        put_u64(entry + LOC_BUNDLE_CODE_SIZE + 8, files[i].size);
+        output_pos += files[i].size;
+    }
+
+    stream_file output;
+    loc_bool written = stream_open(arena, &output, output_path, STREAM_WRITE);
+    if(written) {
+        stream_write(&output, directory, directory_size);
+        for(uint32_t i = 0; i < file_count; i++) {
+            stream_pad(&output, 0, LOC_BUNDLE_ALIGNMENT);
+            write_output(&output, &files[i]);
+        }
+        written = stream_close(&output);
+    }
+    if(!written) {
+        printf("Failed to write output file: %s\n", output_path);
+        return loc_false;
+    }
+
+    printf("Successfully created %s (%u files, %zu bytes)\n", output_path, file_count, total_size);
+    return loc_true;
+}
+
+/* Streaming (--mem-limit). The input is read a chunk at a time and every row goes straight to temporary
+ * files: the keys, each language's strings section, and the hashes and lengths the index is built from.
+ * Only the index is built in memory, the strings are copied from their file into the output. */
+#define STREAM_MIN_CHUNK_SIZE ((size_t)1024 * 1024)
+#define STREAM_MAX_CHUNK_SIZE ((size_t)64 * 1024 * 1024)
+#define STREAM_MIN_MEMORY ((size_t)16 * 1024 * 1024)
+
+typedef struct {
+    int language_count;
+    loc_bool shared_keys;
+    unsigned char *row_buffer;      // one unescaped key and value
+    size_t row_count;
+    uint32_t max_key_len;
+    stream_file keys;               // [key\0] per row
+    stream_file hashes;             // uint64_t per row
+    stream_file key_lens;           // uint32_t per row
+    stream_file row_digests;        // uint64_t per row
+    uint64_t lang_digests[32];
+    const int *fallbacks;           // NULL without --fallback
+    stream_file fallback_masks;     // uint32_t per row with --fallback, the languages filled from a fallback
+    stream_file values[32];         // the language's strings section, [key\0value\0] or with shared keys [value\0] per row
+    stream_file value_lens[32];     // uint32_t per row
+} spilled_rows;
+
+/* row_callback, unescapes the row and appends it to the temporary files */
+static void spill_row(void *user, string *fields) {
+    spilled_rows *spilled = (spilled_rows *)user;
+
+    // A filled field is another field of the same row, the row buffer still holds the key and any one value
+    uint32_t fallback_mask = 0;
+    if(spilled->fallbacks) {
+        fallback_mask = resolve_fallbacks(fields, spilled->language_count, spilled->fallbacks);
+        stream_write(&spilled->fallback_masks, &fallback_mask, sizeof(fallback_mask));
+    }
+
+    unsigned char *key = spilled->row_buffer;
+    size_t key_size = 0;
+    unescape_and_copy(key, &key_size, fields[0].value, fields[0].len);
+    key[key_size++] = '\0';
+
+    string key_string;
+    key_string.value = key;
+    key_string.len = key_size - 1;
+    uint64_t hash = fnv1a_hash64(key_string);
+    uint32_t key_len = (uint32_t)key_string.len;
+    spilled->max_key_len = LOC_ARENA_MAX(spilled->max_key_len, key_len);
+
+    stream_write(&spilled->keys, key, key_size);
+    stream_write(&spilled->hashes, &hash, sizeof(hash));
+    stream_write(&spilled->key_lens, &key_len, sizeof(key_len));
+
+    uint64_t row_digest = digest_row(fields, spilled->language_count, spilled->lang_digests, fallback_mask);
+    stream_write(&spilled->row_digests, &row_digest, sizeof(row_digest));
+
+    unsigned char *value = key + key_size;
+    for(int i = 0; i < spilled->language_count; i++) {
+        size_t value_size = 0;
+        unescape_and_copy(value, &value_size, fields[i].value, fields[i].len);
+        value[value_size++] = '\0';
+
+        uint32_t value_len = (uint32_t)(value_size - 1);
+        if(!spilled->shared_keys) {
+            stream_write(&spilled->values[i], key, key_size);
+        }
+        stream_write(&spilled->values[i], value, value_size);
+        stream_write(&spilled->value_lens[i], &value_len, sizeof(value_len));
+    }
+    spilled->row_count++;
+}
+
+/* Reads the input chunk_size bytes at a time and spills every row to temporary files in spill_dir.
+ * The files are done being written when this returns. */
+static loc_bool spill_input(loc_mem_arena *arena, const char *input_path, const char *spill_dir, size_t chunk_size,
+                            spilled_rows *spilled) {
+    stream_file input;
+    if(!stream_open(arena, &input, input_path, STREAM_READ)) {
+        printf("Failed to read file: %s\n", input_path);
+        return loc_false;
+    }
+
+    loc_bool opened = stream_open(arena, &spilled->keys, spill_dir, STREAM_TEMP) &&
+                      stream_open(arena, &spilled->hashes, spill_dir, STREAM_TEMP) &&
+                      stream_open(arena, &spilled->key_lens, spill_dir, STREAM_TEMP) &&
+                      stream_open(arena, &spilled->row_digests, spill_dir, STREAM_TEMP) &&
+                      (!spilled->fallbacks || stream_open(arena, &spilled->fallback_masks, spill_dir, STREAM_TEMP));
+    for(int i = 0; opened && i < spilled->language_count; i++) {
+        opened = stream_open(arena, &spilled->values[i], spill_dir, STREAM_TEMP) &&
+                 stream_open(arena, &spilled->value_lens[i], spill_dir, STREAM_TEMP);
+    }
+    if(!opened) {
+        printf("Failed to create a temporary file in %s\n", spill_dir);
+        return loc_false;
+    }
+
+    // A row has to fit in a chunk, and unescaping never makes it longer
+    unsigned char *chunk = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, chunk_size);
+    spilled->row_buffer = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, chunk_size + 2);
+    spilled->row_count = 0;
+    spilled->max_key_len = 0;
+    for(int i = 0; i < 32; i++) spilled->lang_digests[i] = 0;
+
+    size_t chunk_used = 0;
+    size_t input_pos = 0;
+    for(;;) {
+        size_t wanted = chunk_size - chunk_used;
+        if(wanted == 0) {
+            printf("Error: the row at byte %zu is longer than %zu bytes, raise --mem-limit\n", input_pos - chunk_used, chunk_size);
+            return loc_false;
+        }
+
+        size_t got = stream_read_at(&input, input_pos, chunk + chunk_used, wanted);
+        if(input.failed) {
+            printf("Failed to read file: %s\n", input_path);
+            return loc_false;
+        }
+        input_pos += got;
+        chunk_used += got;
+
+        loc_bool at_end = got < wanted;
+        size_t used = parse_rows(chunk, chunk_used, spilled->language_count, at_end, spill_row, spilled);
+        if(at_end) {
+            break;
+        }
+
+        // The unfinished row moves to the front, loc_memcpy copies front to back so the overlap is fine
+        loc_memcpy(chunk, chunk + used, chunk_used - used);
+        chunk_used -= used;
+    }
+    stream_close(&input);
+
+    loc_bool written = stream_end_writing(&spilled->keys) &&
+                       stream_end_writing(&spilled->hashes) &&
+                       stream_end_writing(&spilled->key_lens) &&
+                       stream_end_writing(&spilled->row_digests) &&
+                       (!spilled->fallbacks || stream_end_writing(&spilled->fallback_masks));
+    for(int i = 0; written && i < spilled->language_count; i++) {
+        written = stream_end_writing(&spilled->values[i]) && stream_end_writing(&spilled->value_lens[i]);
+    }
+    if(!written) {
+        printf("Failed to write a temporary file in %s\n", spill_dir);
+        return loc_false;
+    }
+    return loc_true;
+}
+
+/* Directory the outputs go to, the input's. The temporary files go there too, so they end up on the
+ * same disk and not in a tmpfs that's really memory. */
+static void output_directory(char *directory, const char *input_path) {
+    const char *last_slash = NULL;
+    for(const char *p = input_path; *p; p++) {
+        if(*p == '/' || *p == '\\') last_slash = p;
+    }
+
+    size_t len = last_slash ? LOC_ARENA_MAX((size_t)(last_slash - input_path), 1) : 0;
+    if(len == 0) {
+        loc_memcpy(directory, ".", 2);
+    } else {
+        loc_memcpy(directory, input_path, len);
+        directory[len] = '\0';
+    }
+}
+
+/* 512M, 2G, 65536... 0 if text isn't a size */
+static size_t parse_size(const char *text) {
+    char *end;
+    unsigned long long size = strtoull(text, &end, 10);
+    if(end == text) return 0;
+
+    switch(*end) {
+        case 'k': case 'K': size <<= 10; end++; break;
+        case 'm': case 'M': size <<= 20; end++; break;
+        case 'g': case 'G': size <<= 30; end++; break;
+        default: break;
+    }
+    if(*end == 'b' || *end == 'B') end++;
+    return *end ? 0 : (size_t)size;
+}
+
+/* Incremental builds. Every run leaves input.manifest next to its outputs with the digests of what it built
+ * from, and the next run only rebuilds files whose digests changed (--force rebuilds everything).
+ *   header:    "LOCM", u32 version, u32 language_count, u32 reserved
+ *              u64 settings digest (options, languages, format version), u64 row_count, u64 keys digest
+ *              u64 mph bucket count, u64 mph slot count (0 without --mph)
+ *   languages: language_count x {u64 digest of the language's column, u64 size of its file}
+ *   files:     u64 size of the keys file, the bundle, the header (0 if not written)
+ *   rows:      row_count x u64 digest of the row
+ *   mph:       bucket count x u32 displacement, so the perfect hash doesn't have to be searched again
+ * Numbers are little-endian. */
+#define LOC_MANIFEST_MAGIC "LOCM"
+#define LOC_MANIFEST_VERSION 1
+#define LOC_MANIFEST_HEADER_SIZE 56
+
+typedef struct {
+    uint64_t settings;
+    size_t row_count;
+    uint64_t keys_digest;
+    uint64_t *row_digests;
+    int language_count;
+    uint64_t lang_digests[32];
+    size_t lang_sizes[32];
+    size_t keys_size;
+    size_t bundle_size;
+    size_t header_size;
+    size_t mph_bucket_count;
+    size_t mph_slot_count;
+    uint32_t *mph_displacements;
+} manifest;
+
+/* The last run's manifest, false if there's none or it's damaged */
+static loc_bool read_manifest(loc_mem_arena *arena, const char *path, manifest *m) {
+    size_t size = 0;
+    unsigned char *data = loc_read_entire_file(arena, path, &size);
+    if(!data || size < LOC_MANIFEST_HEADER_SIZE || loc_memcmp(data, LOC_MANIFEST_MAGIC, 4) != 0 ||
+       get_u32(data + 4) != LOC_MANIFEST_VERSION || get_u32(data + 8) > 32) {
+        return loc_false;
+    }
+
+    m->language_count = (int)get_u32(data + 8);
+    m->settings = get_u64(data + 16);
+    m->row_count = (size_t)get_u64(data + 24);
+    m->keys_digest = get_u64(data + 32);
+    m->mph_bucket_count = (size_t)get_u64(data + 40);
+    m->mph_slot_count = (size_t)get_u64(data + 48);
+
+    size_t files_pos = LOC_MANIFEST_HEADER_SIZE + (size_t)m->language_count * 16;
+    size_t rows_pos = files_pos + 24;
+    size_t mph_pos = rows_pos + m->row_count * 8;
+    if(m->row_count > size / 8 || m->mph_bucket_count > size / 4 || mph_pos + m->mph_bucket_count * 4 != size) {
+        return loc_false;
+    }
+
+    for(int i = 0; i < m->language_count; i++) {
+        m->lang_digests[i] = get_u64(data + LOC_MANIFEST_HEADER_SIZE + i * 16);
+        m->lang_sizes[i] = (size_t)get_u64(data + LOC_MANIFEST_HEADER_SIZE + i * 16 + 8);
+    }
+    m->keys_size = (size_t)get_u64(data + files_pos);
+    m->bundle_size = (size_t)get_u64(data + files_pos + 8);
+    m->header_size = (size_t)get_u64(data + files_pos + 16);
+
+    m->row_digests = LOC_ARENA_PUSH_ARRAY(arena, uint64_t, m->row_count);
+    for(size_t row = 0; row < m->row_count; row++) {
+        m->row_digests[row] = get_u64(data + rows_pos + row * 8);
+    }
+    m->mph_displacements = LOC_ARENA_PUSH_ARRAY(arena, uint32_t, m->mph_bucket_count);
+    for(size_t i = 0; i < m->mph_bucket_count; i++) {
+        m->mph_displacements[i] = get_u32(data + mph_pos + i * 4);
+    }
+    return loc_true;
+}
+
+static loc_bool write_manifest(loc_mem_arena *arena, const char *path, manifest *m) {
+    stream_file output;
+    if(!stream_open(arena, &output, path, STREAM_WRITE)) {
+        return loc_false;
+    }
+
+    unsigned char header[LOC_MANIFEST_HEADER_SIZE];
+    loc_memcpy(header, LOC_MANIFEST_MAGIC, 4);
+    put_u32(header + 4, LOC_MANIFEST_VERSION);
+    put_u32(header + 8, (uint32_t)m->language_count);
+    put_u32(header + 12, 0);
+    put_u64(header + 16, m->settings);
+    put_u64(header + 24, m->row_count);
+    put_u64(header + 32, m->keys_digest);
+    put_u64(header + 40, m->mph_bucket_count);
+    put_u64(header + 48, m->mph_slot_count);
+    stream_write(&output, header, sizeof(header));
+
+    unsigned char value[16];
+    for(int i = 0; i < m->language_count; i++) {
+        put_u64(value, m->lang_digests[i]);
+        put_u64(value + 8, m->lang_sizes[i]);
+        stream_write(&output, value, 16);
+    }
+    put_u64(value, m->keys_size);
+    put_u64(value + 8, m->bundle_size);
+    stream_write(&output, value, 16);
+    put_u64(value, m->header_size);
+    stream_write(&output, value, 8);
+
+    for(size_t row = 0; row < m->row_count; row++) {
+        put_u64(value, m->row_digests[row]);
+        stream_write(&output, value, 8);
+    }
+    for(size_t i = 0; i < m->mph_bucket_count; i++) {
+        put_u32(value, m->mph_displacements[i]);
+        stream_write(&output, value, 4);
+    }
+    return stream_close(&output);
+}
+
+/* Everything besides the input that goes into the files: a different option, language list or file format
+ * and nothing from the last run is reused */
+static uint64_t settings_digest(uint32_t flags, loc_bool shared_keys, loc_bool share_suffixes, loc_bool bundle,
+                                double load_factor, const char *input_path, const char *header_path,
+                                char **lang_codes, int language_count) {
+    char settings[256];
+    string text;
+    text.value = (unsigned char *)settings;
+    text.len = (size_t)snprintf(settings, sizeof(settings), "%d %d %u %d %d %d %.17g", LOC_VERSION, LOC_MANIFEST_VERSION,
+                                flags, shared_keys, share_suffixes, bundle, (flags & LOC_FLAG_FLAT) ? load_factor : 0.0);
+    uint64_t digest = fnv1a_hash64(text);
+
+    // The header has the input's name in it, and its include guard comes from its own
+    text.value = (unsigned char *)input_path;
+    text.len = loc_strlen(input_path);
+    digest = digest_add(digest, fnv1a_hash64(text));
+    text.value = (unsigned char *)(header_path ? header_path : "");
+    text.len = loc_strlen((const char *)text.value);
+    digest = digest_add(digest, fnv1a_hash64(text));
+
+    for(int i = 0; i < language_count; i++) {
+        text.value = (unsigned char *)lang_codes[i];
+        text.len = loc_strlen(lang_codes[i]);
+        digest = digest_add(digest, fnv1a_hash64(text));
+    }
+    return digest;
+}
+
+/* A file from the last run can be kept if what it was built from is the same and it's still the size it was */
+static loc_bool can_keep_file(const char *path, size_t previous_size) {
+    return previous_size != 0 && loc_get_file_size(path) == previous_size;
+}
+
+/* Rebuilds the perfect hash of the last run from its displacements, for the same keys in the same order.
+ * The slots come out the same as mph_build's: rows are placed in order, so a repeated key finds its slot
+ * taken by the row it repeats. */
+static void mph_restore(loc_mem_arena *arena, uint64_t *hashes, size_t row_count, manifest *previous, mph_table *mph) {
+    mph->bucket_count = previous->mph_bucket_count;
+    mph->slot_count = previous->mph_slot_count;
+    mph->displacements = previous->mph_displacements;
+    mph->row_slots = LOC_ARENA_PUSH_ARRAY(arena, size_t, row_count);
+
+    u8 *taken = LOC_ARENA_PUSH_ARRAY_ZERO(arena, u8, mph->slot_count);
+    for(size_t row = 0; row < row_count; row++) {
+        size_t b = (size_t)((hashes[row] >> 32) % mph->bucket_count);
+        size_t slot = mph_slot(hashes[row], mph->displacements[b], mph->slot_count);
+        if(taken[slot]) {
+            mph->row_slots[row] = MPH_NO_SLOT;
+        } else {
+            taken[slot] = 1;
+            mph->row_slots[row] = slot;
+        }
+    }
+}
+
+/* Delta patches (--diff). A patch holds the keys whose translation changed between two files of the same
+ * language, and loc_apply_patch puts it in front of the old file. See PATCH FORMAT in loc.h. */
+#define LOC_PATCH_MAGIC "LOCP"
+#define LOC_PATCH_VERSION 1
+#define LOC_PATCH_HEADER_SIZE 48
+#define LOC_PATCH_ENTRY_SIZE 32
+#define LOC_PATCH_IDS 0x1
+#define LOC_PATCH_ENTRY_KEY 0x1
+#define LOC_PATCH_ENTRY_REMOVED 0x2
+#define LOC_PATCH_NO_ID 0xffffffffu
+#define LOC_PATCH_NONE ((size_t)-1)
+
+/* Every row of a .loc file, in id order, pointing into the loaded file */
+typedef struct {
+    size_t row_count;
+    size_t strings_size;
+    string *keys;
+    string *values;
+    uint64_t *hashes;
+    uint32_t *first;       // open addressing table of row + 1, the first row of every key
+    size_t first_mask;
+} loc_rows;
+
+static loc_bool string_equals(string a, string b) {
+    return a.len == b.len && loc_memcmp(a.value, b.value, a.len) == 0;
+}
+
+/* The first row with key, LOC_PATCH_NONE if there's none */
+static size_t loc_rows_find(loc_rows *rows, string key, uint64_t hash) {
+    for(size_t slot = (size_t)hash & rows->first_mask;; slot = (slot + 1) & rows->first_mask) {
+        uint32_t row = rows->first[slot];
+        if(row == 0) {
+            return LOC_PATCH_NONE;
+        }
+        if(rows->hashes[row - 1] == hash && string_equals(rows->keys[row - 1], key)) {
+            return row - 1;
+        }
+    }
+}
+
+/* Reads back a file the generator wrote. Strings hold key and value of every row in id order,
+ * which the id table confirms. Keys and value files (--shared-keys) don't have both and aren't read. */
+static loc_bool read_loc_rows(loc_mem_arena *arena, const char *path, loc_rows *rows) {
+    size_t size = 0;
+    unsigned char *data = loc_read_entire_file(arena, path, &size);
+    if(!data) {
+        printf("Error: couldn't read %s\n", path);
+        return loc_false;
+    }
+    if(size < LOC_HEADER_SIZE || loc_memcmp(data, LOC_MAGIC, 4) != 0 || get_u32(data + 4) != LOC_VERSION ||
+       get_u64(data + 16) != size) {
+        printf("Error: %s isn't a version %d .loc file, make it again with this generator\n", path, LOC_VERSION);
+        return loc_false;
+    }
+    uint32_t flags = get_u32(data + 8);
+    if(flags & LOC_FLAG_COMPRESSED) {
+        printf("Error: %s is compressed, --diff needs files made without --compress\n", path);
+        return loc_false;
+    }
+    if(flags & (LOC_FLAG_KEYS | LOC_FLAG_VALUES)) {
+        printf("Error: %s is a --shared-keys file, patches need files with both keys and values\n", path);
+        return loc_false;
+    }
+    if(flags & LOC_FLAG_PLURALS) {
+        printf("Error: %s has plural forms, --diff needs files made without --plurals\n", path);
+        return loc_false;
+    }
+
+    size_t offset_size = (flags & LOC_FLAG_WIDE_OFFSETS) ? 8 : 4;
+    unsigned char *strings = NULL;
+    unsigned char *ids = NULL;
+    size_t id_count = 0;
+    uint32_t section_count = get_u32(data + 12);
+    for(uint32_t i = 0; i < section_count && LOC_HEADER_SIZE + (size_t)(i + 1) * LOC_DIRECTORY_ENTRY_SIZE <= size; i++) {
+        unsigned char *entry = data + LOC_HEADER_SIZE + (size_t)i * LOC_DIRECTORY_ENTRY_SIZE;
+        uint64_t offset = get_u64(entry + 8);
+        uint64_t section_size = get_u64(entry + 16);
+        if(offset > size || section_size > size - offset) {
+            break;
+        }
+        if(get_u32(entry) == LOC_SECTION_STRINGS) {
+            strings = data + offset;
+            rows->strings_size = (size_t)section_size;
+        } else if(get_u32(entry) == LOC_SECTION_IDS) {
+            ids = data + offset;
+            id_count = (size_t)section_size / offset_size;
+        }
+    }
+    if(!strings || !ids) {
+        printf("Error: %s is damaged\n", path);
+        return loc_false;
+    }
+
+    rows->row_count = id_count;
+    rows->keys = LOC_ARENA_PUSH_ARRAY(arena, string, id_count);
+    rows->values = LOC_ARENA_PUSH_ARRAY(arena, string, id_count);
+    rows->hashes = LOC_ARENA_PUSH_ARRAY(arena, uint64_t, id_count);
+    size_t slot_count = 16;
+    while(slot_count < id_count * 2) slot_count *= 2;
+    rows->first = LOC_ARENA_PUSH_ARRAY_ZERO(arena, uint32_t, slot_count);
+    rows->first_mask = slot_count - 1;
+
+    // Entries are the key and its translation in id order, with --dedup the keys come first and the
+    // translations are wherever the id table says
+    loc_bool dedup = (flags & LOC_FLAG_DEDUP) != 0;
+    size_t pos = 0;
+    for(size_t row = 0; row < id_count; row++) {
+        size_t value_offset = offset_size == 8 ? (size_t)get_u64(ids + row * 8) : get_u32(ids + row * 4);
+        string *fields[2] = { &rows->keys[row], &rows->values[row] };
+        for(int f = 0; f < (dedup ? 1 : 2); f++) {
+            size_t start = pos;
+            while(pos < rows->strings_size && strings[pos]) pos++;
+            if(pos == rows->strings_size) {
+                printf("Error: %s is damaged\n", path);
+                return loc_false;
+            }
+            fields[f]->value = strings + start;
+            fields[f]->len = pos - start;
+            pos++;
+        }
+
+        if(dedup) {
+            size_t end = value_offset;
+            while(end < rows->strings_size && strings[end]) end++;
+            if(end >= rows->strings_size) {
+                printf("Error: %s is damaged\n", path);
+                return loc_false;
+            }
+            rows->values[row].value = strings + value_offset;
+            rows->values[row].len = end - value_offset;
+        } else if(value_offset != (size_t)(rows->values[row].value - strings)) {
+            printf("Error: %s wasn't written by this generator, its strings aren't in id order\n", path);
+            return loc_false;
+        }
+
+        rows->hashes[row] = fnv1a_hash64(rows->keys[row]);
+        if(loc_rows_find(rows, rows->keys[row], rows->hashes[row]) == LOC_PATCH_NONE) {
+            size_t slot = (size_t)rows->hashes[row] & rows->first_mask;
+            while(rows->first[slot]) slot = (slot + 1) & rows->first_mask;
+            rows->first[slot] = (uint32_t)(row + 1);
+        }
+    }
+    return loc_true;
+}
+
+typedef struct {
+    size_t row;       // in the new file, or the old one for a removed key
+    uint32_t id;
+    uint32_t flags;
+} patch_entry;
+
+/* Writes the patch that turns base_path into next_path. Lookups by key follow the first row of every key,
+ * like the indexes do. Every row whose key or translation isn't the base file's at the same row has an id entry,
+ * even when its key only moved there, so the base file's id table answers for every row the patch doesn't have. */
+static loc_bool write_patch(loc_mem_arena *arena, const char *base_path, const char *next_path, const char *patch_path) {
+    loc_rows base = {0};
+    loc_rows next = {0};
+    if(!read_loc_rows(arena, base_path, &base) || !read_loc_rows(arena, next_path, &next)) {
+        return loc_false;
+    }
+    if(next.row_count >= LOC_PATCH_NO_ID) {
+        printf("Error: %s has too many keys for a patch\n", next_path);
+        return loc_false;
+    }
+
+    patch_entry *entries = LOC_ARENA_PUSH_ARRAY(arena, patch_entry, base.row_count + next.row_count);
+    patch_entry *unnumbered = LOC_ARENA_PUSH_ARRAY(arena, patch_entry, base.row_count + next.row_count);
+    size_t entry_count = 0;
+    size_t unnumbered_count = 0;
+    size_t changed = 0, added = 0, removed = 0;
+
+    for(size_t row = 0; row < next.row_count; row++) {
+        uint32_t flags = 0;
+        if(loc_rows_find(&next, next.keys[row], next.hashes[row]) == row) {
+            size_t base_row = loc_rows_find(&base, next.keys[row], next.hashes[row]);
+            if(base_row == LOC_PATCH_NONE) {
+                flags = LOC_PATCH_ENTRY_KEY;
+                added++;
+            } else if(!string_equals(base.values[base_row], next.values[row])) {
+                flags = LOC_PATCH_ENTRY_KEY;
+                changed++;
+            }
+        }
+        loc_bool id_changed = row >= base.row_count || !string_equals(base.keys[row], next.keys[row]) ||
+                              !string_equals(base.values[row], next.values[row]);
+
+        patch_entry entry;
+        entry.row = row;
+        entry.flags = flags;
+        entry.id = id_changed ? (uint32_t)row : LOC_PATCH_NO_ID;
+        if(id_changed) {
+            entries[entry_count++] = entry;
+        } else if(flags) {
+            unnumbered[unnumbered_count++] = entry;
+        }
+    }
+
+    for(size_t row = 0; row < base.row_count; row++) {
+        if(loc_rows_find(&base, base.keys[row], base.hashes[row]) == row &&
+           loc_rows_find(&next, base.keys[row], base.hashes[row]) == LOC_PATCH_NONE) {
+            patch_entry entry;
+            entry.row = row;
+            entry.flags = LOC_PATCH_ENTRY_KEY | LOC_PATCH_ENTRY_REMOVED;
+            entry.id = LOC_PATCH_NO_ID;
+            unnumbered[unnumbered_count++] = entry;
+            removed++;
+        }
+    }
+
+    // Entries with an id first, in id order, then the rest
+    loc_memcpy(entries + entry_count, unnumbered, unnumbered_count * sizeof(patch_entry));
+    entry_count += unnumbered_count;
+
+    size_t slot_count = 16;
+    while(slot_count < entry_count * 2) slot_count *= 2;
+    uint32_t *slots = LOC_ARENA_PUSH_ARRAY_ZERO(arena, uint32_t, slot_count);
+    unsigned char *entry_table = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, entry_count * LOC_PATCH_ENTRY_SIZE);
+    size_t strings_size = 0;
+    for(size_t i = 0; i < entry_count; i++) {
+        loc_rows *rows = (entries[i].flags & LOC_PATCH_ENTRY_REMOVED) ? &base : &next;
+        string key = rows->keys[entries[i].row];
+        size_t value_len = (entries[i].flags & LOC_PATCH_ENTRY_REMOVED) ? 0 : rows->values[entries[i].row].len;
+        uint64_t hash = rows->hashes[entries[i].row];
+
+        unsigned char *entry = entry_table + i * LOC_PATCH_ENTRY_SIZE;
+        put_u64(entry, hash);
+        put_u32(entry + 8, entries[i].id);
+        put_u32(entry + 12, entries[i].flags);
+        put_u32(entry + 16, (uint32_t)key.len);
+        put_u32(entry + 20, (uint32_t)value_len);
+        put_u64(entry + 24, strings_size);
+        strings_size += key.len + value_len + 2;
+
+        if(entries[i].flags & LOC_PATCH_ENTRY_KEY) {
+            size_t slot = (size_t)hash & (slot_count - 1);
+            while(slots[slot]) slot = (slot + 1) & (slot_count - 1);
+            slots[slot] = (uint32_t)(i + 1);
+        }
+    }
+
+    size_t file_size = LOC_PATCH_HEADER_SIZE + entry_count * LOC_PATCH_ENTRY_SIZE + slot_count * sizeof(uint32_t) + strings_size;
+    unsigned char header[LOC_PATCH_HEADER_SIZE];
+    loc_memcpy(header, LOC_PATCH_MAGIC, 4);
+    put_u32(header + 4, LOC_PATCH_VERSION);
+    put_u32(header + 8, LOC_PATCH_IDS);
+    put_u32(header + 12, (uint32_t)entry_count);
+    put_u64(header + 16, file_size);
+    put_u64(header + 24, base.strings_size);
+    put_u32(header + 32, (uint32_t)base.row_count);
+    put_u32(header + 36, (uint32_t)next.row_count);
+    put_u32(header + 40, (uint32_t)slot_count);
+    put_u32(header + 44, 0);
+
+    stream_file output;
+    if(!stream_open(arena, &output, patch_path, STREAM_WRITE)) {
+        printf("Failed to write patch: %s\n", patch_path);
+        return loc_false;
+    }
+    stream_write(&output, header, sizeof(header));
+    stream_write(&output, entry_table, entry_count * LOC_PATCH_ENTRY_SIZE);
+    for(size_t slot = 0; slot < slot_count; slot++) {
+        unsigned char value[4];
+        put_u32(value, slots[slot]);
+        stream_write(&output, value, 4);
+    }
+    for(size_t i = 0; i < entry_count; i++) {
+        loc_rows *rows = (entries[i].flags & LOC_PATCH_ENTRY_REMOVED) ? &base : &next;
+        string key = rows->keys[entries[i].row];
+        stream_write(&output, key.value, key.len + 1);
+        if(entries[i].flags & LOC_PATCH_ENTRY_REMOVED) {
+            stream_write(&output, "", 1);
+        } else {
+            stream_write(&output, rows->values[entries[i].row].value, rows->values[entries[i].row].len + 1);
+        }
+    }
+    if(!stream_close(&output)) {
+        printf("Failed to write patch: %s\n", patch_path);
+        return loc_false;
+    }
+
+    printf("Successfully created %s (%zu changed, %zu added, %zu removed, %zu bytes)\n", patch_path, changed, added, removed, file_size);
+    return loc_true;
+}
+
+/* Everything the language jobs share, read only while they run */
+typedef struct {
+    uint32_t flags;
+    loc_bool shared_keys;
+    loc_bool bundle;
+    const char *input_path;
+    const char *spill_dir;
+    char **lang_codes;
+    size_t *lang_sizes;
+    int language_count;
+    mph_table *mph;
+    flat_table *flat;
+    bucket *buckets;
+    size_t bucket_count;
+    size_t row_count;
+    uint64_t *row_hashes;
+    uint32_t *row_key_lens;
+    size_t *row_key_offsets;
+    unsigned char *key_pool;  // every key (null-terminated) in row order, --dedup files start with it
+    size_t key_pool_size;
+    loc_bool share_suffixes;
+    string *row_values;     // language_count strings per row, one row after the other
+    uint32_t *fallback_masks;  // per row the languages filled from a fallback (bit lang), NULL without --fallback
+    plural_language *plurals;  // every language's rules and u8 per row, 1 for a plural row, NULL without --plurals
+    u8 *plural_rows;
+    spilled_rows *spilled;  // instead of row_values with --mem-limit, every job only touches its languages' files
+    loc_bool *unchanged;    // languages whose file from the last run is still right
+    manifest *previous;
+    output_file *outputs;   // one per language, every job only touches its own
+} build_context;
+
+/* One thread's share: languages first_language, first_language + stride, ... */
+typedef struct {
+    build_context *context;
+    loc_mem_arena *arena;
+    int first_language;
+    int stride;
+} language_job;
+
+static loc_bool write_output_file(build_context *context, loc_mem_arena *arena, output_file *file) {
+    char output_path[512];
+    make_output_path(output_path, context->input_path, file->name);
+
+    stream_file output;
+    loc_bool written = stream_open(arena, &output, output_path, STREAM_WRITE);
+    if(written) {
+        write_output(&output, file);
+        written = stream_close(&output);
+    }
+    if(!written) {
+        printf("Failed to write output file: %s\n", output_path);
+        file->failed = loc_true;
+        return loc_false;
+    }
+    printf("Successfully created %s (%zu strings, %zu bytes)\n", output_path, context->row_count, file->size);
+    return loc_true;
+}
+
+/* With --mem-limit a bundled file can't wait in memory for the rest of the bundle, it waits in a temporary file */
+static loc_bool park_output_file(build_context *context, loc_mem_arena *arena, output_file *file) {
+    loc_bool written = stream_open(arena, &file->parked_file, context->spill_dir, STREAM_TEMP);
+    if(written) {
+        write_sections(&file->parked_file, file->flags, file->sections, file->section_count);
+        written = stream_end_writing(&file->parked_file);
+        file->parked = loc_true;
+    }
+    if(!written) {
+        printf("Failed to write a temporary file in %s\n", context->spill_dir);
+        file->failed = loc_true;
+    }
+    return written;
+}
+
+/* Unescapes one language's column into its string pool */
+static void build_language_strings(build_context *context, loc_mem_arena *arena, int lang_idx, section *strings,
+                                   size_t *row_offsets, uint32_t *value_lens) {
+    unsigned char *data = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, context->lang_sizes[lang_idx]);
+    size_t strings_size = 0;
+
+    for(size_t row = 0; row < context->row_count; row++) {
+        row_offsets[row] = strings_size;
+
+        // Storage format: [english_key:null-terminated][localized_string:null-terminated]
+        // Write English key first (for verification), unless the keys are in their own file
+        string *row_strings = &context->row_values[row * context->language_count];
+        loc_bool plural = context->plural_rows && context->plural_rows[row];
+        if(!context->shared_keys) {
+            string key = plural ? plural_row_key(row_strings[0]) : row_strings[0];
+            unescape_and_copy(data, &strings_size, key.value, key.len);
+            data[strings_size++] = '\0';
+        }
+
+        // Then write localized string, a plural row's forms one after the other
+        size_t value_start = strings_size;
+        if(plural) {
+            unescape_plural_forms(data, &strings_size, row_strings[lang_idx], &context->plurals[lang_idx]);
+        } else {
+            unescape_and_copy(data, &strings_size, row_strings[lang_idx].value, row_strings[lang_idx].len);
+        }
+        value_lens[row] = (uint32_t)(strings_size - value_start);
+        data[strings_size++] = '\0';
+    }
+
+    strings->data = data;
+    strings->size = strings_size;
+}
+
+/* A distinct translation of --dedup. With --share-suffixes it may be the end of a longer one, it's then
+ * written as part of its owner, skip bytes in. */
+typedef struct {
+    string value;
+    uint32_t owner;
+    size_t skip;
+    size_t offset;  // where it went in the strings if it's an owner, DEDUP_NOT_PLACED until then
+    loc_bool used;  // some row has it, keys are interned too
+} interned_value;
+
+#define DEDUP_NOT_PLACED SIZE_MAX
+
+/* Orders translations by their bytes from the end, so a translation comes right before the ones it's the end of */
+static int compare_reversed(const void *a, const void *b) {
+    const string *x = &(*(const interned_value *const *)a)->value;
+    const string *y = &(*(const interned_value *const *)b)->value;
+    size_t i = x->len;
+    size_t j = y->len;
+    while(i && j) {
+        unsigned char cx = x->value[--i];
+        unsigned char cy = y->value[--j];
+        if(cx != cy) return cx < cy ? -1 : 1;
+    }
+    return (i > 0) - (j > 0);
+}
+
+/* --dedup: the keys, then every distinct translation once, in the order rows first use them, so a row's key and
+ * translation still tend to be close. Rows with the same translation point at the same copy, a translation
+ * that's the same as a key (all of them in the source language) points at the key, and with --share-suffixes
+ * a translation that's the end of another one ("Cancel" in "Press Cancel") points into it.
+ * Fills where every row's key is (its translation without keys), where its translation is, and where strings
+ * start (blocks of --compress are only cut there). */
+static void build_deduped_strings(build_context *context, loc_mem_arena *arena, int lang_idx, section *strings,
+                                  size_t *row_offsets, size_t *value_offsets, size_t *starts, size_t *start_count) {
+    size_t row_count = context->row_count;
+    unsigned char *data = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, context->lang_sizes[lang_idx]);
+    size_t strings_size = 0;
+    *start_count = 0;
+
+    if(!context->shared_keys) {
+        loc_memcpy(data, context->key_pool, context->key_pool_size);
+        strings_size = context->key_pool_size;
+        for(size_t row = 0; row < row_count; row++) {
+            row_offsets[row] = context->row_key_offsets[row];
+            starts[(*start_count)++] = row_offsets[row];
+        }
+    }
+    size_t undeduped_size = strings_size;
+
+    // Intern the keys, they're in the strings already, then every row's translation, unescaped into scratch
+    // space that's gone once they're written
+    loc_arena_temp temp = loc_arena_temp_begin(arena);
+    unsigned char *scratch = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, context->lang_sizes[lang_idx]);
+    size_t key_count = context->shared_keys ? 0 : row_count;
+    interned_value *values = LOC_ARENA_PUSH_ARRAY(arena, interned_value, key_count + row_count);
+    uint32_t *row_value = LOC_ARENA_PUSH_ARRAY(arena, uint32_t, row_count);
+    size_t slot_count = 16;
+    while(slot_count < (key_count + row_count) * 2) slot_count *= 2;
+    uint32_t *slots = LOC_ARENA_PUSH_ARRAY_ZERO(arena, uint32_t, slot_count);
+    size_t value_count = 0;
+    size_t distinct_count = 0;
+    size_t scratch_size = 0;
+
+    for(size_t i = 0; i < key_count + row_count; i++) {
+        string value;
+        if(i < key_count) {
+            value.value = data + row_offsets[i];
+            value.len = context->row_key_lens[i];
+        } else {
+            size_t row = i - key_count;
+            string *field = &context->row_values[row * context->language_count + lang_idx];
+            value.value = scratch + scratch_size;
+            if(context->plural_rows && context->plural_rows[row]) {
+                unescape_plural_forms(scratch, &scratch_size, *field, &context->plurals[lang_idx]);
+            } else {
+                unescape_and_copy(scratch, &scratch_size, field->value, field->len);
+            }
+            value.len = (size_t)(scratch + scratch_size - value.value);
+            undeduped_size += value.len + 1;
+        }
+
+        size_t slot = (size_t)fnv1a_hash64(value) & (slot_count - 1);
+        while(slots[slot] && !string_equals(values[slots[slot] - 1].value, value)) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        if(!slots[slot]) {
+            values[value_count].value = value;
+            values[value_count].owner = (uint32_t)value_count;
+            values[value_count].skip = 0;
+            values[value_count].offset = i < key_count ? row_offsets[i] : DEDUP_NOT_PLACED;
+            values[value_count].used = loc_false;
+            slots[slot] = (uint32_t)++value_count;
+        } else if(i >= key_count) {
+            scratch_size -= value.len;  // Seen it already, the next one can go here
+        }
+
+        if(i >= key_count) {
+            interned_value *interned = &values[slots[slot] - 1];
+            distinct_count += !interned->used;
+            interned->used = loc_true;
+            row_value[i - key_count] = slots[slot] - 1;
+        }
+    }
+
+    // Sorted by their ends, a translation that's the end of others is right before one of them.
+    // Going backwards every translation after it already knows its owner.
+    size_t suffix_count = 0;
+    if(context->share_suffixes && value_count > 1) {
+        interned_value **order = LOC_ARENA_PUSH_ARRAY(arena, interned_value *, value_count);
+        for(size_t i = 0; i < value_count; i++) {
+            order[i] = &values[i];
+        }
+        qsort(order, value_count, sizeof(interned_value *), compare_reversed);
+
+        for(size_t i = value_count - 1; i-- > 0;) {
+            interned_value *shorter = order[i];
+            interned_value *longer = order[i + 1];
+            size_t tail = longer->value.len - shorter->value.len;
+            // Keys stay where they are, there's nothing to save by moving them
+            if(shorter->offset == DEDUP_NOT_PLACED && shorter->value.len <= longer->value.len &&
+               loc_memcmp(shorter->value.value, longer->value.value + tail, shorter->value.len) == 0) {
+                shorter->owner = longer->owner;
+                shorter->skip = longer->skip + tail;
+                suffix_count++;
+            }
+        }
+    }
+
+    for(size_t row = 0; row < row_count; row++) {
+        interned_value *value = &values[row_value[row]];
+        interned_value *owner = &values[value->owner];
+        if(owner->offset == DEDUP_NOT_PLACED) {
+            owner->offset = strings_size;
+            starts[(*start_count)++] = strings_size;
+            loc_memcpy(data + strings_size, owner->value.value, owner->value.len);
+            strings_size += owner->value.len;
+            data[strings_size++] = '\0';
+        }
+        value_offsets[row] = owner->offset + value->skip;
+        if(context->shared_keys) {
+            row_offsets[row] = value_offsets[row];
+        }
+    }
+    loc_arena_temp_end(temp);
+
+    printf("Deduplicated %s: %zu distinct translations in %zu rows", context->lang_codes[lang_idx], distinct_count, row_count);
+    if(context->share_suffixes) {
+        printf(" (%zu of them the end of another)", suffix_count);
+    }
+    printf(", strings %zu -> %zu bytes\n", undeduped_size, strings_size);
+
+    strings->data = data;
+    strings->size = strings_size;
+}
+
+/* The string pool was spilled while reading the input, only the lengths come back into memory */
+static loc_bool load_spilled_language(build_context *context, int lang_idx, section *strings,
+                                      size_t *row_offsets, uint32_t *value_lens) {
+    stream_file *lens = &context->spilled->value_lens[lang_idx];
+    size_t lens_size = context->row_count * sizeof(uint32_t);
+    loc_bool read = stream_read_at(lens, 0, value_lens, lens_size) == lens_size;
+    stream_close(lens);
+    if(!read) {
+        printf("Failed to read a temporary file in %s\n", context->spill_dir);
+        return loc_false;
+    }
+
+    size_t key_skip = context->shared_keys ? 0 : 1;
+    size_t strings_size = 0;
+    for(size_t row = 0; row < context->row_count; row++) {
+        row_offsets[row] = strings_size;
+        strings_size += key_skip * (context->row_key_lens[row] + 1) + value_lens[row] + 1;
+    }
+
+    strings->spill = &context->spilled->values[lang_idx];
+    strings->size = strings_size;
+    return loc_true;
+}
+
+/* --templates: the placeholders of every translation are parsed here once, into ops loc_format runs without
+ * looking at the braces again. {0}..{9999} is that argument, {{ and }} are a brace, and {name} gets the number of
+ * the name in its row: names are numbered in the order they first appear reading the row from the key on, so a
+ * translation that puts them in another order still gets the arguments the key has there. Anything else in braces
+ * is text. The rules have to stay the same as loc_format_scan's in loc.h. */
+#define TEMPLATE_MAX_NAME 64
+#define TEMPLATE_MAX_NAMES 64
+
+typedef struct {
+    string names[TEMPLATE_MAX_NAMES];
+    int count;
+} placeholder_names;
+
+static loc_bool is_name_char(unsigned char c, loc_bool first) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || (!first && c >= '0' && c <= '9');
+}
+
+/* Length of the placeholder at p (a '{'), 0 if there's none. *number is its number for {0}..{9999}, -1 for a {name}. */
+static size_t template_placeholder(const unsigned char *p, const unsigned char *end, long *number, string *name) {
+    const unsigned char *q = p + 1;
+    *number = 0;
+    if(q < end && *q >= '0' && *q <= '9') {
+        while(q < end && *q >= '0' && *q <= '9' && q - p <= 4) {
+            *number = *number * 10 + (*q++ - '0');
+        }
+        return q < end && *q == '}' ? (size_t)(q + 1 - p) : 0;
+    }
+
+    while(q < end && is_name_char(*q, q == p + 1) && q - p <= TEMPLATE_MAX_NAME) {
+        q++;
+    }
+    if(q == p + 1 || q >= end || *q != '}') {
+        return 0;
+    }
+    *number = -1;
+    name->value = (unsigned char *)p + 1;
+    name->len = (size_t)(q - p - 1);
+    return (size_t)(q + 1 - p);
+}
+
+static long placeholder_number(placeholder_names *names, string name) {
+    for(int i = 0; i < names->count; i++) {
+        if(string_equals(names->names[i], name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* The names in a row, in the order they first appear. The fields are still escaped, which only doubles '|'. */
+static void collect_placeholder_names(string *fields, int language_count, placeholder_names *names) {
+    names->count = 0;
+    for(int lang = 0; lang < language_count; lang++) {
+        const unsigned char *p = fields[lang].value;
+        const unsigned char *end = p + fields[lang].len;
+        while(p < end) {
+            long number;
+            string name;
+            size_t size;
+            if(p + 1 < end && ((p[0] == '{' && p[1] == '{') || (p[0] == '}' && p[1] == '}'))) {
+                p += 2;
+            } else if(p[0] == '{' && (size = template_placeholder(p, end, &number, &name)) != 0) {
+                if(number < 0 && names->count < TEMPLATE_MAX_NAMES && placeholder_number(names, name) < 0) {
+                    names->names[names->count++] = name;
+                }
+                p += size;
+            } else {
+                p++;
+            }
+        }
+    }
+}
+
+static void put_op(uint32_t *ops, size_t *op_count, uint32_t kind, size_t n) {
+    ops[(*op_count)++] = (uint32_t)(n << 2) | kind;
+}
+
+/* Compiles a translation into ops (room for value.len + 1 of them), returns how many, 0 if it has no placeholders
+ * or escaped braces and loc_format only has to copy it */
+static size_t compile_template(string value, placeholder_names *names, uint32_t *ops, uint32_t *literal_len) {
+    const unsigned char *p = value.value;
+    const unsigned char *end = p + value.len;
+    const unsigned char *run = p;
+    size_t op_count = 0;
+    size_t literal = 0;
+    while(p < end) {
+        long number;
+        string name;
+        size_t size;
+        if(p + 1 < end && ((p[0] == '{' && p[1] == '{') || (p[0] == '}' && p[1] == '}'))) {
+            // The first brace goes with the text before it
+            put_op(ops, &op_count, LOC_OP_LITERAL, (size_t)(p + 1 - run));
+            put_op(ops, &op_count, LOC_OP_SKIP, 1);
+            literal += (size_t)(p + 1 - run);
+            p += 2;
+            run = p;
+        } else if(p[0] == '{' && (size = template_placeholder(p, end, &number, &name)) != 0 &&
+                  (number >= 0 || (number = placeholder_number(names, name)) >= 0)) {
+            if(p > run) {
+                put_op(ops, &op_count, LOC_OP_LITERAL, (size_t)(p - run));
+                literal += (size_t)(p - run);
+            }
+            ops[op_count++] = ((uint32_t)size << 18) | ((uint32_t)number << 2) | LOC_OP_ARG;
+            p += size;
+            run = p;
+        } else {
+            p++;
+        }
+    }
+    if(!op_count) {
+        return 0;
+    }
+    if(end > run) {
+        put_op(ops, &op_count, LOC_OP_LITERAL, (size_t)(end - run));
+        literal += (size_t)(end - run);
+    }
+    *literal_len = (uint32_t)literal;
+    return op_count;
+}
+
+/* Compiles the templates of a language's translations and appends their sections. value_offsets is where every
+ * row's translation is in the strings, rows sharing one (--dedup) share its template: it's compiled with the first
+ * row's names, a later row that numbers them differently is counted in *conflicts. */
+static void append_template_sections(build_context *context, loc_mem_arena *arena, int lang_idx, const unsigned char *strings,
+                                     const size_t *value_offsets, section *sections, uint32_t *section_count, size_t *conflicts) {
+    size_t row_count = context->row_count;
+    *conflicts = 0;
+
+    // Only translations with a brace can have a template, they bound the sections' size
+    u8 *braces = LOC_ARENA_PUSH_ARRAY_ZERO(arena, u8, row_count);
+    size_t candidate_count = 0;
+    size_t templates_bound = 0;
+    size_t longest = 0;
+    for(size_t row = 0; row < row_count; row++) {
+        const unsigned char *value = strings + value_offsets[row];
+        size_t len = 0;
+        for(; value[len]; len++) {
+            braces[row] |= value[len] == '{' || value[len] == '}';
+        }
+        if(braces[row]) {
+            candidate_count++;
+            templates_bound += LOC_TEMPLATE_HEADER_SIZE + (len + 1) * 4;
+            longest = LOC_ARENA_MAX(longest, len);
+        }
+    }
+    if(!candidate_count) {
+        return;
+    }
+
+    // Rows sharing a translation are found through these slots too, the file's are only as many as the templates need
+    size_t slot_count = 16;
+    while(slot_count < candidate_count * 2) slot_count *= 2;
+    unsigned char *slots = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, slot_count * LOC_TEMPLATE_SLOT_SIZE);
+    loc_arena_memset(slots, 0xff, slot_count * LOC_TEMPLATE_SLOT_SIZE);
+    unsigned char *templates = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, templates_bound);
+    size_t templates_size = 0;
+    size_t template_count = 0;
+
+    loc_arena_temp temp = loc_arena_temp_begin(arena);
+    uint32_t *ops = LOC_ARENA_PUSH_ARRAY(arena, uint32_t, longest + 1);
+    placeholder_names *names = LOC_ARENA_PUSH_STRUCT(arena, placeholder_names);
+    for(size_t row = 0; row < row_count; row++) {
+        if(!braces[row]) {
+            continue;
+        }
+        string value;
+        value.value = (unsigned char *)strings + value_offsets[row];
+        value.len = loc_strlen((const char *)value.value);
+
+        size_t slot = (size_t)mix64(value_offsets[row]) & (slot_count - 1);
+        unsigned char *entry = slots + slot * LOC_TEMPLATE_SLOT_SIZE;
+        while(get_u64(entry) != LOC_TEMPLATE_EMPTY_SLOT && get_u64(entry) != value_offsets[row]) {
+            slot = (slot + 1) & (slot_count - 1);
+            entry = slots + slot * LOC_TEMPLATE_SLOT_SIZE;
+        }
+        loc_bool repeat = get_u64(entry) == value_offsets[row];
+
+        collect_placeholder_names(&context->row_values[row * context->language_count], context->language_count, names);
+        uint32_t literal_len = 0;
+        size_t op_count = compile_template(value, names, ops, &literal_len);
+        if(repeat) {
+            const unsigned char *first = templates + (size_t)get_u64(entry + 8);
+            loc_bool same = get_u32(first + 8) == op_count;
+            for(size_t i = 0; same && i < op_count; i++) {
+                same = get_u32(first + LOC_TEMPLATE_HEADER_SIZE + i * 4) == ops[i];
+            }
+            *conflicts += !same;
+            continue;
+        }
+        if(!op_count) {
+            continue;
+        }
+
+        put_u64(entry, value_offsets[row]);
+        put_u64(entry + 8, templates_size);
+        put_u32(templates + templates_size, (uint32_t)value.len);
+        put_u32(templates + templates_size + 4, literal_len);
+        put_u32(templates + templates_size + 8, (uint32_t)op_count);
+        templates_size += LOC_TEMPLATE_HEADER_SIZE;
+        for(size_t i = 0; i < op_count; i++) {
+            put_u32(templates + templates_size, ops[i]);
+            templates_size += 4;
+        }
+        template_count++;
+    }
+    loc_arena_temp_end(temp);
+
+    if(!template_count) {
+        return;
+    }
+
+    size_t file_slot_count = 16;
+    while(file_slot_count < template_count * 2) file_slot_count *= 2;
+    unsigned char *file_slots = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, file_slot_count * LOC_TEMPLATE_SLOT_SIZE);
+    loc_arena_memset(file_slots, 0xff, file_slot_count * LOC_TEMPLATE_SLOT_SIZE);
+    for(size_t i = 0; i < slot_count; i++) {
+        const unsigned char *entry = slots + i * LOC_TEMPLATE_SLOT_SIZE;
+        uint64_t value_offset = get_u64(entry);
+        if(value_offset == LOC_TEMPLATE_EMPTY_SLOT) {
+            continue;
+        }
+        size_t slot = (size_t)mix64(value_offset) & (file_slot_count - 1);
+        while(get_u64(file_slots + slot * LOC_TEMPLATE_SLOT_SIZE) != LOC_TEMPLATE_EMPTY_SLOT) {
+            slot = (slot + 1) & (file_slot_count - 1);
+        }
+        loc_memcpy(file_slots + slot * LOC_TEMPLATE_SLOT_SIZE, entry, LOC_TEMPLATE_SLOT_SIZE);
+    }
+
+    sections[*section_count].id = LOC_SECTION_TEMPLATE_SLOTS;
+    sections[*section_count].data = file_slots;
+    sections[*section_count].size = file_slot_count * LOC_TEMPLATE_SLOT_SIZE;
+    (*section_count)++;
+    sections[*section_count].id = LOC_SECTION_TEMPLATES;
+    sections[*section_count].data = templates;
+    sections[*section_count].size = templates_size;
+    (*section_count)++;
+    printf("%s: %zu strings with placeholders, templates %zu bytes\n", context->lang_codes[lang_idx], template_count,
+           sections[*section_count - 2].size + templates_size);
+}
+
+/* A language's plural rules, the loader picks a plural row's form with them */
+static void append_plural_rules_section(loc_mem_arena *arena, plural_language *language, section *sections, uint32_t *section_count) {
+    size_t size = 8 + PLURAL_TABLE_SIZE + language->word_count * 4;
+    unsigned char *rules = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, size);
+    put_u32(rules, (uint32_t)language->form_count);
+    put_u32(rules + 4, PLURAL_TABLE_SIZE);
+    loc_memcpy(rules + 8, language->table, PLURAL_TABLE_SIZE);
+    for(size_t i = 0; i < language->word_count; i++) {
+        put_u32(rules + 8 + PLURAL_TABLE_SIZE + i * 4, language->words[i]);
+    }
+
+    sections[*section_count].id = LOC_SECTION_PLURAL_RULES;
+    sections[*section_count].data = rules;
+    sections[*section_count].size = size;
+    (*section_count)++;
+}
+
+/* Builds one language's file around its string pool */
+static output_file build_language(build_context *context, loc_mem_arena *arena, int lang_idx) {
+    size_t row_count = context->row_count;
+
+    section sections[LOC_MAX_SECTIONS] = {0};
+    uint32_t section_count = 0;
+
+    // Where each row's entry starts in the strings, and how long its translation is
+    size_t *row_offsets = LOC_ARENA_PUSH_ARRAY(arena, size_t, row_count);
+    uint32_t *value_lens = LOC_ARENA_PUSH_ARRAY(arena, uint32_t, row_count);
+
+    // --dedup keeps translations apart from their keys, entries carry the row instead of the translation's length
+    loc_bool dedup = (context->flags & LOC_FLAG_DEDUP) != 0;
+    size_t *value_offsets = NULL;
+    uint32_t *row_ids = NULL;
+    size_t *starts = row_offsets;
+    size_t start_count = row_count;
+
+    sections[section_count].id = LOC_SECTION_STRINGS;
+    if(dedup) {
+        value_offsets = LOC_ARENA_PUSH_ARRAY(arena, size_t, row_count);
+        starts = LOC_ARENA_PUSH_ARRAY(arena, size_t, row_count * 2);
+        row_ids = LOC_ARENA_PUSH_ARRAY(arena, uint32_t, row_count);
+        for(size_t row = 0; row < row_count; row++) {
+            row_ids[row] = (uint32_t)row;
+        }
+        build_deduped_strings(context, arena, lang_idx, &sections[section_count], row_offsets, value_offsets, starts, &start_count);
+    } else if(context->spilled) {
+        if(!load_spilled_language(context, lang_idx, &sections[section_count], row_offsets, value_lens)) {
+            output_file failed = make_output(context->lang_codes[lang_idx], 0, sections, 0);
+            failed.failed = loc_true;
+            return failed;
+        }
+    } else {
+        build_language_strings(context, arena, lang_idx, &sections[section_count], row_offsets, value_lens);
+    }
+    size_t strings_size = sections[section_count].size;
+    section_count++;
+
+    loc_bool wide = needs_wide_offsets(strings_size, context->shared_keys ? NULL : context->buckets, context->bucket_count);
+    size_t offset_size = wide ? 8 : 4;
+    size_t entry_size = wide ? LOC_WIDE_ENTRY_SIZE : LOC_ENTRY_SIZE;
+    loc_bool templates = (context->flags & LOC_FLAG_TEMPLATES) != 0;
+    uint32_t file_flags = context->shared_keys ? LOC_FLAG_VALUES | (context->flags & LOC_FLAG_TEMPLATES) : context->flags;
+    file_flags |= wide ? LOC_FLAG_WIDE_OFFSETS : 0;
+
+    // Id table, row -> localized string
+    size_t value_skip = context->shared_keys ? 0 : 1;
+    unsigned char *id_table = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, row_count * offset_size);
+    size_t *template_offsets = templates ? LOC_ARENA_PUSH_ARRAY(arena, size_t, row_count) : NULL;
+    for(size_t row = 0; row < row_count; row++) {
+        size_t value_offset = dedup ? value_offsets[row] : row_offsets[row] + value_skip * (context->row_key_lens[row] + 1);
+        put_offset(id_table + row * offset_size, value_offset, offset_size);
+        if(templates) {
+            template_offsets[row] = value_offset;
+        }
+    }
+
+    sections[section_count].id = LOC_SECTION_IDS;
+    sections[section_count].data = id_table;
+    sections[section_count].size = row_count * offset_size;
+    section_count++;
+
+    // Rows filled from a fallback language are flagged in their entry's key_len, and so are plural rows. Value files
+    // have no entries of their own, the keys file's are every language's, so only its plural rows are flagged.
+    uint32_t *key_lens = context->row_key_lens;
+    size_t fallback_count = 0;
+    uint32_t lang_bit = (uint32_t)1 << lang_idx;
+    for(size_t row = 0; context->fallback_masks && row < row_count; row++) {
+        fallback_count += (context->fallback_masks[row] & lang_bit) != 0;
+    }
+    if((fallback_count || context->plural_rows) && !context->shared_keys) {
+        key_lens = LOC_ARENA_PUSH_ARRAY(arena, uint32_t, row_count);
+        for(size_t row = 0; row < row_count; row++) {
+            key_lens[row] = context->row_key_lens[row];
+            key_lens[row] |= fallback_count && (context->fallback_masks[row] & lang_bit) ? LOC_ENTRY_FALLBACK : 0;
+            key_lens[row] |= context->plural_rows && context->plural_rows[row] ? LOC_ENTRY_PLURAL : 0;
+        }
+        file_flags |= fallback_count ? LOC_FLAG_FALLBACK : 0;
+    }
+    if(fallback_count) {
+        printf("%s: %zu of %zu strings from fallback languages\n", context->lang_codes[lang_idx], fallback_count, row_count);
+    }
+
+    // Value files are looked up through the keys file's index
+    if(!context->shared_keys) {
+        index_rows rows;
+        rows.count = row_count;
+        rows.hashes = context->row_hashes;
+        rows.key_lens = key_lens;
+        rows.extras = dedup ? row_ids : value_lens;
+        rows.offsets = row_offsets;
+        append_index_sections(arena, context->flags, context->mph, context->flat, context->buckets, context->bucket_count,
+                              &rows, offset_size, entry_size, sections, &section_count);
+    }
+
+    // Templates are found by the same offsets, so they're compiled before the strings are compressed
+    if(templates) {
+        size_t conflicts = 0;
+        append_template_sections(context, arena, lang_idx, sections[0].data, template_offsets, sections, &section_count, &conflicts);
+        if(conflicts) {
+            printf("Warning: %s: %zu rows share a translation with a row that numbers its {name} placeholders differently, "
+                   "loc_format gives them the first row's numbers\n", context->lang_codes[lang_idx], conflicts);
+        }
+    }
+
+    if(context->plurals) {
+        append_plural_rules_section(arena, &context->plurals[lang_idx], sections, &section_count);
+        file_flags |= LOC_FLAG_PLURALS;
+    }
+
+    if(context->flags & LOC_FLAG_COMPRESSED) {
+        compress_strings(arena, sections, &section_count, 0, starts, start_count);
+    }
+
+    return make_output(context->lang_codes[lang_idx], file_flags, sections, section_count);
+}
+
+static void run_language_job(language_job *job) {
+    build_context *context = job->context;
+    for(int lang_idx = job->first_language; lang_idx < context->language_count; lang_idx += job->stride) {
+        // Bundled languages have to stay around until the bundle is written, the others can go once they're on disk.
+        // With --mem-limit bundled languages wait on disk too.
+        loc_arena_temp temp = loc_arena_temp_begin(job->arena);
+        output_file *file = &context->outputs[lang_idx];
+        if(context->unchanged[lang_idx]) {
+            // Same keys and translations as the last run, its file is still right
+            char output_path[512];
+            make_output_path(output_path, context->input_path, context->lang_codes[lang_idx]);
+            *file = make_output(context->lang_codes[lang_idx], 0, NULL, 0);
+            file->size = context->previous->lang_sizes[lang_idx];
+            printf("Unchanged, kept %s\n", output_path);
+        } else {
+            *file = build_language(context, job->arena, lang_idx);
+            if(!file->failed && !context->bundle) {
+                write_output_file(context, job->arena, file);
+            } else if(!file->failed && context->spilled) {
+                park_output_file(context, job->arena, file);
+            }
+        }
+
+        if(context->spilled) {
+            stream_close(&context->spilled->values[lang_idx]);
+        }
+        if(!context->bundle || context->spilled) {
+            loc_arena_temp_end(temp);
+        }
+    }
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+static DWORD WINAPI language_thread(LPVOID param) {
+    run_language_job((language_job *)param);
+    return 0;
+}
+#else
+static void *language_thread(void *param) {
+    run_language_job((language_job *)param);
+    return NULL;
+}
+#endif
+
+/* jobs[0] runs on this thread, the others get one thread each */
+static loc_bool run_language_jobs(language_job *jobs, int job_count) {
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE threads[32];
+    int started = 0;
+    for(int i = 1; i < job_count; i++) {
+        threads[started] = CreateThread(NULL, 0, language_thread, &jobs[i], 0, NULL);
+        if(!threads[started]) break;
+        started++;
+    }
+    if(started == job_count - 1) {
+        run_language_job(&jobs[0]);
+    }
+    for(int i = 0; i < started; i++) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+#else
+    pthread_t threads[32];
+    int started = 0;
+    for(int i = 1; i < job_count; i++) {
+        if(pthread_create(&threads[started], NULL, language_thread, &jobs[i]) != 0) break;
+        started++;
+    }
+    if(started == job_count - 1) {
+        run_language_job(&jobs[0]);
+    }
+    for(int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+#endif
+    return started == job_count - 1;
+}
+
+static void print_usage(void) {
+    printf("Usage: loc [options] [input_file_path] [lang1] [lang2] [lang3] ...\n");
+    printf("Input file format: pipe-delimited (|) with optional whitespace around pipes\n");
+    printf("Use || to include a literal pipe character in a string\n");
+    printf("Options:\n");
+    printf("  --mph                index the keys with a minimal perfect hash, every lookup is one probe\n");
+    printf("  --flat               index the keys with a flat open addressing table\n");
+    printf("  --load-factor=N      how full the --flat table gets, between 0 and 1 (default %.3f)\n", FLAT_DEFAULT_LOAD_FACTOR);
+    printf("  --header=FILE        write a C/C++ header with an id and a precomputed hash for every key\n");
+    printf("  --shared-keys        write the keys and the index once to input.keys.loc, the language files only hold values\n");
+    printf("  -j N                 build and write N languages at a time, the output is the same as with -j 1\n");
+    printf("  --bundle             write every language into one input.bundle.loc instead of one file each\n");
+    printf("  --mem-limit=SIZE     stream the input and keep the strings in temporary files, using at most SIZE\n");
+    printf("                       of memory (like 512M or 2G, at least 16M)\n");
+    printf("  --compress           compress the strings in blocks the loader decompresses when they're first used\n");
+    printf("  --dedup              store every distinct translation once, rows with the same one share it\n");
+    printf("  --share-suffixes     --dedup, and a translation that's the end of another one is stored inside it\n");
+    printf("  --templates          compile the {0} and {name} placeholders of every string for loc_format\n");
+    printf("  --plurals            rows whose key starts with a category ([one] ... [other] ...) get a form per\n");
+    printf("                       category, picked by the language's CLDR rules in loc_get_plural\n");
+    printf("  --plural-rules=MAP   --plurals, and which CLDR language a code follows, like sp:es,jp:ja\n");
+    printf("  --fallback=CHAINS    fill missing translations from other languages, like pt-BR:pt:en,es-MX:es\n");
+    printf("  --force              rebuild every file, even the ones input.manifest says haven't changed\n");
+    printf("Example: loc strings.txt en fr jp\n");
+    printf("  Produces: strings.en.loc, strings.fr.loc, strings.jp.loc\n");
+    printf("Patches: loc --diff=PATCH old.loc new.loc\n");
+    printf("  Writes the keys that changed between two files of a language, for loc_apply_patch\n");
+}
+
+int main(int argc, char **argv) {
+    size_t input_size = 0;
+    unsigned char *input;
+    int language_count = 0;
+    loc_mem_arena *arena;
+    uint32_t flags = 0;
+    double load_factor = FLAT_DEFAULT_LOAD_FACTOR;
+    const char *input_path = NULL;
+    const char *header_path = NULL;
+    const char *patch_path = NULL;
+    const char *fallback_spec = NULL;
+    const char *plural_rules_spec = NULL;
+    loc_bool shared_keys = loc_false;
+    loc_bool bundle = loc_false;
+    loc_bool force = loc_false;
+    loc_bool share_suffixes = loc_false;
+    int thread_count = 1;
+    size_t mem_limit = 0;
+    const char *value;
+    char *lang_codes[32];
+
+    for(int i = 1; i < argc; i++) {
+        if(argv[i][0] == '-' && argv[i][1] == '-') {
+            if(loc_strcmp(argv[i], "--mph") == 0) {
+                flags |= LOC_FLAG_MPH;
+            } else if(loc_strcmp(argv[i], "--flat") == 0) {
+                flags |= LOC_FLAG_FLAT;
+            } else if(loc_strcmp(argv[i], "--shared-keys") == 0) {
+                shared_keys = loc_true;
+            } else if(loc_strcmp(argv[i], "--bundle") == 0) {
+                bundle = loc_true;
+            } else if(loc_strcmp(argv[i], "--force") == 0) {
+                force = loc_true;
+            } else if(loc_strcmp(argv[i], "--compress") == 0) {
+                flags |= LOC_FLAG_COMPRESSED;
+            } else if(loc_strcmp(argv[i], "--dedup") == 0) {
+                flags |= LOC_FLAG_DEDUP;
+            } else if(loc_strcmp(argv[i], "--share-suffixes") == 0) {
+                flags |= LOC_FLAG_DEDUP;
+                share_suffixes = loc_true;
+            } else if(loc_strcmp(argv[i], "--templates") == 0) {
+                flags |= LOC_FLAG_TEMPLATES;
+            } else if(loc_strcmp(argv[i], "--plurals") == 0) {
+                flags |= LOC_FLAG_PLURALS;
+            } else if((value = option_value(argc, argv, &i, "--plural-rules"))) {
+                flags |= LOC_FLAG_PLURALS;
+                plural_rules_spec = value;
+            } else if((value = option_value(argc, argv, &i, "--load-factor"))) {
+                load_factor = strtod(value, NULL);
+                if(!(load_factor > 0.0 && load_factor < 1.0)) {
+                    printf("Error: load factor has to be between 0 and 1\n");
+                    return -1;
+                }
+            } else if((value = option_value(argc, argv, &i, "--header"))) {
+                header_path = value;
+            } else if((value = option_value(argc, argv, &i, "--fallback"))) {
+                fallback_spec = value;
+            } else if((value = option_value(argc, argv, &i, "--diff"))) {
+                patch_path = value;
+            } else if((value = option_value(argc, argv, &i, "--mem-limit"))) {
+                mem_limit = parse_size(value);
+                if(mem_limit < STREAM_MIN_MEMORY) {
+                    printf("Error: --mem-limit needs a size of at least 16M, like 512M or 2G\n");
+                    return -1;
+                }
             } else {
-                size_t *new_offsets = LOC_ARENA_PUSH_ARRAY(arena, size_t, b->count + 1);
-                for(size_t i = 0; i < b->count; i++) {
-                    new_offsets[i] = b->offsets[i];
+                printf("Unknown option: %s\n", argv[i]);
+                print_usage();
+                return -1;
+            }
+        } else if(argv[i][0] == '-' && argv[i][1] == 'j') {
+            value = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+            thread_count = atoi(value);
+            if(thread_count < 1 || thread_count > 32) {
+                printf("Error: -j needs a thread count between 1 and 32\n");
+                return -1;
+            }
+        } else if(!input_path) {
+            input_path = argv[i];
+        } else {
+            if(language_count == 32) {
+                printf("Error: Too many languages (max 32)\n");
+                return -1;
+            }
+            lang_codes[language_count++] = argv[i];
+        }
+    }
+
+    if((flags & LOC_FLAG_MPH) && (flags & LOC_FLAG_FLAT)) {
+        printf("Error: --mph and --flat can't be used together\n");
+        return -1;
+    }
+
+    // The loader caches decompressed blocks in the loc_file, which views into bundles and attached files don't own.
+    // Compressing needs the whole pool in memory.
+    if((flags & LOC_FLAG_COMPRESSED) && (shared_keys || bundle || mem_limit)) {
+        printf("Error: --compress can't be used with --shared-keys, --bundle or --mem-limit\n");
+        return -1;
+    }
+
+    // Translations are only interned once they're all in memory
+    if((flags & LOC_FLAG_DEDUP) && mem_limit) {
+        printf("Error: --dedup and --share-suffixes can't be used with --mem-limit\n");
+        return -1;
+    }
+
+    // Templates are compiled from the strings in memory, and the rows they come from for {name} numbers
+    if((flags & LOC_FLAG_TEMPLATES) && mem_limit) {
+        printf("Error: --templates can't be used with --mem-limit\n");
+        return -1;
+    }
+
+    // Plural rows are rewritten into every language's forms from the rows in memory
+    if((flags & LOC_FLAG_PLURALS) && mem_limit) {
+        printf("Error: --plurals can't be used with --mem-limit\n");
+        return -1;
+    }
+
+    // --diff compares two .loc files instead of reading an input
+    if(patch_path) {
+        if(!input_path || language_count != 1) {
+            printf("Error: --diff needs the old and the new .loc file\n");
+            print_usage();
+            return -1;
+        }
+        arena = loc_arena_init((size_t)16 * 1024 * 1024 * 1024);
+        loc_bool written = write_patch(arena, input_path, lang_codes[0], patch_path);
+        loc_arena_destroy(arena);
+        return written ? 0 : -1;
+    }
+
+    for(int i = 0; i < language_count; i++) {
+        if(bundle && loc_strlen(lang_codes[i]) >= LOC_BUNDLE_CODE_SIZE) {
+            printf("Error: language code %s is too long for a bundle (max %d characters)\n", lang_codes[i], LOC_BUNDLE_CODE_SIZE - 1);
+            return -1;
+        }
+        if(shared_keys && loc_strcmp(lang_codes[i], LOC_BUNDLE_KEYS) == 0) {
+            printf("Error: \"%s\" can't be a language with --shared-keys, the keys file has that name\n", LOC_BUNDLE_KEYS);
+            return -1;
+        }
+    }
+
+    if(!input_path || language_count == 0) {
+        printf("Invalid Usage.\n");
+        print_usage();
+        return -1;
+    }
+
+    int fallbacks[32];
+    if(fallback_spec && !parse_fallbacks(fallback_spec, lang_codes, language_count, fallbacks)) {
+        return -1;
+    }
+
+    // With --mem-limit everything comes out of an arena that size, so it can't grow past it
+    arena = loc_arena_init(mem_limit ? mem_limit : (size_t)16 * 1024 * 1024 * 1024);
+
+    // Every language's plural rules are compiled before the input is read, a language without any stops the build
+    plural_language *plurals = NULL;
+    if(flags & LOC_FLAG_PLURALS) {
+        plurals = LOC_ARENA_PUSH_ARRAY(arena, plural_language, language_count);
+        if(!resolve_plural_languages(plural_rules_spec, lang_codes, language_count, plurals)) {
+            loc_arena_destroy(arena);
+            return -1;
+        }
+    }
+
+    char spill_dir[512];
+    output_directory(spill_dir, input_path);
+
+    // The last run's manifest says which of its files are still right. It's out of date as soon as
+    // this run starts writing, so it goes until this run is done.
+    char manifest_path[512];
+    make_sibling_path(manifest_path, input_path, ".manifest");
+    manifest previous;
+    loc_bool have_previous = !force && read_manifest(arena, manifest_path, &previous);
+    remove(manifest_path);
+
+    size_t row_count;
+    string *row_values = NULL;
+    size_t *lang_sizes = NULL;
+    spilled_rows *spilled = NULL;
+    uint64_t *row_hashes;
+    uint64_t *row_digests;
+    uint32_t *fallback_masks = NULL;
+    u8 *plural_rows = NULL;
+    uint64_t lang_digests[32] = {0};
+    key_table keys;
+
+    if(mem_limit) {
+        // Reading buffers are only needed until the input's been spilled, the index gets their memory after that
+        spilled = LOC_ARENA_PUSH_STRUCT(arena, spilled_rows);
+        spilled->language_count = language_count;
+        spilled->shared_keys = shared_keys;
+        spilled->fallbacks = fallback_spec ? fallbacks : NULL;
+
+        size_t chunk_size = LOC_ARENA_MIN(LOC_ARENA_MAX(mem_limit / 16, STREAM_MIN_CHUNK_SIZE), STREAM_MAX_CHUNK_SIZE);
+        loc_arena_temp temp = loc_arena_temp_begin(arena);
+        if(!spill_input(arena, input_path, spill_dir, chunk_size, spilled)) {
+            loc_arena_destroy(arena);
+            return -1;
+        }
+        loc_arena_temp_end(temp);
+
+        row_count = spilled->row_count;
+        row_hashes = LOC_ARENA_PUSH_ARRAY(arena, uint64_t, row_count);
+        row_digests = LOC_ARENA_PUSH_ARRAY(arena, uint64_t, row_count);
+        keys.lens = LOC_ARENA_PUSH_ARRAY(arena, uint32_t, row_count);
+        size_t hashes_size = row_count * sizeof(uint64_t);
+        size_t lens_size = row_count * sizeof(uint32_t);
+        loc_bool read = stream_read_at(&spilled->hashes, 0, row_hashes, hashes_size) == hashes_size &&
+                        stream_read_at(&spilled->row_digests, 0, row_digests, hashes_size) == hashes_size &&
+                        stream_read_at(&spilled->key_lens, 0, keys.lens, lens_size) == lens_size;
+        if(fallback_spec) {
+            fallback_masks = LOC_ARENA_PUSH_ARRAY(arena, uint32_t, row_count);
+            read = read && stream_read_at(&spilled->fallback_masks, 0, fallback_masks, lens_size) == lens_size;
+            stream_close(&spilled->fallback_masks);
+        }
+        stream_close(&spilled->hashes);
+        stream_close(&spilled->row_digests);
+        stream_close(&spilled->key_lens);
+        for(int i = 0; i < language_count; i++) {
+            lang_digests[i] = spilled->lang_digests[i];
+        }
+        if(!read) {
+            printf("Failed to read a temporary file in %s\n", spill_dir);
+            loc_arena_destroy(arena);
+            return -1;
+        }
+
+        keys.data = NULL;
+        keys.spill = &spilled->keys;
+        keys.size = spilled->keys.size;
+        keys.max_len = spilled->max_key_len;
+        keys.offsets = LOC_ARENA_PUSH_ARRAY(arena, size_t, row_count);
+        size_t key_offset = 0;
+        for(size_t row = 0; row < row_count; row++) {
+            keys.offsets[row] = key_offset;
+            key_offset += (size_t)keys.lens[row] + 1;
+        }
+    } else {
+        input = loc_read_entire_file(arena, input_path, &input_size);
+        if(!input) {
+            printf("Failed to read file: %s\n", input_path);
+            loc_arena_destroy(arena);
+            return -1;
+        }
+
+        // Split the input into rows, this also tells us how much string space each language needs
+        parsed_rows parsed;
+        parsed_rows_init(&parsed, arena, language_count, shared_keys);
+        parse_rows(input, input_size, language_count, loc_true, push_row, &parsed);
+        row_count = parsed.row_count;
+        row_values = parsed.values;
+        lang_sizes = LOC_ARENA_PUSH_ARRAY(arena, size_t, language_count);
+        for(int i = 0; i < language_count; i++) {
+            lang_sizes[i] = parsed.lang_sizes[i];
+        }
+
+        // The unescaped keys, the languages' string pools are built from row_values later, each on its own
+        keys.data = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, parsed.keys_size);
+        keys.spill = NULL;
+        keys.size = 0;
+        keys.max_len = 0;
+        keys.offsets = LOC_ARENA_PUSH_ARRAY(arena, size_t, row_count);
+        keys.lens = LOC_ARENA_PUSH_ARRAY(arena, uint32_t, row_count);
+        row_hashes = LOC_ARENA_PUSH_ARRAY(arena, uint64_t, row_count);
+        row_digests = LOC_ARENA_PUSH_ARRAY(arena, uint64_t, row_count);
+        fallback_masks = fallback_spec ? LOC_ARENA_PUSH_ARRAY(arena, uint32_t, row_count) : NULL;
+        plural_rows = plurals ? LOC_ARENA_PUSH_ARRAY_ZERO(arena, u8, row_count) : NULL;
+
+        for(size_t row = 0; row < row_count; row++) {
+            string *key_value = &row_values[row * language_count];
+            string key_field = *key_value;
+
+            // A filled field was empty, its language needs room for the text now
+            uint32_t fallback_mask = 0;
+            if(fallback_masks) {
+                fallback_mask = resolve_fallbacks(key_value, language_count, fallbacks);
+                fallback_masks[row] = fallback_mask;
+                for(int i = 0; i < language_count; i++) {
+                    lang_sizes[i] += (fallback_mask & ((uint32_t)1 << i)) ? key_value[i].len : 0;
                 }
-                b->offsets = new_offsets;
-            }
-            
-            // Store offset to this string entry
-            b->offsets[b->count] = lang_buffers[lang_idx].size;
-            b->count++;
-            
-            // Storage format: [english_key:null-terminated][localized_string:null-terminated]
-            // Write English key first (for verification)
-            unescape_and_copy(lang_buffers[lang_idx].data, &lang_buffers[lang_idx].size, values[0].value, values[0].len);
-            lang_buffers[lang_idx].data[lang_buffers[lang_idx].size++] = '\0';
-            
-            // Then write localized string
-            unescape_and_copy(lang_buffers[lang_idx].data, &lang_buffers[lang_idx].size, values[lang_idx].value, values[lang_idx].len);
-            
-            // Add null terminator
-            lang_buffers[lang_idx].data[lang_buffers[lang_idx].size++] = '\0';
-        }
-    }
-
-    // Write output files for each language
-    for(int lang_idx = 0; lang_idx < language_count; lang_idx++) {
-        char output_path[512];
-        const char *input_path = argv[1];
-        const char *lang_code = argv[2 + lang_idx];
-        
-        // Create output filename
-        const char *dot = input_path;
-        const char *last_dot = NULL;
-        while(*dot) {
-            if(*dot == '.') last_dot = dot;
-            dot++;
+            }
+            row_digests[row] = digest_row(key_value, language_count, lang_digests, fallback_mask);
+
+            // A plural row's key is its [other] form, and a form a language has that its translation doesn't give
+            // takes a byte to leave out
+            string forms[PLURAL_CATEGORY_COUNT];
+            if(plural_rows && split_plural_forms(key_field, forms)) {
+                if(!forms[PLURAL_OTHER].len) {
+                    printf("Error: the plural row \"%.*s\" has no [other] form, it's the row's key\n", (int)key_field.len, key_field.value);
+                    loc_arena_destroy(arena);
+                    return -1;
+                }
+                plural_rows[row] = 1;
+                key_field = forms[PLURAL_OTHER];
+                for(int i = 0; i < language_count; i++) {
+                    lang_sizes[i] += PLURAL_CATEGORY_COUNT - 1;
+                }
+            }
+
+            // Storage format of a keys file: [english_key:null-terminated]
+            keys.offsets[row] = keys.size;
+            unescape_and_copy(keys.data, &keys.size, key_field.value, key_field.len);
+            keys.data[keys.size++] = '\0';
+
+            // Hash the unescaped key, that's what the loader gets asked for
+            string key;
+            key.value = keys.data + keys.offsets[row];
+            key.len = keys.size - keys.offsets[row] - 1;
+            keys.lens[row] = (uint32_t)key.len;
+            keys.max_len = LOC_ARENA_MAX(keys.max_len, keys.lens[row]);
+            row_hashes[row] = fnv1a_hash64(key);
         }
-        
-        if(last_dot) {
-            size_t prefix_len = last_dot - input_path;
-            loc_memcpy(output_path, input_path, prefix_len);
-            output_path[prefix_len] = '.';
-            size_t lang_len = loc_strlen(lang_code);
-            loc_memcpy(output_path + prefix_len + 1, lang_code, lang_len);
-            loc_memcpy(output_path + prefix_len + 1 + lang_len, ".loc", 5);
-        } else {
-            size_t path_len = loc_strlen(input_path);
-            loc_memcpy(output_path, input_path, path_len);
-            output_path[path_len] = '.';
-            size_t lang_len = loc_strlen(lang_code);
-            loc_memcpy(output_path + path_len + 1, lang_code, lang_len);
-            loc_memcpy(output_path + path_len + 1 + lang_len, ".loc", 5);
+    }
+
+    printf("Found %zu strings\n", row_count);
+
+    size_t bucket_table_size = row_count;
+    size_t row;
+
+    // What this run is built from, for the next one
+    manifest current = {0};
+    current.settings = settings_digest(flags, shared_keys, share_suffixes, bundle, load_factor, input_path, header_path,
+                                       lang_codes, language_count);
+    for(int i = 0; plurals && i < language_count; i++) {
+        // The rules are loc_gen's as much as --plural-rules', a change to either builds everything again
+        string rules;
+        rules.value = (unsigned char *)plurals[i].words;
+        rules.len = plurals[i].word_count * sizeof(uint32_t);
+        current.settings = digest_add(current.settings, fnv1a_hash64(rules) + (uint64_t)plurals[i].form_count);
+    }
+    current.row_count = row_count;
+    current.row_digests = row_digests;
+    current.language_count = language_count;
+    for(row = 0; row < row_count; row++) {
+        // "[other] Close" and "Close" are the same key, only one of them is a plural row
+        current.keys_digest = digest_add(current.keys_digest, row_hashes[row] + (plural_rows && plural_rows[row]));
+    }
+    for(int i = 0; i < language_count; i++) {
+        current.lang_digests[i] = lang_digests[i];
+    }
+
+    // A file only has to be built again if what it's built from changed. The index only depends on the
+    // keys, and every language file on the keys and its own column. With --templates on every column: a row's
+    // {name} numbers come from all of its languages.
+    loc_bool same_keys = have_previous && previous.settings == current.settings && previous.language_count == language_count &&
+                         previous.row_count == row_count && previous.keys_digest == current.keys_digest;
+    if(have_previous && previous.settings != current.settings) {
+        printf("Options or languages changed since the last run, building everything\n");
+    } else if(have_previous) {
+        size_t changed_rows = row_count > previous.row_count ? row_count - previous.row_count : previous.row_count - row_count;
+        for(row = 0; row < LOC_ARENA_MIN(row_count, previous.row_count); row++) {
+            changed_rows += row_digests[row] != previous.row_digests[row];
         }
-        
-        // Calculate sizes for each chunk
-        // Format: [bucket_offset_table_size][bucket_offset_table][bucket_list_size][bucket_list][strings_size][strings]
-        
-        size_t bucket_offset_table_size = bucket_table_size * sizeof(size_t);
-        
-        // Calculate bucket list size
-        size_t bucket_list_size = 0;
-        for(size_t i = 0; i < bucket_table_size; i++) {
-            bucket *b = &lang_buckets[lang_idx][i];
-            bucket_list_size += sizeof(size_t) + (b->count * sizeof(size_t));
+        printf("%zu of %zu rows changed since the last run\n", changed_rows, row_count);
+    }
+
+    loc_bool same_columns = same_keys;
+    for(int i = 0; same_columns && i < language_count; i++) {
+        same_columns = previous.lang_digests[i] == lang_digests[i];
+    }
+
+    char path[512];
+    loc_bool unchanged[32];
+    loc_bool all_unchanged = loc_true;
+    for(int i = 0; i < language_count; i++) {
+        make_output_path(path, input_path, lang_codes[i]);
+        unchanged[i] = same_keys && previous.lang_digests[i] == lang_digests[i] && (bundle || can_keep_file(path, previous.lang_sizes[i])) &&
+                       (same_columns || !(flags & LOC_FLAG_TEMPLATES));
+        all_unchanged &= unchanged[i];
+    }
+    make_output_path(path, input_path, LOC_BUNDLE_KEYS);
+    loc_bool keys_unchanged = shared_keys && same_keys && (bundle || can_keep_file(path, previous.keys_size));
+    char bundle_path[512];
+    make_output_path(bundle_path, input_path, "bundle");
+    loc_bool bundle_unchanged = bundle && all_unchanged && can_keep_file(bundle_path, previous.bundle_size);
+    if(bundle && !bundle_unchanged) {
+        // The bundle is one file, it's written again in full
+        for(int i = 0; i < language_count; i++) unchanged[i] = loc_false;
+        all_unchanged = loc_false;
+        keys_unchanged = loc_false;
+    }
+    loc_bool need_index = (shared_keys && !keys_unchanged) || (!shared_keys && !all_unchanged);
+
+    if(header_path && same_keys && can_keep_file(header_path, previous.header_size)) {
+        printf("Unchanged, kept %s\n", header_path);
+    } else if(header_path) {
+        loc_arena_temp temp = loc_arena_temp_begin(arena);
+        loc_bool written = write_key_header(arena, header_path, input_path, &keys, row_hashes, row_count);
+        loc_arena_temp_end(temp);
+        if(!written) {
+            printf("Failed to write header: %s\n", header_path);
+            loc_arena_destroy(arena);
+            return -1;
         }
-        
-        size_t strings_size = lang_buffers[lang_idx].size;
-        
-        size_t total_size = sizeof(size_t) + bucket_offset_table_size +
-                           sizeof(size_t) + bucket_list_size +
-                           sizeof(size_t) + strings_size;
-        
-        // Build output buffer
-        unsigned char *output = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, total_size);
-        size_t output_pos = 0;
-        
-        // Write bucket offset table size
-        *((size_t*)(output + output_pos)) = bucket_offset_table_size;
-        output_pos += sizeof(size_t);
-        
-        // Write bucket offset table
-        size_t *bucket_offsets = (size_t*)(output + output_pos);
-        size_t current_bucket_offset = 0;
-        
-        for(size_t i = 0; i < bucket_table_size; i++) {
-            bucket_offsets[i] = current_bucket_offset;
-            bucket *b = &lang_buckets[lang_idx][i];
-            current_bucket_offset += sizeof(size_t) + (b->count * sizeof(size_t));
+        printf("Successfully created %s (%zu keys)\n", header_path, row_count);
+    }
+
+    mph_table mph = {0};
+    flat_table flat = {0};
+    bucket *buckets = NULL;
+
+    if(!need_index) {
+        // Nothing to build
+    } else if((flags & LOC_FLAG_MPH) && same_keys) {
+        mph_restore(arena, row_hashes, row_count, &previous, &mph);
+        printf("Keys unchanged, reused the minimal perfect hash (%zu keys, %zu buckets)\n", mph.slot_count, mph.bucket_count);
+        print_mph_occupancy(arena, row_hashes, row_count, &mph);
+    } else if(flags & LOC_FLAG_MPH) {
+        if(!mph_build(arena, row_hashes, &keys, row_count, &mph)) {
+            loc_arena_destroy(arena);
+            return -1;
         }
-        output_pos += bucket_offset_table_size;
-        
-        // Write bucket list size
-        *((size_t*)(output + output_pos)) = bucket_list_size;
-        output_pos += sizeof(size_t);
-        
-        // Write bucket list
-        for(size_t i = 0; i < bucket_table_size; i++) {
-            bucket *b = &lang_buckets[lang_idx][i];
-            
-            // Write count
-            *((size_t*)(output + output_pos)) = b->count;
-            output_pos += sizeof(size_t);
-            
-            // Write offsets
-            for(size_t j = 0; j < b->count; j++) {
-                *((size_t*)(output + output_pos)) = b->offsets[j];
-                output_pos += sizeof(size_t);
+        printf("Built minimal perfect hash (%zu keys, %zu buckets)\n", mph.slot_count, mph.bucket_count);
+        print_mph_occupancy(arena, row_hashes, row_count, &mph);
+    } else if(flags & LOC_FLAG_FLAT) {
+        flat_build(arena, row_hashes, row_count, load_factor, &flat);
+        printf("Built flat table (%zu slots, %.1f%% full)\n", flat.capacity, 100.0 * (double)row_count / (double)flat.capacity);
+        print_flat_occupancy(row_hashes, row_count, &flat);
+    } else {
+        // Buckets only depend on the keys, so every language shares them
+        buckets = build_buckets(arena, row_hashes, row_count, bucket_table_size);
+        print_bucket_occupancy(buckets, bucket_table_size, row_count);
+    }
+
+    if(mph.displacements) {
+        current.mph_bucket_count = mph.bucket_count;
+        current.mph_slot_count = mph.slot_count;
+        current.mph_displacements = mph.displacements;
+    } else if((flags & LOC_FLAG_MPH) && same_keys) {
+        current.mph_bucket_count = previous.mph_bucket_count;
+        current.mph_slot_count = previous.mph_slot_count;
+        current.mph_displacements = previous.mph_displacements;
+    }
+
+    build_context context;
+    context.flags = flags;
+    context.shared_keys = shared_keys;
+    context.bundle = bundle;
+    context.input_path = input_path;
+    context.spill_dir = spill_dir;
+    context.lang_codes = lang_codes;
+    context.lang_sizes = lang_sizes;
+    context.language_count = language_count;
+    context.mph = &mph;
+    context.flat = &flat;
+    context.buckets = buckets;
+    context.bucket_count = bucket_table_size;
+    context.row_count = row_count;
+    context.row_hashes = row_hashes;
+    context.row_key_lens = keys.lens;
+    context.row_key_offsets = keys.offsets;
+    context.key_pool = keys.data;
+    context.key_pool_size = keys.size;
+    context.share_suffixes = share_suffixes;
+    context.row_values = row_values;
+    context.fallback_masks = fallback_masks;
+    context.plurals = plurals;
+    context.plural_rows = plural_rows;
+    context.spilled = spilled;
+    context.unchanged = unchanged;
+    context.previous = &previous;
+
+    output_file outputs[33];
+    uint32_t output_count = 0;
+
+    if(bundle_unchanged) {
+        printf("Unchanged, kept %s\n", bundle_path);
+    } else if(keys_unchanged) {
+        make_output_path(path, input_path, LOC_BUNDLE_KEYS);
+        outputs[output_count] = make_output(LOC_BUNDLE_KEYS, 0, NULL, 0);
+        outputs[output_count].size = previous.keys_size;
+        output_count++;
+        printf("Unchanged, kept %s\n", path);
+    } else if(shared_keys) {
+        // One file with the keys and the index, entries point at keys and carry the row instead of a value length
+        size_t offset_size = needs_wide_offsets(keys.size, buckets, bucket_table_size) ? 8 : 4;
+        size_t entry_size = offset_size == 8 ? LOC_WIDE_ENTRY_SIZE : LOC_ENTRY_SIZE;
+        uint32_t *row_ids = LOC_ARENA_PUSH_ARRAY(arena, uint32_t, row_count);
+        for(row = 0; row < row_count; row++) {
+            row_ids[row] = (uint32_t)row;
+        }
+
+        // Plural rows are every language's, the keys file's entries say which they are
+        uint32_t *key_lens = keys.lens;
+        if(plural_rows) {
+            key_lens = LOC_ARENA_PUSH_ARRAY(arena, uint32_t, row_count);
+            for(row = 0; row < row_count; row++) {
+                key_lens[row] = keys.lens[row] | (plural_rows[row] ? LOC_ENTRY_PLURAL : 0);
             }
         }
-        
-        // Write strings size
-        *((size_t*)(output + output_pos)) = strings_size;
-        output_pos += sizeof(size_t);
-        
-        // Write strings
-        loc_memcpy(output + output_pos, lang_buffers[lang_idx].data, strings_size);
-        
-        if(!loc_write_entire_file(output_path, total_size, (char*)output)) {
-            printf("Failed to write output file: %s\n", output_path);
+
+        index_rows rows;
+        rows.count = row_count;
+        rows.hashes = row_hashes;
+        rows.key_lens = key_lens;
+        rows.extras = row_ids;
+        rows.offsets = keys.offsets;
+
+        section sections[LOC_MAX_SECTIONS] = {0};
+        uint32_t section_count = 0;
+
+        sections[section_count].id = LOC_SECTION_STRINGS;
+        sections[section_count].data = keys.data;
+        sections[section_count].spill = keys.spill;
+        sections[section_count].size = keys.size;
+        section_count++;
+
+        // The id table of a keys file points at the keys
+        unsigned char *id_table = LOC_ARENA_PUSH_ARRAY(arena, unsigned char, row_count * offset_size);
+        for(row = 0; row < row_count; row++) {
+            put_offset(id_table + row * offset_size, keys.offsets[row], offset_size);
+        }
+
+        sections[section_count].id = LOC_SECTION_IDS;
+        sections[section_count].data = id_table;
+        sections[section_count].size = row_count * offset_size;
+        section_count++;
+
+        append_index_sections(arena, flags, &mph, &flat, buckets, bucket_table_size, &rows,
+                              offset_size, entry_size, sections, &section_count);
+
+        uint32_t file_flags = (flags & ~(LOC_FLAG_DEDUP | LOC_FLAG_TEMPLATES)) | LOC_FLAG_KEYS | (offset_size == 8 ? LOC_FLAG_WIDE_OFFSETS : 0);
+        outputs[output_count] = make_output(LOC_BUNDLE_KEYS, file_flags, sections, section_count);
+        loc_bool written = loc_true;
+        if(!bundle) {
+            written = write_output_file(&context, arena, &outputs[output_count]);
+        } else if(spilled) {
+            written = park_output_file(&context, arena, &outputs[output_count]);
+        }
+        if(!written) {
             loc_arena_destroy(arena);
             return -1;
         }
-        
-        printf("Successfully created %s (%zu strings, %zu bytes)\n",
-               output_path, row_count, total_size);
+        output_count++;
     }
-    
+    if(spilled) {
+        stream_close(&spilled->keys);
+    }
+
+    // Build (and unless bundling, write) every language, split over thread_count threads
+    if(thread_count > language_count) thread_count = language_count;
+    if(bundle_unchanged) {
+        thread_count = 0;
+        for(int i = 0; spilled && i < language_count; i++) {
+            stream_close(&spilled->values[i]);
+        }
+    }
+    context.outputs = outputs + output_count;
+
+    // With --mem-limit every job gets an even share of what the index left over, minus room to write the bundle
+    size_t job_memory = 0;
+    if(mem_limit && thread_count) {
+        size_t left = mem_limit - LOC_ARENA_MIN(mem_limit, arena->pos + 2 * STREAM_BUFFER_SIZE);
+        job_memory = left / thread_count;
+        if(job_memory < STREAM_MIN_CHUNK_SIZE) {
+            printf("Error: --mem-limit is too low, the index of %zu keys already takes %zu MB\n", row_count, arena->pos >> 20);
+            loc_arena_destroy(arena);
+            return -1;
+        }
+    }
+
+    language_job jobs[32];
+    for(int i = 0; i < thread_count; i++) {
+        jobs[i].context = &context;
+        jobs[i].first_language = i;
+        jobs[i].stride = thread_count;
+        if(mem_limit) {
+            jobs[i].arena = loc_arena_init(job_memory);
+        } else {
+            jobs[i].arena = i == 0 ? arena : loc_arena_init((size_t)16 * 1024 * 1024 * 1024);
+        }
+    }
+
+    if(thread_count && !run_language_jobs(jobs, thread_count)) {
+        printf("Error: couldn't start %d threads\n", thread_count);
+        loc_arena_destroy(arena);
+        return -1;
+    }
+
+    loc_bool failed = loc_false;
+    for(int lang_idx = 0; lang_idx < language_count && !bundle_unchanged; lang_idx++) {
+        failed |= context.outputs[lang_idx].failed;
+        current.lang_sizes[lang_idx] = context.outputs[lang_idx].size;
+    }
+    output_count += bundle_unchanged ? 0 : language_count;
+
+    if(!failed && bundle && !bundle_unchanged) {
+        failed = !write_bundle(arena, bundle_path, outputs, output_count);
+    }
+
+    for(uint32_t i = 0; i < output_count; i++) {
+        if(outputs[i].parked) {
+            stream_close(&outputs[i].parked_file);
+        }
+    }
+    for(int i = mem_limit ? 0 : 1; i < thread_count; i++) {
+        loc_arena_destroy(jobs[i].arena);
+    }
+    if(failed) {
+        loc_arena_destroy(arena);
+        return -1;
+    }
+
+    // Everything is written, the next run can start from here
+    if(bundle_unchanged) {
+        for(int i = 0; i < language_count; i++) {
+            current.lang_sizes[i] = previous.lang_sizes[i];
+        }
+    }
+    current.keys_size = !shared_keys ? 0 : bundle_unchanged ? previous.keys_size : outputs[0].size;
+    current.bundle_size = bundle ? loc_get_file_size(bundle_path) : 0;
+    current.header_size = header_path ? loc_get_file_size(header_path) : 0;
+    if(!write_manifest(arena, manifest_path, &current)) {
+        printf("Warning: couldn't write %s, the next run builds everything again\n", manifest_path);
+        remove(manifest_path);
+    }
+
     loc_arena_destroy(arena);
     return 0;
 }
@@ -0,0 +1,485 @@
+/* loc_test.c - round trips through loc_gen and loc.h
+ *
+ * Builds small inputs with a loc_gen binary and checks what the loader answers from the files.
+ * Needs nothing but a loc_gen binary and a POSIX system:
+ *   cc -O2 loc_gen.c -o loc_gen -lpthread
+ *   cc -O2 loc_test.c -o loc_test -lpthread
+ *   ./loc_test ./loc_gen
+ * Prints every failed check and exits with 1 if there was one.
+ *
+ * handle_reload: readers on their own threads look strings up in a loc_handle while another thread reloads it
+ *                over and over. Every string a reader gets stays whole until it leaves.
+ * patch:         loc_gen --diff between two files and loc_apply_patch, then every key and every id of the new
+ *                file, once with the keys where they were and once with a key added before them (so they all
+ *                moved) and one removed. With --dedup and --share-suffixes too, whose index entries hold rows.
+ * shared_strings: --dedup and --share-suffixes files with repeated translations and translations that end others,
+ *                 by key, in a batch and by id.
+ * compressed:    a --compress file of far more blocks than LOC_BLOCK_CACHE_SIZE. Every key has its string, and a
+ *                string a lookup returned is still there after as many other lookups as LOC_BLOCK_CACHE_SIZE allows,
+ *                also when it came from a block that was decompressed long before. With --dedup only half as many.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define LOC_IMPLEMENTATION
+#include "loc.h"
+
+static int failures = 0;
+
+#define CHECK(condition, ...)                                   \
+    do {                                                        \
+        if(!(condition)) {                                      \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);         \
+            printf(__VA_ARGS__);                                \
+            printf("\n");                                       \
+            failures++;                                         \
+        }                                                       \
+    } while(0)
+
+static int write_text(const char *path, const char *text) {
+    FILE *f = fopen(path, "wb");
+    if(!f) {
+        return 0;
+    }
+    fputs(text, f);
+    return fclose(f) == 0;
+}
+
+/* The whole file in memory from malloc, 8 byte aligned as loc_apply_patch wants. NULL if it can't be read. */
+static void *read_file(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if(!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    void *data = length > 0 ? malloc((size_t)length) : NULL;
+    if(data && fread(data, 1, (size_t)length, f) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *size = (size_t)length;
+    return data;
+}
+
+/* Runs loc_gen with the arguments (NULL-terminated) and its output thrown away. Returns its exit status. */
+static int run_loc_gen(const char *loc_gen, const char **args) {
+    char *argv[16];
+    int argc = 0;
+    argv[argc++] = (char *)loc_gen;
+    while(*args && argc < 15) {
+        argv[argc++] = (char *)*args++;
+    }
+    argv[argc] = NULL;
+
+    fflush(stdout);  // or the child has the failures printed so far in its buffer too
+    pid_t pid = fork();
+    if(pid < 0) {
+        return -1;
+    }
+    if(pid == 0) {
+        if(!freopen("/dev/null", "w", stdout)) {
+            _exit(127);
+        }
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    int status = 0;
+    if(waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+/* Writes text to dir/name.txt and builds it with the options (NULL-terminated) for en and fr. 0 if that failed. */
+static int build(const char *loc_gen, const char *dir, const char *name, const char *text, const char *const *options) {
+    char input[512];
+    snprintf(input, sizeof(input), "%s/%s.txt", dir, name);
+    mkdir(dir, 0755);
+    if(!write_text(input, text)) {
+        return 0;
+    }
+
+    const char *args[16];
+    int n = 0;
+    while(*options && n < 12) {
+        args[n++] = *options++;
+    }
+    args[n++] = input;
+    args[n++] = "en";
+    args[n++] = "fr";
+    args[n] = NULL;
+    return run_loc_gen(loc_gen, args) == 0;
+}
+
+#define RELOAD_READERS 4
+#define RELOAD_COUNT 2000
+
+typedef struct {
+    loc_handle *handle;
+    uint64_t *done;
+    size_t lookups;
+    size_t bad;
+} reload_reader;
+
+static void *reload_reader_main(void *data) {
+    reload_reader *reader = (reload_reader *)data;
+    int slot = loc_handle_register_reader(reader->handle);
+    if(slot < 0) {
+        reader->bad++;
+        return NULL;
+    }
+    while(!LOC_ATOMIC_LOAD_U64(reader->done)) {
+        loc_file *fr = loc_handle_enter(reader->handle, slot);
+        const char *text = loc_get_string(fr, "hello");
+        // Still the same text a moment later, the table can't have been freed under it
+        char copy[32];
+        snprintf(copy, sizeof(copy), "%s", text ? text : "");
+        if(!text || (strcmp(copy, "bonjour un") != 0 && strcmp(copy, "bonjour deux") != 0) || strcmp(copy, text) != 0) {
+            reader->bad++;
+        }
+        loc_handle_leave(reader->handle, slot);
+        reader->lookups++;
+    }
+    loc_handle_unregister_reader(reader->handle, slot);
+    return NULL;
+}
+
+static void test_handle_reload(const char *loc_gen, const char *dir, uint32_t load_flags) {
+    const char *none[] = {NULL};
+    CHECK(build(loc_gen, dir, "one", "hello | bonjour un | bye | au revoir\n", none), "loc_gen failed on one.txt");
+    CHECK(build(loc_gen, dir, "two", "hello | bonjour deux | bye | au revoir\n", none), "loc_gen failed on two.txt");
+    char one[512], two[512];
+    snprintf(one, sizeof(one), "%s/one.fr.loc", dir);
+    snprintf(two, sizeof(two), "%s/two.fr.loc", dir);
+
+    loc_handle *handle = loc_handle_open(one, load_flags);
+    CHECK(handle != NULL, "can't open a handle on %s", one);
+    if(!handle) {
+        return;
+    }
+
+    uint64_t done = 0;
+    pthread_t threads[RELOAD_READERS];
+    reload_reader readers[RELOAD_READERS];
+    for(int i = 0; i < RELOAD_READERS; i++) {
+        readers[i].handle = handle;
+        readers[i].done = &done;
+        readers[i].lookups = 0;
+        readers[i].bad = 0;
+        pthread_create(&threads[i], NULL, reload_reader_main, &readers[i]);
+    }
+    int reloaded = 0;
+    for(int i = 0; i < RELOAD_COUNT; i++) {
+        reloaded += loc_handle_reload(handle, i % 2 ? one : two);
+    }
+    LOC_ATOMIC_STORE_U64(&done, 1);
+    for(int i = 0; i < RELOAD_READERS; i++) {
+        pthread_join(threads[i], NULL);
+        CHECK(readers[i].bad == 0, "reader %d got %zu bad strings in %zu lookups", i, readers[i].bad, readers[i].lookups);
+    }
+    CHECK(reloaded == RELOAD_COUNT, "%d of %d reloads worked", reloaded, RELOAD_COUNT);
+
+    // The last reload was one.fr.loc, and with every reader gone nothing retired is still needed
+    int reader = loc_handle_register_reader(handle);
+    const char *text = loc_get_string(loc_handle_enter(handle, reader), "hello");
+    CHECK(text && strcmp(text, "bonjour un") == 0, "after the reloads hello is %s", text ? text : "NULL");
+    loc_handle_leave(handle, reader);
+    loc_handle_unregister_reader(handle, reader);
+    loc_handle_reclaim(handle);
+    CHECK(handle->retired_count == 0, "%zu tables still retired", handle->retired_count);
+    loc_handle_close(handle);
+}
+
+/* A string the loader returned against the one expected, NULL for none */
+static int same_string(const char *got, const char *expected) {
+    return got && expected ? strcmp(got, expected) == 0 : got == expected;
+}
+
+typedef struct {
+    const char *base;      /* input of the file the patch goes on */
+    const char *next;      /* input of the file the patch makes it into */
+    const char *keys[8];   /* NULL-terminated, with what the patched file answers for them */
+    const char *values[8];
+    const char *ids[8];    /* what loc_get_by_id answers for ids 0, 1... of the new file, then one past them is NULL */
+    size_t id_count;
+} patch_case;
+
+static const patch_case patch_in_place = {
+    "alpha | A1\nbeta | B1\ngamma | G1\n",
+    "alpha | A1\nbeta | B2\ngamma | G1\ndelta | D1\n",
+    {"alpha", "beta", "gamma", "delta", NULL}, {"A1", "B2", "G1", "D1"},
+    {"A1", "B2", "G1", "D1"}, 4,
+};
+
+static const patch_case patch_moved = {
+    "alpha | A1\nbeta | B1\ngamma | G1\n",
+    "new first | N1\nalpha | A1\nbeta | B2\n",
+    {"new first", "alpha", "beta", "gamma", NULL}, {"N1", "A1", "B2", NULL},
+    {"N1", "A1", "B2"}, 3,
+};
+
+/* Builds both inputs with the options (NULL-terminated), makes the patch and checks the patched file */
+static void test_patch(const char *loc_gen, const char *dir, const char *name, const char *const *options, const patch_case *test) {
+    char base_dir[300], next_dir[300], base_file[512], next_file[512], patch_file[512], patch_arg[600];
+    snprintf(base_dir, sizeof(base_dir), "%s/base", dir);
+    snprintf(next_dir, sizeof(next_dir), "%s/next", dir);
+    snprintf(base_file, sizeof(base_file), "%s/strings.fr.loc", base_dir);
+    snprintf(next_file, sizeof(next_file), "%s/strings.fr.loc", next_dir);
+    snprintf(patch_file, sizeof(patch_file), "%s/fr.locp", dir);
+    snprintf(patch_arg, sizeof(patch_arg), "--diff=%s", patch_file);
+    mkdir(dir, 0755);
+    CHECK(build(loc_gen, base_dir, "strings", test->base, options), "[%s] loc_gen failed on the base input", name);
+    CHECK(build(loc_gen, next_dir, "strings", test->next, options), "[%s] loc_gen failed on the new input", name);
+    const char *diff[] = {patch_arg, base_file, next_file, NULL};
+    CHECK(run_loc_gen(loc_gen, diff) == 0, "[%s] loc_gen --diff failed", name);
+
+    size_t patch_size = 0;
+    void *patch = read_file(patch_file, &patch_size);
+    loc_file fr = loc_load(base_file);
+    CHECK(patch != NULL, "[%s] no patch", name);
+    CHECK(fr.strings != NULL, "[%s] can't load %s", name, base_file);
+    if(!patch || !fr.strings) {
+        free(patch);
+        loc_free(&fr);
+        return;
+    }
+    CHECK(loc_apply_patch(&fr, patch, patch_size), "[%s] the patch doesn't apply", name);
+
+    size_t key_count = 0;
+    while(test->keys[key_count]) key_count++;
+    const char *batch[8];
+    loc_get_strings(&fr, test->keys, key_count, batch);
+    for(size_t i = 0; i < key_count; i++) {
+        const char *single = loc_get_string(&fr, test->keys[i]);
+        CHECK(same_string(single, test->values[i]), "[%s] loc_get_string(\"%s\") is %s, not %s", name, test->keys[i],
+              single ? single : "NULL", test->values[i] ? test->values[i] : "NULL");
+        CHECK(same_string(batch[i], test->values[i]), "[%s] loc_get_strings(\"%s\") is %s, not %s", name, test->keys[i],
+              batch[i] ? batch[i] : "NULL", test->values[i] ? test->values[i] : "NULL");
+    }
+    for(size_t id = 0; id <= test->id_count; id++) {
+        const char *expected = id < test->id_count ? test->ids[id] : NULL;
+        const char *text = loc_get_by_id(&fr, (uint32_t)id);
+        CHECK(same_string(text, expected), "[%s] loc_get_by_id(%zu) is %s, not %s", name, id, text ? text : "NULL",
+              expected ? expected : "NULL");
+    }
+
+    loc_apply_patch(&fr, NULL, 0);
+    loc_free(&fr);
+    free(patch);
+}
+
+/* "OK" is repeated, "Annuler" ends "Appuyez sur Annuler" and "sur" is inside it but doesn't end it */
+static const char shared_input[] =
+    "ok | OK\ncancel | Annuler\npress cancel | Appuyez sur Annuler\non | sur\nagain | OK\nretry | Réessayer\n"
+    "press ok | Appuyez sur OK\nyes | Oui\n";
+static const char *const shared_keys[] = {"ok", "cancel", "press cancel", "on", "again", "retry", "press ok", "yes", "missing"};
+static const char *const shared_values[] = {"OK", "Annuler", "Appuyez sur Annuler", "sur", "OK", "Réessayer", "Appuyez sur OK", "Oui", NULL};
+#define SHARED_KEY_COUNT (sizeof(shared_keys) / sizeof(shared_keys[0]))
+
+static void test_shared_strings(const char *loc_gen, const char *dir, const char *name, const char *const *options) {
+    CHECK(build(loc_gen, dir, "strings", shared_input, options), "[%s] loc_gen failed", name);
+    char path[512];
+    snprintf(path, sizeof(path), "%s/strings.fr.loc", dir);
+    loc_file fr = loc_load(path);
+    snprintf(path, sizeof(path), "%s/strings.en.loc", dir);
+    loc_file en = loc_load(path);
+    CHECK(fr.strings != NULL && en.strings != NULL, "[%s] can't load the files", name);
+    if(!fr.strings || !en.strings) {
+        loc_free(&fr);
+        loc_free(&en);
+        return;
+    }
+
+    const char *batch[SHARED_KEY_COUNT];
+    loc_get_strings(&fr, shared_keys, SHARED_KEY_COUNT, batch);
+    for(size_t i = 0; i < SHARED_KEY_COUNT; i++) {
+        const char *expected = shared_values[i];
+        const char *single = loc_get_string(&fr, shared_keys[i]);
+        CHECK(same_string(single, expected), "[%s] loc_get_string(\"%s\") is %s", name, shared_keys[i], single ? single : "NULL");
+        CHECK(same_string(batch[i], expected), "[%s] loc_get_strings(\"%s\") is %s", name, shared_keys[i], batch[i] ? batch[i] : "NULL");
+        // The source language's translations are its keys
+        const char *english = loc_get_string(&en, shared_keys[i]);
+        CHECK(same_string(english, expected ? shared_keys[i] : NULL), "[%s] en \"%s\" is %s", name, shared_keys[i],
+              english ? english : "NULL");
+        // Rows are in input order, the missing key has none
+        const char *by_id = loc_get_by_id(&fr, (uint32_t)i);
+        CHECK(same_string(by_id, expected), "[%s] loc_get_by_id(%zu) is %s", name, i, by_id ? by_id : "NULL");
+    }
+    loc_free(&fr);
+    loc_free(&en);
+}
+
+#define COMPRESSED_ROWS 2400
+#define COMPRESSED_VALUES 1200  /* rows share their string with the rows this many before and after them */
+
+static void compressed_key(size_t row, char *key, size_t size) {
+    snprintf(key, size, "key %zu", row);
+}
+
+/* About 300 bytes that don't compress to nothing, so the file has many blocks */
+static void compressed_value(size_t row, char *value, size_t size) {
+    size_t n = row % COMPRESSED_VALUES;
+    uint64_t state = n * 0x9e3779b97f4a7c15ull + 1;
+    int len = snprintf(value, size, "value %zu ", n);
+    while(len < 300 && (size_t)len + 1 < size) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        value[len++] = (char)('a' + (state >> 59) % 26);
+    }
+    value[len] = '\0';
+}
+
+/* A lookup's string, compared after every one of the next `lookups` lookups. Keys are picked far apart,
+ * so each lookup needs another block. */
+static void check_string_kept(loc_file *fr, const char *name, size_t row, size_t first_other, size_t lookups) {
+    char key[64], expected[512], other[64];
+    compressed_key(row, key, sizeof(key));
+    compressed_value(row, expected, sizeof(expected));
+    const char *text = loc_get_string(fr, key);
+    CHECK(same_string(text, expected), "[%s] %s is %s", name, key, text ? text : "NULL");
+    for(size_t i = 0; text && i < lookups; i++) {
+        compressed_key((first_other + i * 13) % COMPRESSED_ROWS, other, sizeof(other));
+        loc_get_string(fr, other);
+        if(strcmp(text, expected) != 0) {
+            CHECK(0, "[%s] the string of %s changed after %zu other lookups", name, key, i + 1);
+            break;
+        }
+    }
+}
+
+/* strings_kept: how many lookups a string has to outlast */
+static void test_compressed(const char *loc_gen, const char *dir, const char *name, const char *const *options, size_t strings_kept) {
+    size_t capacity = COMPRESSED_ROWS * 400;
+    char *text = (char *)malloc(capacity);
+    size_t len = 0;
+    for(size_t row = 0; row < COMPRESSED_ROWS; row++) {
+        char key[64], value[512];
+        compressed_key(row, key, sizeof(key));
+        compressed_value(row, value, sizeof(value));
+        len += (size_t)snprintf(text + len, capacity - len, "%s | %s\n", key, value);
+    }
+    CHECK(build(loc_gen, dir, "strings", text, options), "[%s] loc_gen failed", name);
+    free(text);
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/strings.fr.loc", dir);
+    loc_file fr = loc_load(path);
+    CHECK(fr.strings != NULL, "[%s] can't load %s", name, path);
+    if(!fr.strings) {
+        return;
+    }
+    CHECK(fr.block_count > LOC_BLOCK_CACHE_SIZE, "[%s] only %zu blocks", name, fr.block_count);
+
+    for(size_t row = 0; row < COMPRESSED_ROWS; row++) {
+        char key[64], expected[512];
+        compressed_key(row, key, sizeof(key));
+        compressed_value(row, expected, sizeof(expected));
+        const char *single = loc_get_string(&fr, key);
+        CHECK(same_string(single, expected), "[%s] loc_get_string(\"%s\") is %s", name, key, single ? single : "NULL");
+    }
+    const char *keys[16];
+    const char *batch[16];
+    char key_text[16][64];
+    for(size_t i = 0; i < 16; i++) {
+        compressed_key(i * 91 % COMPRESSED_ROWS, key_text[i], sizeof(key_text[i]));
+        keys[i] = key_text[i];
+    }
+    loc_get_strings(&fr, keys, 16, batch);
+    for(size_t i = 0; i < 16; i++) {
+        char expected[512];
+        compressed_value(i * 91 % COMPRESSED_ROWS, expected, sizeof(expected));
+        CHECK(same_string(batch[i], expected), "[%s] loc_get_strings(\"%s\") is %s", name, keys[i], batch[i] ? batch[i] : "NULL");
+    }
+
+    // A fresh block, then one decompressed long ago: looked up again it's as fresh as any
+    check_string_kept(&fr, name, 7, 100, strings_kept);
+    check_string_kept(&fr, name, 100, 1000, strings_kept);
+    check_string_kept(&fr, name, 7, 400, strings_kept);
+    loc_free(&fr);
+}
+
+int main(int argc, char **argv) {
+    const char *loc_gen = argc > 1 ? argv[1] : "./loc_gen";
+    char dir[] = "/tmp/loc_test_XXXXXX";
+    if(!mkdtemp(dir)) {
+        printf("Error: can't make a temporary directory\n");
+        return 1;
+    }
+    char sub[256];
+
+    snprintf(sub, sizeof(sub), "%s/reload", dir);
+    test_handle_reload(loc_gen, sub, 0);
+    snprintf(sub, sizeof(sub), "%s/reload_mapped", dir);
+    test_handle_reload(loc_gen, sub, LOC_LOAD_MMAP);
+
+    static const struct {
+        const char *name;
+        const char *options[3];
+    } indexes[] = {
+        {"chained", {NULL}},
+        {"mph", {"--mph", NULL}},
+        {"flat", {"--flat", NULL}},
+        {"dedup", {"--dedup", NULL}},
+        {"share-suffixes", {"--share-suffixes", NULL}},
+        {"mph dedup", {"--mph", "--dedup", NULL}},
+        {"flat share-suffixes", {"--flat", "--share-suffixes", NULL}},
+    };
+    for(size_t i = 0; i < sizeof(indexes) / sizeof(indexes[0]); i++) {
+        snprintf(sub, sizeof(sub), "%s/patch_in_place_%zu", dir, i);
+        test_patch(loc_gen, sub, indexes[i].name, indexes[i].options, &patch_in_place);
+        snprintf(sub, sizeof(sub), "%s/patch_moved_%zu", dir, i);
+        test_patch(loc_gen, sub, indexes[i].name, indexes[i].options, &patch_moved);
+    }
+
+    static const struct {
+        const char *name;
+        const char *options[4];
+    } shared[] = {
+        {"dedup", {"--dedup", NULL}},
+        {"share-suffixes", {"--share-suffixes", NULL}},
+        {"mph share-suffixes", {"--mph", "--share-suffixes", NULL}},
+        {"flat share-suffixes", {"--flat", "--share-suffixes", NULL}},
+        {"compressed share-suffixes", {"--compress", "--share-suffixes", NULL}},
+    };
+    for(size_t i = 0; i < sizeof(shared) / sizeof(shared[0]); i++) {
+        snprintf(sub, sizeof(sub), "%s/shared_%zu", dir, i);
+        test_shared_strings(loc_gen, sub, shared[i].name, shared[i].options);
+    }
+
+    static const struct {
+        const char *name;
+        const char *options[4];
+        size_t strings_kept;
+    } compressed[] = {
+        {"compressed chained", {"--compress", NULL}, LOC_BLOCK_CACHE_SIZE - 1},
+        {"compressed mph", {"--compress", "--mph", NULL}, LOC_BLOCK_CACHE_SIZE - 1},
+        {"compressed flat", {"--compress", "--flat", NULL}, LOC_BLOCK_CACHE_SIZE - 1},
+        {"compressed dedup", {"--compress", "--dedup", NULL}, LOC_BLOCK_CACHE_SIZE / 2 - 1},
+        {"compressed mph share-suffixes", {"--compress", "--mph", "--share-suffixes", NULL}, LOC_BLOCK_CACHE_SIZE / 2 - 1},
+    };
+    for(size_t i = 0; i < sizeof(compressed) / sizeof(compressed[0]); i++) {
+        snprintf(sub, sizeof(sub), "%s/compressed_%zu", dir, i);
+        test_compressed(loc_gen, sub, compressed[i].name, compressed[i].options, compressed[i].strings_kept);
+    }
+
+    char command[600];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    if(system(command) != 0) {
+        printf("Warning: couldn't remove %s\n", dir);
+    }
+
+    if(failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}